@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+// Non-owning view of a contiguous array, e.g. a vector or a section of a mapped snapshot.
+template <typename T>
+class ArrayView {
+public:
+    ArrayView() = default;
+
+    ArrayView(const T* data, size_t size)
+        : data_(data)
+        , size_(size) {
+    }
+
+    ArrayView(const std::vector<T>& values)
+        : data_(values.data())
+        , size_(values.size()) {
+    }
+
+    const T* begin() const {
+        return data_;
+    }
+
+    const T* end() const {
+        return data_ + size_;
+    }
+
+    const T* data() const {
+        return data_;
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+    bool empty() const {
+        return size_ == 0;
+    }
+
+    const T& operator[](size_t index) const {
+        return data_[index];
+    }
+
+    const T& back() const {
+        return data_[size_ - 1];
+    }
+
+    ArrayView Slice(size_t first, size_t count) const {
+        return {data_ + first, count};
+    }
+
+private:
+    const T* data_ = nullptr;
+    size_t size_ = 0;
+};
@@ -0,0 +1,272 @@
+#include "benchmark.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <execution>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <unordered_set>
+
+#include "process_queries.h"
+#include "remove_duplicates.h"
+#include "search_server.h"
+
+using namespace std;
+
+struct Corpus {
+    vector<string> vocabulary;
+    // weights of the vocabulary, by rank
+    discrete_distribution<size_t> ranks;
+    vector<string> stop_words;
+    vector<string> documents;
+};
+
+// Latencies of the calls of one operation under one set of parameters.
+struct OperationResult {
+    string operation;
+    string policy;
+    // 0 if the operation takes no query
+    size_t query_length = 0;
+    double minus_word_prob = 0.0;
+    vector<double> latencies;
+    // queries handled by a call, for batch operations
+    size_t items_per_call = 1;
+    size_t peak_resident_kb = 0;
+};
+
+static vector<string> GenerateVocabulary(mt19937& generator, size_t word_count) {
+    unordered_set<string> seen;
+    vector<string> words;
+    while (words.size() < word_count) {
+        string word(uniform_int_distribution<size_t>(2, 12)(generator), ' ');
+        for (char& c : word) {
+            c = uniform_int_distribution<int>('a', 'z')(generator);
+        }
+        if (seen.insert(word).second) {
+            words.push_back(move(word));
+        }
+    }
+    return words;
+}
+
+static string GenerateText(mt19937& generator, Corpus& corpus, size_t word_count, double minus_word_prob = 0.0) {
+    string text;
+    for (size_t i = 0; i < word_count; ++i) {
+        if (!text.empty()) {
+            text.push_back(' ');
+        }
+        if (minus_word_prob > 0.0 && uniform_real_distribution<>(0, 1)(generator) < minus_word_prob) {
+            text.push_back('-');
+        }
+        text += corpus.vocabulary[corpus.ranks(generator)];
+    }
+    return text;
+}
+
+static Corpus GenerateCorpus(mt19937& generator, const BenchmarkConfig& config, size_t document_count) {
+    Corpus corpus;
+    corpus.vocabulary = GenerateVocabulary(generator, config.vocabulary_size);
+    vector<double> weights;
+    for (size_t rank = 1; rank <= config.vocabulary_size; ++rank) {
+        weights.push_back(1.0 / pow(rank, config.zipf_exponent));
+    }
+    corpus.ranks = discrete_distribution<size_t>(weights.begin(), weights.end());
+    corpus.stop_words.assign(corpus.vocabulary.begin(), corpus.vocabulary.begin() + min(config.stop_word_count, corpus.vocabulary.size()));
+
+    // log-uniform, so short documents are common and long ones rare
+    uniform_real_distribution<> log_length(log(config.min_document_length), log(config.max_document_length + 1));
+    for (size_t i = 0; i < document_count; ++i) {
+        const auto length = static_cast<size_t>(exp(log_length(generator)));
+        corpus.documents.push_back(GenerateText(generator, corpus, min(length, config.max_document_length)));
+    }
+    return corpus;
+}
+
+template <typename Operation>
+static double MeasureSeconds(Operation operation) {
+    const auto start = chrono::steady_clock::now();
+    operation();
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// Peak resident memory since the last reset, 0 where /proc is not available.
+static size_t GetPeakResidentKb() {
+    ifstream status("/proc/self/status"s);
+    for (string line; getline(status, line);) {
+        if (line.rfind("VmHWM:"s, 0) == 0) {
+            return stoul(line.substr(6));
+        }
+    }
+    return 0;
+}
+
+static void ResetPeakResident() {
+    ofstream("/proc/self/clear_refs"s) << "5"s;
+}
+
+// Nearest-rank percentile of sorted latencies.
+static double GetPercentile(const vector<double>& sorted_latencies, double percent) {
+    if (sorted_latencies.empty()) {
+        return 0.0;
+    }
+    const auto rank = static_cast<size_t>(ceil(percent / 100 * sorted_latencies.size()));
+    return sorted_latencies[max<size_t>(rank, 1) - 1];
+}
+
+static void WriteResult(ostream& out, OperationResult& result) {
+    sort(result.latencies.begin(), result.latencies.end());
+    double total_seconds = 0.0;
+    for (const double seconds : result.latencies) {
+        total_seconds += seconds;
+    }
+    const size_t item_count = result.latencies.size() * result.items_per_call;
+    out << "{\"operation\": \""s << result.operation << '"';
+    if (!result.policy.empty()) {
+        out << ", \"policy\": \""s << result.policy << '"';
+    }
+    if (result.query_length > 0) {
+        out << ", \"query_length\": "s << result.query_length << ", \"minus_word_prob\": "s << result.minus_word_prob;
+    }
+    out << ", \"calls\": "s << result.latencies.size() << ", \"items\": "s << item_count
+        << ", \"p50_us\": "s << GetPercentile(result.latencies, 50) * 1e6
+        << ", \"p95_us\": "s << GetPercentile(result.latencies, 95) * 1e6
+        << ", \"p99_us\": "s << GetPercentile(result.latencies, 99) * 1e6
+        << ", \"qps\": "s << (total_seconds > 0.0 ? item_count / total_seconds : 0.0)
+        << ", \"peak_rss_kb\": "s << result.peak_resident_kb << '}';
+}
+
+static vector<OperationResult> RunCorpusBenchmarks(mt19937& generator, const BenchmarkConfig& config, Corpus& corpus) {
+    vector<OperationResult> results;
+    const int document_count = static_cast<int>(corpus.documents.size());
+
+    ResetPeakResident();
+    SearchServer search_server(corpus.stop_words);
+    // repeated queries would be answered from the cache
+    search_server.SetQueryCacheCapacity(0);
+    OperationResult& add = results.emplace_back();
+    add.operation = "AddDocument"s;
+    for (int id = 0; id < document_count; ++id) {
+        const vector<int> ratings = {uniform_int_distribution<int>(-10, 10)(generator)};
+        add.latencies.push_back(MeasureSeconds([&] {
+            search_server.AddDocument(id, corpus.documents[id], DocumentStatus::ACTUAL, ratings);
+        }));
+    }
+    add.peak_resident_kb = GetPeakResidentKb();
+
+    for (const size_t query_length : config.query_lengths) {
+        for (const double minus_word_prob : config.minus_word_probs) {
+            vector<string> queries;
+            for (size_t i = 0; i < config.query_count; ++i) {
+                queries.push_back(GenerateText(generator, corpus, query_length, minus_word_prob));
+            }
+            const auto add_result = [&](string operation, string policy) -> OperationResult& {
+                ResetPeakResident();
+                OperationResult& result = results.emplace_back();
+                result.operation = move(operation);
+                result.policy = move(policy);
+                result.query_length = query_length;
+                result.minus_word_prob = minus_word_prob;
+                return result;
+            };
+
+            OperationResult& find_seq = add_result("FindTopDocuments"s, "seq"s);
+            for (const string& query : queries) {
+                find_seq.latencies.push_back(MeasureSeconds([&] {
+                    search_server.FindTopDocuments(execution::seq, query);
+                }));
+            }
+            find_seq.peak_resident_kb = GetPeakResidentKb();
+
+            OperationResult& find_par = add_result("FindTopDocuments"s, "par"s);
+            for (const string& query : queries) {
+                find_par.latencies.push_back(MeasureSeconds([&] {
+                    search_server.FindTopDocuments(execution::par, query);
+                }));
+            }
+            find_par.peak_resident_kb = GetPeakResidentKb();
+
+            OperationResult& match = add_result("MatchDocument"s, "seq"s);
+            for (const string& query : queries) {
+                const int id = uniform_int_distribution<int>(0, document_count - 1)(generator);
+                match.latencies.push_back(MeasureSeconds([&] {
+                    search_server.MatchDocument(query, id);
+                }));
+            }
+            match.peak_resident_kb = GetPeakResidentKb();
+
+            // ten batches, so percentiles say something about batch latency
+            OperationResult& process = add_result("ProcessQueries"s, ""s);
+            process.items_per_call = max<size_t>(queries.size() / 10, 1);
+            for (size_t first = 0; first + process.items_per_call <= queries.size(); first += process.items_per_call) {
+                const vector<string> batch(queries.begin() + first, queries.begin() + first + process.items_per_call);
+                process.latencies.push_back(MeasureSeconds([&] {
+                    ProcessQueries(search_server, batch);
+                }));
+            }
+            process.peak_resident_kb = GetPeakResidentKb();
+        }
+    }
+
+    // duplicates get ids past the corpus, so the originals survive
+    const auto duplicate_count = static_cast<int>(document_count * config.duplicate_share);
+    for (int i = 0; i < duplicate_count; ++i) {
+        const int original = uniform_int_distribution<int>(0, document_count - 1)(generator);
+        search_server.AddDocument(document_count + i, corpus.documents[original], DocumentStatus::ACTUAL, {1});
+    }
+    ResetPeakResident();
+    OperationResult& remove_duplicates = results.emplace_back();
+    remove_duplicates.operation = "RemoveDuplicates"s;
+    remove_duplicates.items_per_call = search_server.GetDocumentCount();
+    // it reports every removed document on cout, which may be where the JSON goes
+    streambuf* const cout_buffer = cout.rdbuf(nullptr);
+    remove_duplicates.latencies.push_back(MeasureSeconds([&] {
+        RemoveDuplicates(search_server);
+    }));
+    cout.rdbuf(cout_buffer);
+    remove_duplicates.peak_resident_kb = GetPeakResidentKb();
+
+    vector<int> ids(search_server.begin(), search_server.end());
+    shuffle(ids.begin(), ids.end(), generator);
+    ids.resize(static_cast<size_t>(ids.size() * config.removed_share));
+    ResetPeakResident();
+    OperationResult& remove = results.emplace_back();
+    remove.operation = "RemoveDocument"s;
+    for (const int id : ids) {
+        remove.latencies.push_back(MeasureSeconds([&] {
+            search_server.RemoveDocument(id);
+        }));
+    }
+    remove.peak_resident_kb = GetPeakResidentKb();
+    return results;
+}
+
+void RunBenchmarks(const BenchmarkConfig& config, ostream& out) {
+    mt19937 generator(config.seed);
+    out << "{\n  \"config\": {\"vocabulary_size\": "s << config.vocabulary_size << ", \"zipf_exponent\": "s << config.zipf_exponent
+        << ", \"stop_word_count\": "s << config.stop_word_count << ", \"min_document_length\": "s << config.min_document_length
+        << ", \"max_document_length\": "s << config.max_document_length << ", \"query_count\": "s << config.query_count
+        << ", \"seed\": "s << config.seed << "},\n  \"corpora\": ["s;
+    bool is_first_corpus = true;
+    for (const size_t document_count : config.document_counts) {
+        Corpus corpus = GenerateCorpus(generator, config, document_count);
+        size_t word_count = 0;
+        for (const string& document : corpus.documents) {
+            word_count += count(document.begin(), document.end(), ' ') + 1;
+        }
+        auto results = RunCorpusBenchmarks(generator, config, corpus);
+
+        out << (is_first_corpus ? "\n"s : ",\n"s) << "    {\"documents\": "s << document_count
+            << ", \"average_document_length\": "s << word_count * 1.0 / max<size_t>(document_count, 1) << ", \"results\": ["s;
+        for (size_t i = 0; i < results.size(); ++i) {
+            out << (i == 0 ? "\n      "s : ",\n      "s);
+            WriteResult(out, results[i]);
+        }
+        out << "\n    ]}"s;
+        is_first_corpus = false;
+    }
+    out << "\n  ]\n}"s << endl;
+}
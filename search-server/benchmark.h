@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+// Settings of the synthetic-corpus benchmark suite. Words are drawn from a
+// random vocabulary with Zipf-distributed frequencies, document lengths from
+// a log-uniform distribution, so both have the long tail of natural text.
+struct BenchmarkConfig {
+    std::vector<size_t> document_counts = {10'000, 50'000};
+    size_t vocabulary_size = 20'000;
+    // frequency of the word of rank r falls as 1 / r^zipf_exponent
+    double zipf_exponent = 1.0;
+    // the most frequent words are stop words
+    size_t stop_word_count = 10;
+    size_t min_document_length = 5;
+    size_t max_document_length = 300;
+    std::vector<size_t> query_lengths = {2, 8, 32};
+    std::vector<double> minus_word_probs = {0.0, 0.2};
+    // queries per query length and minus-word probability
+    size_t query_count = 300;
+    // share of the corpus removed document by document
+    double removed_share = 0.1;
+    // share of the corpus added again as duplicates before RemoveDuplicates
+    double duplicate_share = 0.05;
+    uint32_t seed = 42;
+};
+
+// Runs AddDocument, FindTopDocuments (seq and par), MatchDocument,
+// ProcessQueries, RemoveDocument and RemoveDuplicates on every corpus of the
+// config and writes p50/p95/p99 latency, throughput and peak resident memory
+// of each as JSON to out. Field names stay fixed, so runs can be diffed.
+void RunBenchmarks(const BenchmarkConfig& config, std::ostream& out);
@@ -0,0 +1,68 @@
+#include "concurrent_search_server.h"
+
+#include <thread>
+
+using namespace std;
+
+ConcurrentSearchServer::ConcurrentSearchServer(const string& stop_words_text)
+    : server_(stop_words_text)
+    , version_(server_.CreateVersion().release())
+{
+}
+
+ConcurrentSearchServer::ConcurrentSearchServer(string_view stop_words_text)
+    : server_(stop_words_text)
+    , version_(server_.CreateVersion().release())
+{
+}
+
+ConcurrentSearchServer::~ConcurrentSearchServer() {
+    delete version_.load();
+}
+
+void ConcurrentSearchServer::AddDocument(int document_id, string_view document, DocumentStatus status, const vector<int>& ratings) {
+    const lock_guard lock(writer_mutex_);
+    server_.AddDocument(document_id, document, status, ratings);
+}
+
+void ConcurrentSearchServer::RemoveDocument(int document_id) {
+    const lock_guard lock(writer_mutex_);
+    server_.RemoveDocument(document_id);
+}
+
+void ConcurrentSearchServer::Compact() {
+    const lock_guard lock(writer_mutex_);
+    server_.Compact();
+}
+
+void ConcurrentSearchServer::Publish() {
+    const lock_guard lock(writer_mutex_);
+    const SearchServer* previous = version_.exchange(server_.CreateVersion().release());
+    // Queries of the new epoch load the new version. Those that may still
+    // hold the previous one started in the old epoch, wait until they end.
+    const uint64_t epoch = epoch_.fetch_add(1);
+    while (readers_[epoch % 2].load() != 0) {
+        this_thread::yield();
+    }
+    delete previous;
+}
+
+ConcurrentSearchServer::ReaderGuard::ReaderGuard(const ConcurrentSearchServer& server) {
+    // Counting in under an epoch that has just ended could go unnoticed by
+    // Publish, so the epoch is checked again after counting in.
+    uint64_t epoch = server.epoch_.load();
+    while (true) {
+        readers_ = &server.readers_[epoch % 2];
+        readers_->fetch_add(1);
+        const uint64_t current_epoch = server.epoch_.load();
+        if (current_epoch == epoch) {
+            break;
+        }
+        readers_->fetch_sub(1);
+        epoch = current_epoch;
+    }
+}
+
+ConcurrentSearchServer::ReaderGuard::~ReaderGuard() {
+    readers_->fetch_sub(1);
+}
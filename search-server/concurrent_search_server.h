@@ -0,0 +1,93 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "search_server.h"
+
+// Serves queries while documents are added and removed.
+// Writers change a private SearchServer one at a time, and Publish() makes
+// their changes visible by swapping in a new read-only version of it.
+// A query runs on the version that was current when it started and never
+// waits: it only counts itself in, so Publish() can tell when nobody is left
+// on the previous version and destroy it (read-copy-update). Published
+// versions have no query cache, whose lookups would lock.
+class ConcurrentSearchServer {
+public:
+    template <typename StringContainer>
+    explicit ConcurrentSearchServer(const StringContainer& stop_words);
+    explicit ConcurrentSearchServer(const std::string& stop_words_text);
+    explicit ConcurrentSearchServer(std::string_view stop_words_text);
+    ConcurrentSearchServer(const ConcurrentSearchServer&) = delete;
+    ConcurrentSearchServer& operator=(const ConcurrentSearchServer&) = delete;
+    // No query may be running.
+    ~ConcurrentSearchServer();
+
+    void AddDocument(int document_id, std::string_view document, DocumentStatus status, const std::vector<int>& ratings);
+    template <typename ExecutionPolicy>
+    void AddDocuments(ExecutionPolicy&& policy, const std::vector<DocumentToAdd>& documents);
+    void RemoveDocument(int document_id);
+    template <typename ExecutionPolicy>
+    void RemoveDocuments(ExecutionPolicy&& policy, const std::vector<int>& document_ids);
+    // Published versions keep the index they were made from.
+    void Compact();
+
+    // Makes the changes made so far visible to queries started afterwards.
+    // Returns once no query runs on the previous version any more.
+    void Publish();
+
+    // Returns reader(const SearchServer&) called on the latest published version.
+    template <typename Reader>
+    auto Read(Reader reader) const;
+
+private:
+    // Counts a query in under the epoch it started in and out when it ends.
+    class ReaderGuard {
+    public:
+        explicit ReaderGuard(const ConcurrentSearchServer& server);
+        ReaderGuard(const ReaderGuard&) = delete;
+        ReaderGuard& operator=(const ReaderGuard&) = delete;
+        ~ReaderGuard();
+
+    private:
+        std::atomic<size_t>* readers_;
+    };
+
+    std::mutex writer_mutex_;
+    SearchServer server_;
+    std::atomic<const SearchServer*> version_;
+    // Queries in flight, by the parity of the epoch they started in. Publish
+    // starts a new epoch and waits for the queries of the previous one only.
+    mutable std::atomic<uint64_t> epoch_{0};
+    mutable std::atomic<size_t> readers_[2] = {};
+};
+
+template <typename StringContainer>
+ConcurrentSearchServer::ConcurrentSearchServer(const StringContainer& stop_words)
+    : server_(stop_words)
+    , version_(server_.CreateVersion().release())
+{
+}
+
+template <typename ExecutionPolicy>
+void ConcurrentSearchServer::AddDocuments(ExecutionPolicy&& policy, const std::vector<DocumentToAdd>& documents) {
+    const std::lock_guard lock(writer_mutex_);
+    server_.AddDocuments(policy, documents);
+}
+
+template <typename ExecutionPolicy>
+void ConcurrentSearchServer::RemoveDocuments(ExecutionPolicy&& policy, const std::vector<int>& document_ids) {
+    const std::lock_guard lock(writer_mutex_);
+    server_.RemoveDocuments(policy, document_ids);
+}
+
+template <typename Reader>
+auto ConcurrentSearchServer::Read(Reader reader) const {
+    const ReaderGuard guard(*this);
+    return reader(*version_.load());
+}
@@ -0,0 +1,931 @@
+#include "inverted_index.h"
+
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <functional>
+
+using namespace std;
+
+// Bits needed to write value, zero for zero.
+static unsigned GetBitWidth(uint64_t value) {
+    unsigned width = 0;
+    for (; value != 0; value >>= 1) {
+        ++width;
+    }
+    return width;
+}
+
+// Appends the low width bits of value at bit position of the words from first_word on.
+static void WriteBits(vector<uint64_t>& words, size_t first_word, size_t& position, uint64_t value, unsigned width) {
+    if (width == 0) {
+        return;
+    }
+    const size_t word = first_word + position / 64;
+    const unsigned shift = position % 64;
+    if (words.size() <= word) {
+        words.push_back(0);
+    }
+    words[word] |= value << shift;
+    if (shift + width > 64) {
+        words.push_back(value >> (64 - shift));
+    }
+    position += width;
+}
+
+// Reads width bits at bit position. Words hold a zero word past the last
+// one, so the word after the value can be read without a branch.
+static uint64_t ReadBits(const uint64_t* words, size_t& position, unsigned width, uint64_t mask) {
+    const size_t word = position / 64;
+    const unsigned shift = position % 64;
+    const uint64_t value = (words[word] >> shift) | (words[word + 1] << 1 << (63 - shift));
+    position += width;
+    return value & mask;
+}
+
+static uint64_t GetBitMask(unsigned width) {
+    return width == 64 ? ~uint64_t{0} : (uint64_t{1} << width) - 1;
+}
+
+InvertedIndex::InvertedIndex(ScoringMode scoring_mode)
+    : scoring_mode_(scoring_mode) {
+}
+
+InvertedIndex::InvertedIndex(const Snapshot& snapshot, ScoringMode scoring_mode)
+    : scoring_mode_(scoring_mode)
+    , base_terms_(snapshot.Get<TermDictionary::Slot>(SnapshotSection::TERM_SLOTS),
+                  snapshot.Get<uint64_t>(SnapshotSection::TERM_OFFSETS),
+                  snapshot.Get<char>(SnapshotSection::TERM_BYTES)) {
+    const auto segment = make_shared<const Segment>(snapshot);
+    // offsets, ordinals and term ids index other arrays unchecked later on,
+    // so all of them are checked here in one pass over the sections
+    const auto is_offsets_of = [](ArrayView<uint64_t> offsets, size_t count, size_t total) {
+        return offsets.size() == count + 1 && offsets[0] == 0 && offsets[count] == total && is_sorted(offsets.begin(), offsets.end());
+    };
+    const size_t term_count = base_terms_.size();
+    if (!is_offsets_of(segment->posting_offsets, term_count, segment->posting_documents.size())
+        || segment->posting_freqs.size() != segment->posting_documents.size()
+        || segment->posting_max_freqs.size() != term_count
+        || !is_offsets_of(segment->block_offsets, term_count, segment->block_max_freqs.size())
+        || segment->document_term_offsets.empty()
+        || !is_offsets_of(segment->document_term_offsets, segment->GetDocumentCount(), segment->document_terms.size())) {
+        throw invalid_argument("Invalid snapshot index"s);
+    }
+    for (TermId term = 0; term < term_count; ++term) {
+        const uint64_t first = segment->posting_offsets[term];
+        const uint64_t count = segment->posting_offsets[term + 1] - first;
+        const auto documents = segment->posting_documents.Slice(first, count);
+        if (segment->block_offsets[term + 1] - segment->block_offsets[term] != (count + BLOCK_SIZE - 1) / BLOCK_SIZE
+            || adjacent_find(documents.begin(), documents.end(), greater_equal<>()) != documents.end()
+            || (count != 0 && documents.back() >= segment->GetEndDocument())) {
+            throw invalid_argument("Invalid snapshot postings"s);
+        }
+    }
+    for (DocumentOrdinal document = 0; document < segment->GetDocumentCount(); ++document) {
+        const auto terms = segment->GetDocumentTerms(document);
+        const auto is_out_of_order = [](const TermFreq& lhs, const TermFreq& rhs) {
+            return lhs.term >= rhs.term;
+        };
+        if (adjacent_find(terms.begin(), terms.end(), is_out_of_order) != terms.end() || (!terms.empty() && terms.back().term >= term_count)) {
+            throw invalid_argument("Invalid snapshot document terms"s);
+        }
+    }
+    mutable_first_document_ = segment->GetEndDocument();
+    segments_.push_back({segment});
+    document_freqs_.resize(term_count);
+    log_document_freqs_.resize(term_count);
+    for (TermId term = 0; term < term_count; ++term) {
+        document_freqs_[term] = static_cast<uint32_t>(segment->posting_offsets[term + 1] - segment->posting_offsets[term]);
+        UpdateLogDocumentFreq(term);
+    }
+}
+
+InvertedIndex::InvertedIndex(const InvertedIndex& other)
+    : scoring_mode_(other.scoring_mode_)
+    , base_terms_(other.base_terms_)
+    , dictionary_(other.dictionary_)
+    , document_freqs_(other.document_freqs_)
+    , log_document_freqs_(other.log_document_freqs_)
+    , segments_(other.segments_)
+    , mutable_first_document_(other.mutable_first_document_) {
+    // the mutable segment is frozen on the way: a few flat arrays copy faster than a vector per term and document
+    if (!other.document_terms_.empty()) {
+        SegmentState& state = segments_.emplace_back(SegmentState{other.BuildMutableSegment()});
+        other.ForEachMutableRemoved([&state](DocumentOrdinal document) {
+            state.MarkDropped(document);
+        });
+        mutable_first_document_ = state.segment->GetEndDocument();
+    }
+}
+
+TermId InvertedIndex::AddTerm(string_view term) {
+    if (const TermId* base_term = base_terms_.Find(term)) {
+        return *base_term;
+    }
+    const TermId term_id = static_cast<TermId>(base_terms_.size()) + dictionary_.Insert(term);
+    if (document_freqs_.size() <= term_id) {
+        document_freqs_.resize(term_id + 1);
+        log_document_freqs_.resize(term_id + 1);
+        MetricsRegistry::Get().Add(IngestionCounter::TERMS_ADDED, 1);
+    }
+    return term_id;
+}
+
+optional<TermId> InvertedIndex::FindTerm(string_view term) const {
+    if (const TermId* base_term = base_terms_.Find(term)) {
+        return *base_term;
+    }
+    if (const TermId* term_id = dictionary_.Find(term)) {
+        return static_cast<TermId>(base_terms_.size()) + *term_id;
+    }
+    return nullopt;
+}
+
+string_view InvertedIndex::GetTerm(TermId term) const {
+    return term < base_terms_.size() ? base_terms_.GetTerm(term) : dictionary_.GetTerm(term - base_terms_.size());
+}
+
+size_t InvertedIndex::GetTermCount() const {
+    return base_terms_.size() + dictionary_.size();
+}
+
+void InvertedIndex::AddDocument(DocumentOrdinal document, const vector<string_view>& words) {
+    vector<TermId> word_terms;
+    word_terms.reserve(words.size());
+    for (const string_view word : words) {
+        word_terms.push_back(AddTerm(word));
+    }
+    sort(word_terms.begin(), word_terms.end());
+
+    if (document_terms_.size() <= document - mutable_first_document_) {
+        document_terms_.resize(document - mutable_first_document_ + 1);
+    }
+    auto& document_terms = GetMutableDocumentTerms(document);
+    assert(document_terms.empty());
+
+    // frequencies are summed word by word to stay bit-identical with the old map index
+    const double inv_word_count = 1.0 / words.size();
+    for (const TermId term : word_terms) {
+        if (document_terms.empty() || document_terms.back().term != term) {
+            document_terms.push_back({term, 0.0});
+        }
+        document_terms.back().freq += inv_word_count;
+    }
+    document_terms.shrink_to_fit();
+
+    for (const auto [term, freq] : document_terms) {
+        GetMutablePostings(term).Insert(document, freq);
+        ++document_freqs_[term];
+        UpdateLogDocumentFreq(term);
+    }
+    MetricsRegistry::Get().Add(IngestionCounter::DOCUMENTS_ADDED, 1);
+    MetricsRegistry::Get().Add(IngestionCounter::POSTINGS_ADDED, document_terms.size());
+    UpdateSegments();
+}
+
+void InvertedIndex::CountTermFreqs(DocumentOrdinal document, const vector<string_view>& words, TermDictionary& chunk_terms) {
+    thread_local vector<TermId> word_terms;
+    word_terms.clear();
+    for (const string_view word : words) {
+        word_terms.push_back(chunk_terms.Insert(word));
+    }
+    sort(word_terms.begin(), word_terms.end());
+
+    auto& document_terms = GetMutableDocumentTerms(document);
+    assert(document_terms.empty());
+    // summed word by word like in AddDocument
+    const double inv_word_count = 1.0 / words.size();
+    for (const TermId term : word_terms) {
+        if (document_terms.empty() || document_terms.back().term != term) {
+            document_terms.push_back({term, 0.0});
+        }
+        document_terms.back().freq += inv_word_count;
+    }
+    document_terms.shrink_to_fit();
+}
+
+void InvertedIndex::MergeTermFreqs(DocumentOrdinal first, DocumentOrdinal last, const TermDictionary& chunk_terms) {
+    vector<TermId> global_terms;
+    global_terms.reserve(chunk_terms.size());
+    for (const string_view term : chunk_terms) {
+        global_terms.push_back(AddTerm(term));
+    }
+    for (DocumentOrdinal document = first; document < last; ++document) {
+        for (auto& [term, freq] : GetMutableDocumentTerms(document)) {
+            term = global_terms[term];
+            GetMutablePostings(term).Insert(document, freq);
+            ++document_freqs_[term];
+        }
+    }
+    // a logarithm per term of the chunk rather than per posting
+    for (const TermId term : global_terms) {
+        UpdateLogDocumentFreq(term);
+    }
+}
+
+void InvertedIndex::RemoveDocument(DocumentOrdinal document) {
+    RemoveDocument(execution::seq, document);
+}
+
+void InvertedIndex::RemovePosting(TermId term, DocumentOrdinal document) {
+    // the posting exists, so the list does too and may be patched concurrently
+    postings_[term].Erase(document);
+}
+
+size_t InvertedIndex::FindSegment(DocumentOrdinal document) const {
+    const auto it = upper_bound(segments_.begin(), segments_.end(), document, [](DocumentOrdinal lhs, const SegmentState& rhs) {
+        return lhs < rhs.segment->first_document;
+    });
+    if (it == segments_.begin() || document >= prev(it)->segment->GetEndDocument()) {
+        return segments_.size();
+    }
+    return prev(it) - segments_.begin();
+}
+
+void InvertedIndex::RemoveFrozenDocument(DocumentOrdinal document, vector<TermId>& removed_terms) {
+    const size_t segment = FindSegment(document);
+    if (segment < segments_.size() && !segments_[segment].IsRemoved(document)) {
+        segments_[segment].Remove(document);
+        for (const auto [term, freq] : segments_[segment].segment->GetDocumentTerms(document)) {
+            removed_terms.push_back(term);
+        }
+        MetricsRegistry::Get().Add(IngestionCounter::DOCUMENTS_REMOVED, 1);
+    }
+}
+
+void InvertedIndex::DecreaseDocumentFreqs(const vector<TermId>& terms) {
+    MetricsRegistry::Get().Add(IngestionCounter::POSTINGS_REMOVED, terms.size());
+    for (const TermId term : terms) {
+        --document_freqs_[term];
+    }
+    // a logarithm per term, however many removed documents hold it
+    thread_local vector<TermId> distinct_terms;
+    distinct_terms.assign(terms.begin(), terms.end());
+    sort(distinct_terms.begin(), distinct_terms.end());
+    distinct_terms.erase(unique(distinct_terms.begin(), distinct_terms.end()), distinct_terms.end());
+    for (const TermId term : distinct_terms) {
+        UpdateLogDocumentFreq(term);
+    }
+}
+
+void InvertedIndex::UpdateLogDocumentFreq(TermId term) {
+    log_document_freqs_[term] = document_freqs_[term] > 0 ? log(document_freqs_[term]) : 0.0;
+}
+
+bool InvertedIndex::IsRemoved(DocumentOrdinal document) const {
+    if (document >= mutable_first_document_) {
+        const size_t offset = document - mutable_first_document_;
+        return offset / 64 < mutable_removed_.size() && (mutable_removed_[offset / 64] >> (offset % 64) & 1) != 0;
+    }
+    const size_t segment = FindSegment(document);
+    return segment < segments_.size() && segments_[segment].IsRemoved(document);
+}
+
+ArrayView<InvertedIndex::TermFreq> InvertedIndex::GetDocumentTerms(DocumentOrdinal document) const {
+    if (document >= mutable_first_document_) {
+        const size_t offset = document - mutable_first_document_;
+        return offset < document_terms_.size() ? ArrayView<TermFreq>(document_terms_[offset]) : ArrayView<TermFreq>();
+    }
+    const size_t segment = FindSegment(document);
+    return segment < segments_.size() ? segments_[segment].segment->GetDocumentTerms(document) : ArrayView<TermFreq>();
+}
+
+const InvertedIndex::TermFreq* InvertedIndex::FindDocumentTerm(DocumentOrdinal document, TermId term) const {
+    const auto terms = GetDocumentTerms(document);
+    const auto it = lower_bound(terms.begin(), terms.end(), term, [](const TermFreq& lhs, TermId rhs) {
+        return lhs.term < rhs;
+    });
+    return it != terms.end() && it->term == term ? it : nullptr;
+}
+
+size_t InvertedIndex::GetSegmentCount() const {
+    return segments_.size() + (document_terms_.empty() ? 0 : 1);
+}
+
+size_t InvertedIndex::GetMemoryUsage() const {
+    size_t bytes = dictionary_.GetMemoryUsage();
+    bytes += document_freqs_.capacity() * sizeof(uint32_t) + log_document_freqs_.capacity() * sizeof(double);
+    bytes += postings_.capacity() * sizeof(PostingList);
+    for (const auto& postings : postings_) {
+        bytes += postings.documents.capacity() * sizeof(DocumentOrdinal)
+            + (postings.term_freqs.capacity() + postings.block_max_freqs.capacity()) * sizeof(double);
+    }
+    bytes += document_terms_.capacity() * sizeof(vector<TermFreq>) + mutable_removed_.capacity() * sizeof(uint64_t);
+    for (const auto& terms : document_terms_) {
+        bytes += terms.capacity() * sizeof(TermFreq);
+    }
+    for (const SegmentState& state : segments_) {
+        bytes += state.segment->GetMemoryUsage();
+        bytes += state.removed.capacity() * sizeof(uint64_t);
+    }
+    return bytes;
+}
+
+size_t InvertedIndex::GetPostingMemoryUsage() const {
+    size_t bytes = postings_.size() * sizeof(PostingList);
+    for (const auto& postings : postings_) {
+        bytes += postings.documents.size() * sizeof(DocumentOrdinal)
+            + (postings.term_freqs.size() + postings.block_max_freqs.size()) * sizeof(double);
+    }
+    for (const SegmentState& state : segments_) {
+        bytes += state.segment->GetPostingMemoryUsage();
+    }
+    return bytes;
+}
+
+void InvertedIndex::Save(SnapshotWriter& writer) const {
+    // terms keep their ids, the slot table is rebuilt over all of them
+    TermDictionary terms;
+    vector<uint64_t> term_offsets = {0};
+    vector<char> term_bytes;
+    for (TermId term = 0; term < GetTermCount(); ++term) {
+        const string_view word = GetTerm(term);
+        terms.Insert(word);
+        term_bytes.insert(term_bytes.end(), word.begin(), word.end());
+        term_offsets.push_back(term_bytes.size());
+    }
+    writer.Write(SnapshotSection::TERM_OFFSETS, ArrayView<uint64_t>(term_offsets));
+    writer.Write(SnapshotSection::TERM_BYTES, ArrayView<char>(term_bytes));
+    writer.Write(SnapshotSection::TERM_SLOTS, terms.GetSlots());
+
+    // the snapshot holds a single segment, the mutable one covers all terms
+    vector<SegmentState> segments;
+    for (const SegmentState& state : segments_) {
+        segments.push_back({state.segment, state.removed});
+    }
+    segments.push_back({BuildMutableSegment()});
+    const auto segment = MergeSegments(segments, ScoringMode::EXACT);
+    writer.Write(SnapshotSection::POSTING_OFFSETS, segment->posting_offsets);
+    writer.Write(SnapshotSection::POSTING_DOCUMENTS, segment->posting_documents);
+    writer.Write(SnapshotSection::POSTING_FREQS, segment->posting_freqs);
+    writer.Write(SnapshotSection::POSTING_MAX_FREQS, segment->posting_max_freqs);
+    writer.Write(SnapshotSection::BLOCK_OFFSETS, segment->block_offsets);
+    writer.Write(SnapshotSection::BLOCK_MAX_FREQS, segment->block_max_freqs);
+    writer.Write(SnapshotSection::DOCUMENT_TERM_OFFSETS, segment->document_term_offsets);
+    writer.Write(SnapshotSection::DOCUMENT_TERMS, segment->document_terms);
+}
+
+void InvertedIndex::UpdateSegments() {
+    if (merge_.valid() && merge_.wait_for(chrono::seconds(0)) == future_status::ready) {
+        FinishMerge();
+    }
+    if (document_terms_.size() >= MAX_MUTABLE_DOCUMENTS) {
+        FreezeMutableSegment();
+    }
+    if (!merge_.valid()) {
+        StartMerge();
+    }
+}
+
+void InvertedIndex::Freeze() {
+    FreezeMutableSegment();
+    UpdateSegments();
+}
+
+void InvertedIndex::Compact() {
+    if (merge_.valid()) {
+        FinishMerge();
+    }
+    FreezeMutableSegment();
+    if (segments_.empty()) {
+        return;
+    }
+    // live terms keep their relative order, so postings and forward lists stay sorted by term
+    vector<TermId> term_ids(GetTermCount(), TermDictionary::EMPTY_SLOT);
+    TermDictionary dictionary;
+    for (TermId term = 0; term < GetTermCount(); ++term) {
+        if (GetDocumentFreq(term) > 0) {
+            term_ids[term] = dictionary.Insert(GetTerm(term));
+        }
+    }
+    MetricsRegistry::Get().Add(IngestionCounter::TERMS_REMOVED, GetTermCount() - dictionary.size());
+    SegmentState compacted{MergeSegments(segments_, scoring_mode_, &term_ids)};
+    // removed documents keep their ordinals, so they still have to be reported as removed
+    ForEachRemoved(compacted.segment->first_document, compacted.segment->GetEndDocument(), [&compacted](DocumentOrdinal document) {
+        compacted.MarkDropped(document);
+    });
+    segments_.clear();
+    segments_.push_back(move(compacted));
+    base_terms_ = FrozenTermDictionary();
+    dictionary_ = move(dictionary);
+    vector<uint32_t> document_freqs(dictionary_.size());
+    vector<double> log_document_freqs(dictionary_.size());
+    for (TermId term = 0; term < term_ids.size(); ++term) {
+        if (term_ids[term] != TermDictionary::EMPTY_SLOT) {
+            document_freqs[term_ids[term]] = document_freqs_[term];
+            log_document_freqs[term_ids[term]] = log_document_freqs_[term];
+        }
+    }
+    document_freqs_ = move(document_freqs);
+    log_document_freqs_ = move(log_document_freqs);
+    // indexed by the old term ids
+    vector<PostingList>().swap(postings_);
+}
+
+void InvertedIndex::FreezeMutableSegment() {
+    if (document_terms_.empty()) {
+        return;
+    }
+    SegmentState& state = segments_.emplace_back(SegmentState{BuildMutableSegment()});
+    ForEachMutableRemoved([&state](DocumentOrdinal document) {
+        state.MarkDropped(document);
+    });
+    mutable_removed_.clear();
+    mutable_first_document_ = state.segment->GetEndDocument();
+    // posting lists keep their capacity for the next mutable segment
+    for (PostingList& postings : postings_) {
+        postings.Clear();
+    }
+    document_terms_.clear();
+}
+
+shared_ptr<const InvertedIndex::Segment> InvertedIndex::BuildMutableSegment() const {
+    Segment::Arrays arrays;
+    arrays.scoring_mode = scoring_mode_;
+    for (TermId term = 0; term < GetTermCount(); ++term) {
+        if (term < postings_.size()) {
+            const PostingList& postings = postings_[term];
+            for (size_t i = 0; i < postings.size(); ++i) {
+                arrays.AddPosting(postings.documents[i], postings.term_freqs[i]);
+            }
+        }
+        arrays.EndPostings();
+    }
+    DocumentOrdinal dropped_count = 0;
+    for (const auto& terms : document_terms_) {
+        arrays.AddDocument(terms);
+    }
+    ForEachMutableRemoved([&dropped_count](DocumentOrdinal) {
+        ++dropped_count;
+    });
+    return make_shared<const Segment>(mutable_first_document_, move(arrays), dropped_count);
+}
+
+void InvertedIndex::StartMerge() {
+    // Tiered policy: the size class of a segment grows by one with every
+    // MERGE_FACTOR-fold growth of its live documents. The newest MERGE_FACTOR
+    // segments are merged once they share a class, so n documents end up in
+    // O(log n) segments and merged documents are copied O(log n) times, even
+    // when segments are frozen early and small.
+    const auto get_size_class = [](size_t document_count) {
+        size_t size_class = 0;
+        for (size_t size = MERGE_FACTOR; document_count >= size; size *= MERGE_FACTOR) {
+            ++size_class;
+        }
+        return size_class;
+    };
+    if (segments_.size() >= MERGE_FACTOR) {
+        const size_t first = segments_.size() - MERGE_FACTOR;
+        const size_t size_class = get_size_class(segments_[first].GetLiveDocumentCount());
+        const bool same_class = all_of(segments_.begin() + first, segments_.end(), [&](const SegmentState& state) {
+            return get_size_class(state.GetLiveDocumentCount()) == size_class;
+        });
+        if (same_class) {
+            StartMerge(first, MERGE_FACTOR);
+            return;
+        }
+    }
+    // Bulk removals leave whole segments mostly dead: one is rewritten on its
+    // own once enough of its postings belong to removed documents, so queries
+    // stop skipping them and the memory comes back.
+    for (size_t i = 0; i < segments_.size(); ++i) {
+        const SegmentState& state = segments_[i];
+        if (state.removed_count > 0 && state.removed_count >= MAX_REMOVED_SHARE * (state.removed_count + state.GetLiveDocumentCount())) {
+            StartMerge(i, 1);
+            return;
+        }
+    }
+}
+
+void InvertedIndex::StartMerge(size_t first, size_t count) {
+    merge_segments_.clear();
+    for (size_t i = first; i < first + count; ++i) {
+        merge_segments_.push_back({segments_[i].segment, segments_[i].removed});
+    }
+    // segments are immutable and removals are copied, so the merge shares nothing with the index
+    merge_ = async(launch::async, [segments = merge_segments_, scoring_mode = scoring_mode_] {
+        return MergeSegments(segments, scoring_mode);
+    });
+}
+
+void InvertedIndex::FinishMerge() {
+    SegmentState merged{merge_.get()};
+    // documents removed while the merge ran are still in its postings, those removed before are not
+    const size_t first = FindSegment(merged.segment->first_document);
+    for (const SegmentState& input : merge_segments_) {
+        ForEachRemoved(input.segment->first_document, input.segment->GetEndDocument(), [&](DocumentOrdinal document) {
+            if (input.IsRemoved(document)) {
+                merged.MarkDropped(document);
+            } else {
+                merged.Remove(document);
+            }
+        });
+    }
+    const auto it = segments_.begin() + first;
+    *it = move(merged);
+    segments_.erase(it + 1, it + merge_segments_.size());
+    merge_segments_.clear();
+}
+
+shared_ptr<const InvertedIndex::Segment> InvertedIndex::MergeSegments(const vector<SegmentState>& segments, ScoringMode scoring_mode,
+                                                                      const vector<TermId>* term_ids) {
+    size_t term_count = 0;
+    for (const SegmentState& state : segments) {
+        term_count = max(term_count, state.segment->GetTermCount());
+    }
+    Segment::Arrays arrays;
+    arrays.scoring_mode = scoring_mode;
+    PostingBuffers buffers;
+    for (TermId term = 0; term < term_count; ++term) {
+        if (term_ids && (*term_ids)[term] == TermDictionary::EMPTY_SLOT) {
+            continue;
+        }
+        buffers.Clear();
+        for (const SegmentState& state : segments) {
+            const Postings postings = GetPostings(*state.segment, term, buffers);
+            for (size_t i = 0; i < postings.size(); ++i) {
+                const DocumentOrdinal document = postings.documents[i];
+                if (state.IsRemoved(document)) {
+                    continue;
+                }
+                if (state.segment->HasExactFreqs()) {
+                    arrays.AddPosting(document, postings.term_freqs[i]);
+                    continue;
+                }
+                // impacts and decoded counts are rounded, the forward list has the exact frequency
+                const auto terms = state.segment->GetDocumentTerms(document);
+                const auto it = lower_bound(terms.begin(), terms.end(), term, [](const TermFreq& lhs, TermId rhs) {
+                    return lhs.term < rhs;
+                });
+                arrays.AddPosting(document, it->freq);
+            }
+        }
+        arrays.EndPostings();
+    }
+    // removed documents keep their ordinals, with no terms
+    DocumentOrdinal dropped_count = 0;
+    vector<TermFreq> renumbered;
+    for (const SegmentState& state : segments) {
+        const Segment& segment = *state.segment;
+        for (DocumentOrdinal document = segment.first_document; document < segment.GetEndDocument(); ++document) {
+            if (state.IsRemoved(document)) {
+                arrays.AddDocument({});
+                ++dropped_count;
+            } else if (term_ids) {
+                renumbered.clear();
+                for (const auto [term, freq] : segment.GetDocumentTerms(document)) {
+                    renumbered.push_back({(*term_ids)[term], freq});
+                }
+                arrays.AddDocument(renumbered);
+            } else {
+                arrays.AddDocument(segment.GetDocumentTerms(document));
+            }
+        }
+    }
+    return make_shared<const Segment>(segments.front().segment->first_document, move(arrays), dropped_count);
+}
+
+InvertedIndex::Segment::Segment(const Snapshot& snapshot)
+    : posting_offsets(snapshot.Get<uint64_t>(SnapshotSection::POSTING_OFFSETS))
+    , posting_documents(snapshot.Get<DocumentOrdinal>(SnapshotSection::POSTING_DOCUMENTS))
+    , posting_freqs(snapshot.Get<double>(SnapshotSection::POSTING_FREQS))
+    , posting_max_freqs(snapshot.Get<double>(SnapshotSection::POSTING_MAX_FREQS))
+    , block_offsets(snapshot.Get<uint64_t>(SnapshotSection::BLOCK_OFFSETS))
+    , block_max_freqs(snapshot.Get<double>(SnapshotSection::BLOCK_MAX_FREQS))
+    , document_term_offsets(snapshot.Get<uint64_t>(SnapshotSection::DOCUMENT_TERM_OFFSETS))
+    , document_terms(snapshot.Get<TermFreq>(SnapshotSection::DOCUMENT_TERMS)) {
+}
+
+InvertedIndex::Segment::Segment(DocumentOrdinal first, Arrays&& segment_arrays, DocumentOrdinal dropped_count)
+    : first_document(first)
+    , dropped_document_count(dropped_count)
+    , arrays(move(segment_arrays)) {
+    if (arrays.scoring_mode == ScoringMode::COMPRESSED) {
+        arrays.Pack(first);
+    }
+    posting_offsets = arrays.posting_offsets;
+    posting_documents = arrays.posting_documents;
+    posting_freqs = arrays.posting_freqs;
+    posting_impacts_8 = arrays.posting_impacts_8;
+    posting_impacts_16 = arrays.posting_impacts_16;
+    posting_impact_steps = arrays.posting_impact_steps;
+    posting_blocks = arrays.posting_blocks;
+    posting_words = arrays.posting_words;
+    document_inv_lengths = arrays.document_inv_lengths;
+    posting_max_freqs = arrays.posting_max_freqs;
+    block_offsets = arrays.block_offsets;
+    block_max_freqs = arrays.block_max_freqs;
+    document_term_offsets = arrays.document_term_offsets;
+    document_terms = arrays.document_terms;
+}
+
+InvertedIndex::Postings InvertedIndex::Segment::GetPostings(TermId term) const {
+    if (term >= GetTermCount()) {
+        return {};
+    }
+    const size_t first = posting_offsets[term];
+    const size_t count = posting_offsets[term + 1] - first;
+    const size_t first_block = block_offsets[term];
+    Postings postings{posting_documents.Slice(first, count), {},
+                      block_max_freqs.Slice(first_block, block_offsets[term + 1] - first_block), posting_max_freqs[term]};
+    if (IsCompressed()) {
+        postings.documents = {};
+    } else if (posting_impact_steps.empty()) {
+        postings.term_freqs = posting_freqs.Slice(first, count);
+    } else if (posting_impacts_16.empty()) {
+        postings.impacts_8 = posting_impacts_8.Slice(first, count);
+        postings.impact_step = posting_impact_steps[term];
+    } else {
+        postings.impacts_16 = posting_impacts_16.Slice(first, count);
+        postings.impact_step = posting_impact_steps[term];
+    }
+    return postings;
+}
+
+void InvertedIndex::Segment::DecodePostings(TermId term, vector<DocumentOrdinal>& documents, vector<double>& term_freqs) const {
+    const size_t count = posting_offsets[term + 1] - posting_offsets[term];
+    documents.resize(count);
+    term_freqs.resize(count);
+    for (size_t block = block_offsets[term], i = 0; i < count; ++block) {
+        const PackedBlock& packed = posting_blocks[block];
+        const size_t block_end = min(count, i + BLOCK_SIZE);
+        const uint64_t* words = posting_words.data() + packed.word_offset;
+        size_t position = 0;
+        DocumentOrdinal document = packed.first_document;
+        documents[i] = document;
+        const uint64_t document_mask = GetBitMask(packed.document_bits);
+        for (size_t j = i + 1; j < block_end; ++j) {
+            document += static_cast<DocumentOrdinal>(ReadBits(words, position, packed.document_bits, document_mask)) + 1;
+            documents[j] = document;
+        }
+        const uint64_t count_mask = GetBitMask(packed.count_bits);
+        for (; i < block_end; ++i) {
+            const uint64_t word_count = ReadBits(words, position, packed.count_bits, count_mask) + 1;
+            term_freqs[i] = word_count * document_inv_lengths[documents[i] - first_document];
+        }
+    }
+}
+
+ArrayView<InvertedIndex::TermFreq> InvertedIndex::Segment::GetDocumentTerms(DocumentOrdinal document) const {
+    const size_t offset = document - first_document;
+    const size_t first = document_term_offsets[offset];
+    return document_terms.Slice(first, document_term_offsets[offset + 1] - first);
+}
+
+size_t InvertedIndex::Segment::GetMemoryUsage() const {
+    return (arrays.posting_offsets.capacity() + arrays.block_offsets.capacity() + arrays.document_term_offsets.capacity()) * sizeof(uint64_t)
+        + arrays.posting_documents.capacity() * sizeof(DocumentOrdinal)
+        + arrays.posting_impacts_8.capacity() * sizeof(uint8_t) + arrays.posting_impacts_16.capacity() * sizeof(uint16_t)
+        + (arrays.posting_freqs.capacity() + arrays.posting_impact_steps.capacity()
+           + arrays.posting_max_freqs.capacity() + arrays.block_max_freqs.capacity()) * sizeof(double)
+        + arrays.posting_blocks.capacity() * sizeof(PackedBlock) + arrays.posting_words.capacity() * sizeof(uint64_t)
+        + arrays.document_inv_lengths.capacity() * sizeof(double)
+        + arrays.document_terms.capacity() * sizeof(TermFreq);
+}
+
+size_t InvertedIndex::Segment::GetPostingMemoryUsage() const {
+    return (posting_offsets.size() + block_offsets.size() + posting_words.size()) * sizeof(uint64_t)
+        + posting_documents.size() * sizeof(DocumentOrdinal)
+        + posting_impacts_8.size() * sizeof(uint8_t) + posting_impacts_16.size() * sizeof(uint16_t)
+        + (posting_freqs.size() + posting_impact_steps.size() + posting_max_freqs.size() + block_max_freqs.size()
+           + document_inv_lengths.size()) * sizeof(double)
+        + posting_blocks.size() * sizeof(PackedBlock);
+}
+
+void InvertedIndex::Segment::Arrays::AddPosting(DocumentOrdinal document, double freq) {
+    posting_documents.push_back(document);
+    posting_freqs.push_back(freq);
+}
+
+void InvertedIndex::Segment::Arrays::EndPostings() {
+    const bool is_exact = scoring_mode == ScoringMode::EXACT || scoring_mode == ScoringMode::COMPRESSED;
+    if (!is_exact) {
+        const double level_count = scoring_mode == ScoringMode::IMPACT_8_BIT ? UINT8_MAX : UINT16_MAX;
+        const double step = posting_freqs.empty() ? 0.0 : *max_element(posting_freqs.begin(), posting_freqs.end()) / level_count;
+        for (double& freq : posting_freqs) {
+            const auto level = lround(freq / step);
+            if (scoring_mode == ScoringMode::IMPACT_8_BIT) {
+                posting_impacts_8.push_back(static_cast<uint8_t>(level));
+            } else {
+                posting_impacts_16.push_back(static_cast<uint16_t>(level));
+            }
+            // block maxima bound the frequencies queries will see
+            freq = step * level;
+        }
+        posting_impact_steps.push_back(step);
+    }
+    double max_freq = 0.0;
+    for (size_t block = is_exact ? posting_offsets.back() : 0; block < posting_freqs.size(); block += BLOCK_SIZE) {
+        const auto block_end = posting_freqs.begin() + min(posting_freqs.size(), block + BLOCK_SIZE);
+        block_max_freqs.push_back(*max_element(posting_freqs.begin() + block, block_end));
+        max_freq = max(max_freq, block_max_freqs.back());
+    }
+    posting_offsets.push_back(posting_documents.size());
+    posting_max_freqs.push_back(max_freq);
+    block_offsets.push_back(block_max_freqs.size());
+    if (!is_exact) {
+        posting_freqs.clear();
+    }
+}
+
+void InvertedIndex::Segment::Arrays::AddDocument(ArrayView<TermFreq> terms) {
+    // value-initialized, so padding written to a snapshot is zero
+    size_t position = document_terms.size();
+    document_terms.resize(position + terms.size());
+    for (const auto [term, freq] : terms) {
+        document_terms[position].term = term;
+        document_terms[position].freq = freq;
+        ++position;
+    }
+    document_term_offsets.push_back(document_terms.size());
+}
+
+void InvertedIndex::Segment::Arrays::Pack(DocumentOrdinal first_document) {
+    // Frequencies are word counts over document lengths. The length is the
+    // smallest one turning all frequencies of the document into whole counts.
+    const size_t document_count = document_term_offsets.size() - 1;
+    document_inv_lengths.assign(document_count, 0.0);
+    for (size_t document = 0; document < document_count; ++document) {
+        const auto first = document_terms.begin() + document_term_offsets[document];
+        const auto last = document_terms.begin() + document_term_offsets[document + 1];
+        if (first == last) {
+            continue;
+        }
+        const double min_freq = min_element(first, last, [](const TermFreq& lhs, const TermFreq& rhs) {
+                                    return lhs.freq < rhs.freq;
+                                })->freq;
+        for (double min_count = 1.0;; ++min_count) {
+            const double length = round(min_count / min_freq);
+            if (all_of(first, last, [length](const TermFreq& term_freq) {
+                    return abs(term_freq.freq * length - round(term_freq.freq * length)) < 1e-6;
+                })) {
+                document_inv_lengths[document] = 1.0 / length;
+                break;
+            }
+        }
+    }
+
+    vector<uint64_t> gaps;
+    vector<uint64_t> counts;
+    for (size_t term = 0; term + 1 < posting_offsets.size(); ++term) {
+        double max_freq = 0.0;
+        size_t block = block_offsets[term];
+        for (size_t i = posting_offsets[term]; i < posting_offsets[term + 1]; i += BLOCK_SIZE, ++block) {
+            const size_t block_end = min<size_t>(posting_offsets[term + 1], i + BLOCK_SIZE);
+            gaps.clear();
+            counts.clear();
+            uint64_t max_gap = 0;
+            uint64_t max_count = 0;
+            block_max_freqs[block] = 0.0;
+            for (size_t j = i; j < block_end; ++j) {
+                const double inv_length = document_inv_lengths[posting_documents[j] - first_document];
+                counts.push_back(llround(posting_freqs[j] / inv_length) - 1);
+                max_count = max(max_count, counts.back());
+                if (j > i) {
+                    gaps.push_back(posting_documents[j] - posting_documents[j - 1] - 1);
+                    max_gap = max(max_gap, gaps.back());
+                }
+                // bounds have to hold for the decoded frequencies
+                block_max_freqs[block] = max(block_max_freqs[block], (counts.back() + 1) * inv_length);
+            }
+            max_freq = max(max_freq, block_max_freqs[block]);
+
+            const PackedBlock packed{posting_documents[i], static_cast<uint32_t>(posting_words.size()),
+                                     static_cast<uint8_t>(GetBitWidth(max_gap)), static_cast<uint8_t>(GetBitWidth(max_count))};
+            posting_blocks.push_back(packed);
+            size_t position = 0;
+            for (const uint64_t gap : gaps) {
+                WriteBits(posting_words, packed.word_offset, position, gap, packed.document_bits);
+            }
+            for (const uint64_t count : counts) {
+                WriteBits(posting_words, packed.word_offset, position, count, packed.count_bits);
+            }
+        }
+        posting_max_freqs[term] = max_freq;
+    }
+    posting_words.push_back(0);
+    vector<DocumentOrdinal>().swap(posting_documents);
+    vector<double>().swap(posting_freqs);
+    posting_words.shrink_to_fit();
+}
+
+void InvertedIndex::SegmentState::Remove(DocumentOrdinal document) {
+    MarkDropped(document);
+    ++removed_count;
+}
+
+void InvertedIndex::SegmentState::MarkDropped(DocumentOrdinal document) {
+    const DocumentOrdinal offset = document - segment->first_document;
+    if (removed.empty()) {
+        removed.resize((segment->GetDocumentCount() + 63) / 64);
+    }
+    removed[offset / 64] |= uint64_t{1} << (offset % 64);
+}
+
+InvertedIndex::Postings InvertedIndex::ViewOf(const PostingList& postings) {
+    return {postings.documents, postings.term_freqs, postings.block_max_freqs, postings.max_freq};
+}
+
+InvertedIndex::Postings InvertedIndex::GetPostings(const Segment& segment, TermId term, PostingBuffers& buffers) {
+    Postings postings = segment.GetPostings(term);
+    if (segment.IsCompressed() && !postings.block_max_freqs.empty()) {
+        auto& buffer = buffers.GetBuffer();
+        segment.DecodePostings(term, buffer.documents, buffer.term_freqs);
+        postings.documents = buffer.documents;
+        postings.term_freqs = buffer.term_freqs;
+    }
+    return postings;
+}
+
+InvertedIndex::PostingList& InvertedIndex::GetMutablePostings(TermId term) {
+    if (postings_.size() <= term) {
+        postings_.resize(term + 1);
+    }
+    return postings_[term];
+}
+
+vector<InvertedIndex::TermFreq>& InvertedIndex::GetMutableDocumentTerms(DocumentOrdinal document) {
+    return document_terms_[document - mutable_first_document_];
+}
+
+void InvertedIndex::PostingList::Insert(DocumentOrdinal document, double freq) {
+    max_freq = max(max_freq, freq);
+    if (documents.empty() || documents.back() < document) {
+        // appending, the usual case, only touches the last block
+        if (size() % BLOCK_SIZE == 0) {
+            block_max_freqs.push_back(freq);
+        } else {
+            block_max_freqs.back() = max(block_max_freqs.back(), freq);
+        }
+        documents.push_back(document);
+        term_freqs.push_back(freq);
+        return;
+    }
+    const auto pos = upper_bound(documents.begin(), documents.end(), document);
+    const size_t offset = pos - documents.begin();
+    documents.insert(pos, document);
+    term_freqs.insert(term_freqs.begin() + offset, freq);
+    UpdateBlocks(offset / BLOCK_SIZE);
+}
+
+void InvertedIndex::PostingList::Erase(DocumentOrdinal document) {
+    const auto pos = lower_bound(documents.begin(), documents.end(), document);
+    if (pos == documents.end() || *pos != document) {
+        return;
+    }
+    const size_t offset = pos - documents.begin();
+    documents.erase(pos);
+    term_freqs.erase(term_freqs.begin() + offset);
+    UpdateBlocks(offset / BLOCK_SIZE);
+    max_freq = block_max_freqs.empty() ? 0.0 : *max_element(block_max_freqs.begin(), block_max_freqs.end());
+}
+
+void InvertedIndex::PostingList::EraseRemoved(const vector<uint64_t>& removed, DocumentOrdinal first_document) {
+    size_t kept = 0;
+    for (size_t i = 0; i < size(); ++i) {
+        const DocumentOrdinal offset = documents[i] - first_document;
+        if (offset / 64 < removed.size() && (removed[offset / 64] >> (offset % 64) & 1) != 0) {
+            continue;
+        }
+        documents[kept] = documents[i];
+        term_freqs[kept] = term_freqs[i];
+        ++kept;
+    }
+    documents.resize(kept);
+    term_freqs.resize(kept);
+    UpdateBlocks(0);
+    max_freq = block_max_freqs.empty() ? 0.0 : *max_element(block_max_freqs.begin(), block_max_freqs.end());
+}
+
+void InvertedIndex::PostingList::Clear() {
+    documents.clear();
+    term_freqs.clear();
+    block_max_freqs.clear();
+    max_freq = 0.0;
+}
+
+void InvertedIndex::PostingList::UpdateBlocks(size_t first_block) {
+    block_max_freqs.resize((size() + BLOCK_SIZE - 1) / BLOCK_SIZE);
+    for (size_t block = first_block; block < block_max_freqs.size(); ++block) {
+        const auto begin = term_freqs.begin() + block * BLOCK_SIZE;
+        const auto end = term_freqs.begin() + min(size(), (block + 1) * BLOCK_SIZE);
+        block_max_freqs[block] = *max_element(begin, end);
+    }
+}
+
+PostingCursor::PostingCursor(const InvertedIndex::Postings& postings)
+    : postings_(postings) {
+}
+
+size_t PostingCursor::Gallop(DocumentOrdinal target) const {
+    const auto& documents = postings_.documents;
+    // gallop from the current position, targets are usually close
+    size_t low = position_;
+    size_t step = 1;
+    while (low + step < documents.size() && documents[low + step] < target) {
+        low += step;
+        step *= 2;
+    }
+    const auto high = documents.begin() + min(documents.size(), low + step + 1);
+    return lower_bound(documents.begin() + low + 1, high, target) - documents.begin();
+}
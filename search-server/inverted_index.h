@@ -0,0 +1,621 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <execution>
+#include <future>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "array_view.h"
+#include "metrics.h"
+#include "snapshot.h"
+#include "term_dictionary.h"
+
+using DocumentOrdinal = uint32_t;
+
+// How frozen segments store their postings. Impact modes keep term
+// frequencies in 8 or 16 bits, as a number of steps of 1/255 or 1/65535 of the
+// largest frequency of the term in the segment: postings take a quarter of
+// the space or less, and a frequency is off by at most half a step.
+// COMPRESSED packs document gaps and word counts into bit-packed blocks, a
+// byte or two per posting, and decodes the postings a query reads; scores
+// stay exact up to rounding. Forward lists keep exact frequencies, so merges
+// do not add up errors.
+enum class ScoringMode {
+    EXACT,
+    IMPACT_8_BIT,
+    IMPACT_16_BIT,
+    COMPRESSED,
+};
+
+// Inverted index over flat posting lists.
+// Every term gets a dense id, every document is addressed by the ordinal it
+// was added under. Ordinals only grow, so posting lists stay sorted and adding
+// a document only appends to them.
+//
+// Documents are kept in segments covering consecutive ordinals. New documents
+// go to a small mutable segment, which is frozen into a compact immutable one
+// once it fills up. Removing a document from a frozen segment only marks it
+// as such. Runs of similarly sized frozen segments are merged in the
+// background, dropping removed documents, so a corpus ends up in a handful
+// of segments. An index opened from a snapshot starts with a single frozen
+// segment served straight from the snapshot sections.
+class InvertedIndex {
+public:
+    static constexpr size_t BLOCK_SIZE = 64;
+
+    // Read-only postings of a term, sorted by document. Every BLOCK_SIZE
+    // postings form a block whose largest term frequency is kept next to the
+    // largest one of the whole list, so query engines can bound scores
+    // without decoding postings.
+    struct Postings {
+        ArrayView<DocumentOrdinal> documents;
+        // empty if the segment stores impacts, see ScoringMode
+        ArrayView<double> term_freqs;
+        ArrayView<double> block_max_freqs;
+        double max_freq = 0.0;
+        // position of the segment holding them, segments are numbered in document order
+        size_t segment = 0;
+        // frequencies in steps of impact_step, one of them filled
+        ArrayView<uint8_t> impacts_8 = {};
+        ArrayView<uint16_t> impacts_16 = {};
+        double impact_step = 0.0;
+
+        size_t size() const {
+            return documents.size();
+        }
+
+        double GetTermFreq(size_t i) const {
+            if (!term_freqs.empty()) {
+                return term_freqs[i];
+            }
+            return impact_step * (impacts_8.empty() ? impacts_16[i] : impacts_8[i]);
+        }
+
+        // Calls callback(get_term_freq), get_term_freq(i) being GetTermFreq(i)
+        // for the storage at hand, so loops over all postings do not branch.
+        template <typename Callback>
+        void VisitTermFreqs(Callback callback) const {
+            if (!term_freqs.empty()) {
+                callback([this](size_t i) {
+                    return term_freqs[i];
+                });
+            } else if (!impacts_8.empty()) {
+                callback([this](size_t i) {
+                    return impact_step * impacts_8[i];
+                });
+            } else {
+                callback([this](size_t i) {
+                    return impact_step * impacts_16[i];
+                });
+            }
+        }
+    };
+
+    struct TermFreq {
+        TermId term;
+        double freq;
+    };
+
+    // Postings of compressed segments decoded for a query. Views of them stay
+    // valid until Clear(), which keeps the memory for the next query.
+    class PostingBuffers {
+    public:
+        void Clear() {
+            used_count_ = 0;
+        }
+
+    private:
+        friend class InvertedIndex;
+
+        struct Buffer {
+            std::vector<DocumentOrdinal> documents;
+            std::vector<double> term_freqs;
+        };
+        // a deque does not move its buffers when it grows
+        std::deque<Buffer> buffers_;
+        size_t used_count_ = 0;
+
+        Buffer& GetBuffer() {
+            if (used_count_ == buffers_.size()) {
+                buffers_.emplace_back();
+            }
+            return buffers_[used_count_++];
+        }
+    };
+
+    explicit InvertedIndex(ScoringMode scoring_mode = ScoringMode::EXACT);
+    // The snapshot must outlive the index. Its segment keeps exact
+    // frequencies, scoring_mode applies to segments built later.
+    explicit InvertedIndex(const Snapshot& snapshot, ScoringMode scoring_mode = ScoringMode::EXACT);
+    // Copies share frozen segments and term bytes with the original, the
+    // mutable segment is copied as a frozen one. A merge running in the
+    // original is not carried over.
+    InvertedIndex(const InvertedIndex& other);
+    InvertedIndex& operator=(const InvertedIndex&) = delete;
+
+    TermId AddTerm(std::string_view term);
+    std::optional<TermId> FindTerm(std::string_view term) const;
+    std::string_view GetTerm(TermId term) const;
+    size_t GetTermCount() const;
+
+    void AddDocument(DocumentOrdinal document, const std::vector<std::string_view>& words);
+    // Indexes document_count documents under ordinals first, first + 1, ...
+    // get_words(i, words) fills words with the words of the i-th of them.
+    // Chunks of the batch are tokenized and counted in parallel, then merged
+    // into the index in a single serial pass.
+    template <typename ExecutionPolicy, typename WordsGetter>
+    void AddDocuments(ExecutionPolicy&& policy, DocumentOrdinal first, size_t document_count, WordsGetter get_words);
+
+    template <typename ExecutionPolicy>
+    void RemoveDocument(ExecutionPolicy&& policy, DocumentOrdinal document);
+    void RemoveDocument(DocumentOrdinal document);
+    // Removes the documents at once: frozen ones are only marked, and every
+    // mutable posting list they appear in is filtered a single time.
+    template <typename ExecutionPolicy>
+    void RemoveDocuments(ExecutionPolicy&& policy, const std::vector<DocumentOrdinal>& documents);
+
+    // Calls callback(const Postings&) with the postings of the term in every
+    // segment, in document order, skipping empty ones. Compressed postings
+    // are decoded into buffers.
+    template <typename Callback>
+    void ForEachPostings(TermId term, PostingBuffers& buffers, Callback callback) const;
+    // Number of documents containing the term, over all segments.
+    size_t GetDocumentFreq(TermId term) const {
+        return term < document_freqs_.size() ? document_freqs_[term] : 0;
+    }
+    // Its natural logarithm, kept along with it, so queries need no log() per term.
+    double GetLogDocumentFreq(TermId term) const {
+        return log_document_freqs_[term];
+    }
+
+    ScoringMode GetScoringMode() const {
+        return scoring_mode_;
+    }
+
+    ArrayView<TermFreq> GetDocumentTerms(DocumentOrdinal document) const;
+    const TermFreq* FindDocumentTerm(DocumentOrdinal document, TermId term) const;
+
+    // Whether the document was removed. Documents removed from frozen
+    // segments stay in their postings until the segment is merged, queries
+    // have to skip those reported by ForEachRemoved.
+    bool IsRemoved(DocumentOrdinal document) const;
+    template <typename Callback>
+    void ForEachRemoved(DocumentOrdinal begin, DocumentOrdinal end, Callback callback) const;
+
+    size_t GetSegmentCount() const;
+    // Freezes the mutable segment now rather than once it fills up, so that
+    // copies made afterwards share all of the index.
+    void Freeze();
+    // Rewrites the whole index into one segment without removed documents and
+    // renumbers the terms, dropping those no document contains any more.
+    // Term ids and views handed out before do not survive it.
+    void Compact();
+
+    // Heap memory only, mapped snapshot pages are not counted.
+    size_t GetMemoryUsage() const;
+    // Bytes the postings of all segments take, without spare capacity, so
+    // storage modes can be compared. Snapshot sections are counted too.
+    size_t GetPostingMemoryUsage() const;
+
+    // Writes terms, postings and forward lists of all documents as if they
+    // had been added to an empty index.
+    void Save(SnapshotWriter& writer) const;
+
+private:
+    // Postings of the mutable segment.
+    struct PostingList {
+        std::vector<DocumentOrdinal> documents;
+        std::vector<double> term_freqs;
+        std::vector<double> block_max_freqs;
+        double max_freq = 0.0;
+
+        size_t size() const {
+            return documents.size();
+        }
+
+        void Insert(DocumentOrdinal document, double freq);
+        void Erase(DocumentOrdinal document);
+        // Drops the documents whose bit is set, bits counted from first_document.
+        void EraseRemoved(const std::vector<uint64_t>& removed, DocumentOrdinal first_document);
+        void Clear();
+
+    private:
+        void UpdateBlocks(size_t first_block);
+    };
+
+    // Immutable segment: postings of every term with an id below
+    // GetTermCount() in CSR form, then forward lists of the documents
+    // [first_document, first_document + GetDocumentCount()). The views point
+    // into a snapshot or into the segment's own arrays.
+    struct Segment {
+        // BLOCK_SIZE postings of a compressed segment: the first document, then
+        // the gaps to the next ones less one and the word counts less one, in
+        // document_bits and count_bits each, starting at posting_words[word_offset].
+        struct PackedBlock {
+            DocumentOrdinal first_document;
+            uint32_t word_offset;
+            uint8_t document_bits;
+            uint8_t count_bits;
+        };
+
+        struct Arrays {
+            ScoringMode scoring_mode = ScoringMode::EXACT;
+            std::vector<uint64_t> posting_offsets = {0};
+            std::vector<DocumentOrdinal> posting_documents;
+            // in impact mode only those of the list being added
+            std::vector<double> posting_freqs;
+            std::vector<uint8_t> posting_impacts_8;
+            std::vector<uint16_t> posting_impacts_16;
+            std::vector<double> posting_impact_steps;
+            std::vector<PackedBlock> posting_blocks;
+            std::vector<uint64_t> posting_words;
+            // by document, term frequency is word count times this
+            std::vector<double> document_inv_lengths;
+            std::vector<double> posting_max_freqs;
+            std::vector<uint64_t> block_offsets = {0};
+            std::vector<double> block_max_freqs;
+            std::vector<uint64_t> document_term_offsets = {0};
+            std::vector<TermFreq> document_terms;
+
+            void AddPosting(DocumentOrdinal document, double freq);
+            // Closes the posting list of the next term.
+            void EndPostings();
+            void AddDocument(ArrayView<TermFreq> terms);
+            // Replaces the documents and frequencies of all postings by packed
+            // blocks, once all documents are added.
+            void Pack(DocumentOrdinal first_document);
+        };
+
+        DocumentOrdinal first_document = 0;
+        // documents removed before the segment was built, left without terms
+        DocumentOrdinal dropped_document_count = 0;
+        ArrayView<uint64_t> posting_offsets;
+        ArrayView<DocumentOrdinal> posting_documents;
+        ArrayView<double> posting_freqs;
+        ArrayView<uint8_t> posting_impacts_8;
+        ArrayView<uint16_t> posting_impacts_16;
+        // by term, empty if the segment keeps exact frequencies
+        ArrayView<double> posting_impact_steps;
+        // by block, empty unless the segment is compressed
+        ArrayView<PackedBlock> posting_blocks;
+        ArrayView<uint64_t> posting_words;
+        ArrayView<double> document_inv_lengths;
+        ArrayView<double> posting_max_freqs;
+        ArrayView<uint64_t> block_offsets;
+        ArrayView<double> block_max_freqs;
+        ArrayView<uint64_t> document_term_offsets;
+        ArrayView<TermFreq> document_terms;
+        // empty for a snapshot segment
+        Arrays arrays;
+
+        explicit Segment(const Snapshot& snapshot);
+        Segment(DocumentOrdinal first, Arrays&& segment_arrays, DocumentOrdinal dropped_count = 0);
+        Segment(const Segment&) = delete;
+        Segment& operator=(const Segment&) = delete;
+
+        size_t GetTermCount() const {
+            return posting_max_freqs.size();
+        }
+
+        DocumentOrdinal GetDocumentCount() const {
+            return static_cast<DocumentOrdinal>(document_term_offsets.size() - 1);
+        }
+
+        DocumentOrdinal GetEndDocument() const {
+            return first_document + GetDocumentCount();
+        }
+
+        bool IsCompressed() const {
+            return !posting_blocks.empty();
+        }
+
+        bool HasExactFreqs() const {
+            return posting_impact_steps.empty() && !IsCompressed();
+        }
+
+        // Without documents and frequencies if the segment is compressed.
+        Postings GetPostings(TermId term) const;
+        void DecodePostings(TermId term, std::vector<DocumentOrdinal>& documents, std::vector<double>& term_freqs) const;
+        ArrayView<TermFreq> GetDocumentTerms(DocumentOrdinal document) const;
+        size_t GetMemoryUsage() const;
+        size_t GetPostingMemoryUsage() const;
+    };
+
+    // A frozen segment and the documents removed from it since it was built.
+    struct SegmentState {
+        std::shared_ptr<const Segment> segment;
+        // a bit per document of the segment, dropped ones included, grown on demand
+        std::vector<uint64_t> removed = {};
+        // removed documents still in the postings
+        size_t removed_count = 0;
+
+        bool IsRemoved(DocumentOrdinal document) const {
+            const DocumentOrdinal offset = document - segment->first_document;
+            return offset / 64 < removed.size() && (removed[offset / 64] >> (offset % 64) & 1) != 0;
+        }
+
+        size_t GetLiveDocumentCount() const {
+            return segment->GetDocumentCount() - segment->dropped_document_count - removed_count;
+        }
+
+        void Remove(DocumentOrdinal document);
+        // Marks a document the segment was built without.
+        void MarkDropped(DocumentOrdinal document);
+    };
+
+    // batches are not split into chunks smaller than this
+    static constexpr size_t MIN_DOCUMENTS_PER_CHUNK = 256;
+    // the mutable segment is frozen once it holds this many documents
+    static constexpr size_t MAX_MUTABLE_DOCUMENTS = 16 * 1024;
+    // this many frozen segments of the same size class are merged into one
+    static constexpr size_t MERGE_FACTOR = 4;
+    // a frozen segment is rewritten on its own once this share of its postings belongs to removed documents
+    static constexpr double MAX_REMOVED_SHARE = 0.25;
+
+    ScoringMode scoring_mode_ = ScoringMode::EXACT;
+    // terms of the snapshot, then terms added later with ids following them
+    FrozenTermDictionary base_terms_;
+    TermDictionary dictionary_;
+    // by term id, over all segments
+    std::vector<uint32_t> document_freqs_;
+    std::vector<double> log_document_freqs_;
+    // frozen segments in document order
+    std::vector<SegmentState> segments_;
+    // The mutable segment, documents from mutable_first_document_ on: postings
+    // by term id, forward lists by ordinal minus mutable_first_document_.
+    DocumentOrdinal mutable_first_document_ = 0;
+    std::vector<PostingList> postings_;
+    std::vector<std::vector<TermFreq>> document_terms_;
+    // a bit per document of the mutable segment, its removed documents are already gone from the postings
+    std::vector<uint64_t> mutable_removed_;
+    // merge running in the background, of the segments as they were when it started
+    std::future<std::shared_ptr<const Segment>> merge_;
+    std::vector<SegmentState> merge_segments_;
+
+    static Postings ViewOf(const PostingList& postings);
+    static Postings GetPostings(const Segment& segment, TermId term, PostingBuffers& buffers);
+    PostingList& GetMutablePostings(TermId term);
+    std::vector<TermFreq>& GetMutableDocumentTerms(DocumentOrdinal document);
+    void RemovePosting(TermId term, DocumentOrdinal document);
+    // index in segments_ of the frozen segment holding the document, segments_.size() if none
+    size_t FindSegment(DocumentOrdinal document) const;
+    // Appends the terms of the document to removed_terms unless it was removed already.
+    void RemoveFrozenDocument(DocumentOrdinal document, std::vector<TermId>& removed_terms);
+    // Takes one document off the frequency of every listed term, per time it is listed.
+    void DecreaseDocumentFreqs(const std::vector<TermId>& terms);
+    void UpdateLogDocumentFreq(TermId term);
+    // Counts term frequencies of a document into its forward list under
+    // chunk-local term ids; chunks may be counted concurrently.
+    void CountTermFreqs(DocumentOrdinal document, const std::vector<std::string_view>& words, TermDictionary& chunk_terms);
+    // Moves counted documents [first, last) to global term ids and appends their postings.
+    void MergeTermFreqs(DocumentOrdinal first, DocumentOrdinal last, const TermDictionary& chunk_terms);
+
+    // Called after every change: installs a finished merge, freezes a full
+    // mutable segment and starts the next merge the policy asks for.
+    void UpdateSegments();
+    void FreezeMutableSegment();
+    std::shared_ptr<const Segment> BuildMutableSegment() const;
+    template <typename Callback>
+    void ForEachMutableRemoved(Callback callback) const;
+    void StartMerge();
+    void StartMerge(size_t first, size_t count);
+    void FinishMerge();
+    // Copies the live documents of consecutive segments into one. Terms are
+    // renumbered by term_ids if given, those mapped to EMPTY_SLOT are dropped.
+    static std::shared_ptr<const Segment> MergeSegments(const std::vector<SegmentState>& segments, ScoringMode scoring_mode,
+                                                        const std::vector<TermId>* term_ids = nullptr);
+};
+
+// Walks a posting list in document order, skipping ahead on request.
+class PostingCursor {
+public:
+    static constexpr DocumentOrdinal END = UINT32_MAX;
+
+    struct BlockBound {
+        double max_freq;
+        DocumentOrdinal last_document;
+    };
+
+    explicit PostingCursor(const InvertedIndex::Postings& postings);
+
+    DocumentOrdinal GetDocument() const {
+        return position_ < postings_.size() ? postings_.documents[position_] : END;
+    }
+
+    double GetTermFreq() const {
+        return postings_.GetTermFreq(position_);
+    }
+
+    void Next() {
+        ++position_;
+    }
+
+    // How many postings the cursor has passed.
+    size_t GetPosition() const {
+        return position_;
+    }
+
+    // Moves to the first posting of a document not less than target.
+    void SkipTo(DocumentOrdinal target) {
+        position_ = FindPosition(target);
+    }
+
+    // Bounds the postings of the block SkipTo(target) would stop in,
+    // without moving the cursor.
+    BlockBound GetBlockBound(DocumentOrdinal target) const {
+        const size_t position = FindPosition(target);
+        if (position == postings_.size()) {
+            return {0.0, END};
+        }
+        const size_t block = position / InvertedIndex::BLOCK_SIZE;
+        const size_t block_end = std::min(postings_.size(), (block + 1) * InvertedIndex::BLOCK_SIZE);
+        return {postings_.block_max_freqs[block], postings_.documents[block_end - 1]};
+    }
+
+private:
+    InvertedIndex::Postings postings_;
+    size_t position_ = 0;
+
+    size_t FindPosition(DocumentOrdinal target) const {
+        if (position_ == postings_.size() || postings_.documents[position_] >= target) {
+            return position_;
+        }
+        return Gallop(target);
+    }
+    // FindPosition for a target past the current posting.
+    size_t Gallop(DocumentOrdinal target) const;
+};
+
+template <typename ExecutionPolicy, typename WordsGetter>
+void InvertedIndex::AddDocuments(ExecutionPolicy&& policy, DocumentOrdinal first, size_t document_count, WordsGetter get_words) {
+    const size_t first_added = first - mutable_first_document_;
+    if (document_terms_.size() < first_added + document_count) {
+        document_terms_.resize(first_added + document_count);
+    }
+
+    const size_t chunk_count = std::clamp<size_t>(document_count / MIN_DOCUMENTS_PER_CHUNK, 1,
+                                                  4 * std::max(1u, std::thread::hardware_concurrency()));
+    const auto chunk_first = [first, document_count, chunk_count](size_t chunk) {
+        return first + static_cast<DocumentOrdinal>(document_count * chunk / chunk_count);
+    };
+    std::vector<TermDictionary> chunk_terms(chunk_count);
+    std::for_each(policy, chunk_terms.begin(), chunk_terms.end(), [&](TermDictionary& terms) {
+        const size_t chunk = &terms - chunk_terms.data();
+        std::vector<std::string_view> words;
+        for (DocumentOrdinal document = chunk_first(chunk); document < chunk_first(chunk + 1); ++document) {
+            words.clear();
+            get_words(document - first, words);
+            CountTermFreqs(document, words, terms);
+        }
+    });
+
+    // Every chunk looks its terms up in the dictionary once. Chunks cover
+    // increasing ordinals, so merging them in order only appends to posting lists.
+    for (size_t chunk = 0; chunk < chunk_count; ++chunk) {
+        MergeTermFreqs(chunk_first(chunk), chunk_first(chunk + 1), chunk_terms[chunk]);
+    }
+
+    const auto added_terms = document_terms_.begin() + first_added;
+    std::for_each(policy, added_terms, added_terms + document_count, [](std::vector<TermFreq>& terms) {
+        std::sort(terms.begin(), terms.end(), [](const TermFreq& lhs, const TermFreq& rhs) {
+            return lhs.term < rhs.term;
+        });
+    });
+    size_t posting_count = 0;
+    for (auto terms = added_terms; terms != added_terms + document_count; ++terms) {
+        posting_count += terms->size();
+    }
+    MetricsRegistry::Get().Add(IngestionCounter::DOCUMENTS_ADDED, document_count);
+    MetricsRegistry::Get().Add(IngestionCounter::POSTINGS_ADDED, posting_count);
+    UpdateSegments();
+}
+
+template <typename ExecutionPolicy>
+void InvertedIndex::RemoveDocument(ExecutionPolicy&& policy, DocumentOrdinal document) {
+    std::vector<TermId> removed_terms;
+    if (document < mutable_first_document_) {
+        RemoveFrozenDocument(document, removed_terms);
+    } else if (const size_t offset = document - mutable_first_document_; offset < document_terms_.size()) {
+        if (mutable_removed_.size() <= offset / 64) {
+            mutable_removed_.resize(offset / 64 + 1);
+        }
+        mutable_removed_[offset / 64] |= uint64_t{1} << (offset % 64);
+        auto& terms = GetMutableDocumentTerms(document);
+        // every term owns its own posting list, so the lists can be patched independently
+        std::for_each(policy, terms.begin(), terms.end(), [this, document](const TermFreq& term_freq) {
+            RemovePosting(term_freq.term, document);
+        });
+        for (const TermFreq& term_freq : terms) {
+            removed_terms.push_back(term_freq.term);
+        }
+        std::vector<TermFreq>().swap(terms);
+        MetricsRegistry::Get().Add(IngestionCounter::DOCUMENTS_REMOVED, 1);
+    }
+    DecreaseDocumentFreqs(removed_terms);
+    UpdateSegments();
+}
+
+template <typename ExecutionPolicy>
+void InvertedIndex::RemoveDocuments(ExecutionPolicy&& policy, const std::vector<DocumentOrdinal>& documents) {
+    std::vector<TermId> removed_terms;
+    std::vector<TermId> terms;
+    for (const DocumentOrdinal document : documents) {
+        if (document < mutable_first_document_) {
+            RemoveFrozenDocument(document, removed_terms);
+            continue;
+        }
+        const size_t offset = document - mutable_first_document_;
+        if (offset >= document_terms_.size() || IsRemoved(document)) {
+            continue;
+        }
+        if (mutable_removed_.size() <= offset / 64) {
+            mutable_removed_.resize(offset / 64 + 1);
+        }
+        mutable_removed_[offset / 64] |= uint64_t{1} << (offset % 64);
+        auto& document_terms = GetMutableDocumentTerms(document);
+        for (const TermFreq& term_freq : document_terms) {
+            terms.push_back(term_freq.term);
+        }
+        std::vector<TermFreq>().swap(document_terms);
+        MetricsRegistry::Get().Add(IngestionCounter::DOCUMENTS_REMOVED, 1);
+    }
+    removed_terms.insert(removed_terms.end(), terms.begin(), terms.end());
+    std::sort(terms.begin(), terms.end());
+    terms.erase(std::unique(terms.begin(), terms.end()), terms.end());
+    // every term owns its own posting list, so the lists can be filtered independently
+    std::for_each(policy, terms.begin(), terms.end(), [this](TermId term) {
+        postings_[term].EraseRemoved(mutable_removed_, mutable_first_document_);
+    });
+    DecreaseDocumentFreqs(removed_terms);
+    UpdateSegments();
+}
+
+template <typename Callback>
+void InvertedIndex::ForEachPostings(TermId term, PostingBuffers& buffers, Callback callback) const {
+    for (size_t segment = 0; segment < segments_.size(); ++segment) {
+        Postings postings = GetPostings(*segments_[segment].segment, term, buffers);
+        if (postings.size() > 0) {
+            postings.segment = segment;
+            callback(postings);
+        }
+    }
+    if (term < postings_.size() && postings_[term].size() > 0) {
+        Postings postings = ViewOf(postings_[term]);
+        postings.segment = segments_.size();
+        callback(postings);
+    }
+}
+
+template <typename Callback>
+void InvertedIndex::ForEachMutableRemoved(Callback callback) const {
+    for (DocumentOrdinal offset = 0; offset < mutable_removed_.size() * 64; ++offset) {
+        if ((mutable_removed_[offset / 64] >> (offset % 64) & 1) != 0) {
+            callback(mutable_first_document_ + offset);
+        }
+    }
+}
+
+template <typename Callback>
+void InvertedIndex::ForEachRemoved(DocumentOrdinal begin, DocumentOrdinal end, Callback callback) const {
+    for (const SegmentState& state : segments_) {
+        const DocumentOrdinal first = state.segment->first_document;
+        const DocumentOrdinal last = std::min(end, first + static_cast<DocumentOrdinal>(state.removed.size() * 64));
+        for (DocumentOrdinal document = std::max(begin, first); document < last; ++document) {
+            const DocumentOrdinal offset = document - first;
+            if ((state.removed[offset / 64] >> (offset % 64)) == 0) {
+                // nothing left in this word
+                document += 63 - offset % 64;
+            } else if (state.IsRemoved(document)) {
+                callback(document);
+            }
+        }
+    }
+}
@@ -2,12 +2,14 @@
 
 #include <chrono>
 #include <iostream>
+#include <string>
 
 #define PROFILE_CONCAT_INTERNAL(X, Y) X##Y
 #define PROFILE_CONCAT(X, Y) PROFILE_CONCAT_INTERNAL(X, Y)
 #define UNIQUE_VAR_NAME_PROFILE PROFILE_CONCAT(profileGuard, __LINE__)
-#define LOG_DURATION(x) LogDuration UNIQUE_VAR_NAME_PROFILE(x)
-#define LOG_DURATION(x,y) LogDuration UNIQUE_VAR_NAME_PROFILE(x,y)
+// LOG_DURATION(id) reports to std::cerr, LOG_DURATION(id, stream) to the stream.
+// Query stages are timed by StageTimer into the metrics registry instead.
+#define LOG_DURATION(...) LogDuration UNIQUE_VAR_NAME_PROFILE(__VA_ARGS__)
 
 class LogDuration {
 public:
@@ -15,7 +17,7 @@ public:
     //   using  
     using Clock = std::chrono::steady_clock;
 
-    LogDuration(const std::string& id, std::ostream& type)
+    explicit LogDuration(const std::string& id, std::ostream& type = std::cerr)
         : id_(id), stream_(type) {
     }
 
@@ -1,13 +1,28 @@
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
 #include <execution>
+#include <fstream>
 #include <iostream>
+#include <map>
 #include <random>
 #include <string>
+#include <thread>
 #include <vector>
 #include <string_view>
 
+#include <malloc.h>
+#include <unistd.h>
+
+#include "benchmark.h"
+#include "concurrent_search_server.h"
 #include "search_server.h"
 #include "log_duration.h"
 #include "process_queries.h"
+#include "remove_duplicates.h"
+#include "request_queue.h"
+#include "search_server_tests.h"
 
 using namespace std;
 
@@ -50,9 +65,138 @@ vector<string> GenerateQueries(mt19937& generator, const vector<string>& diction
     }
     return queries;
 }
+size_t GetResidentMemory() {
+    size_t total_pages = 0;
+    size_t resident_pages = 0;
+    ifstream("/proc/self/statm"s) >> total_pages >> resident_pages;
+    return resident_pages * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+}
+
+// Peak resident memory since the last call.
+size_t GetPeakResidentMemoryDelta() {
+    static size_t resident_before = 0;
+    size_t peak_kb = 0;
+    ifstream status("/proc/self/status"s);
+    for (string line; getline(status, line);) {
+        if (line.rfind("VmHWM:"s, 0) == 0) {
+            peak_kb = stoul(line.substr(6));
+        }
+    }
+    const size_t peak = peak_kb * 1024 > resident_before ? peak_kb * 1024 - resident_before : 0;
+    // restarts the peak from the current resident size
+    ofstream("/proc/self/clear_refs"s) << "5"s;
+    resident_before = GetResidentMemory();
+    return peak;
+}
+
+// The nested map layout the server used before the flat posting lists,
+// kept here as the baseline for the index layout benchmark.
+struct MapIndex {
+    map<string, map<int, double>> word_to_document_freqs;
+
+    vector<Document> FindTopDocuments(const string_view raw_query) const {
+        map<int, double> document_to_relevance;
+        auto words = SplitIntoWords(raw_query);
+        sort(words.begin(), words.end());
+        words.erase(unique(words.begin(), words.end()), words.end());
+        for (const string& word : words) {
+            const auto it = word_to_document_freqs.find(word);
+            if (it == word_to_document_freqs.end()) {
+                continue;
+            }
+            const double inverse_document_freq = log(document_count * 1.0 / it->second.size());
+            for (const auto [document_id, term_freq] : it->second) {
+                document_to_relevance[document_id] += term_freq * inverse_document_freq;
+            }
+        }
+        vector<Document> matched_documents;
+        for (const auto [document_id, relevance] : document_to_relevance) {
+            matched_documents.push_back({document_id, relevance, 2});
+        }
+        sort(matched_documents.begin(), matched_documents.end(), [](const Document& lhs, const Document& rhs) {
+            if (abs(lhs.relevance - rhs.relevance) < EPSILON) {
+                return lhs.rating > rhs.rating;
+            } else {
+                return lhs.relevance > rhs.relevance;
+            }
+        });
+        if (matched_documents.size() > MAX_RESULT_DOCUMENT_COUNT) {
+            matched_documents.resize(MAX_RESULT_DOCUMENT_COUNT);
+        }
+        return matched_documents;
+    }
+
+    int document_count = 0;
+};
+
+void TestIndexLayout(const string& stop_word, const vector<string>& documents, const vector<string>& queries) {
+    // pages freed by earlier tests would be reused and hide the growth
+    malloc_trim(0);
+    {
+        const size_t memory_before = GetResidentMemory();
+        MapIndex map_index;
+        {
+            LOG_DURATION("map index build"s, cout);
+            for (size_t i = 0; i < documents.size(); ++i) {
+                auto words = SplitIntoWords(documents[i]);
+                words.erase(remove(words.begin(), words.end(), stop_word), words.end());
+                const double inv_word_count = 1.0 / words.size();
+                for (const string& word : words) {
+                    map_index.word_to_document_freqs[word][i] += inv_word_count;
+                }
+                ++map_index.document_count;
+            }
+        }
+        cout << "map index memory: "s << (GetResidentMemory() - memory_before) / 1024 << " KB"s << endl;
+        LOG_DURATION("map index queries"s, cout);
+        double total_relevance = 0;
+        for (const string& query : queries) {
+            for (const auto& document : map_index.FindTopDocuments(query)) {
+                total_relevance += document.relevance;
+            }
+        }
+        cout << total_relevance << endl;
+    }
+    // hand the pages of the map index back so they do not hide the next measurement
+    malloc_trim(0);
+    {
+        const size_t memory_before = GetResidentMemory();
+        SearchServer search_server(stop_word);
+        {
+            LOG_DURATION("flat index build"s, cout);
+            for (size_t i = 0; i < documents.size(); ++i) {
+                search_server.AddDocument(i, documents[i], DocumentStatus::ACTUAL, { 1, 2, 3 });
+            }
+        }
+        cout << "flat index memory: "s << (GetResidentMemory() - memory_before) / 1024 << " KB"s
+             << " (estimated "s << search_server.GetIndexMemoryUsage() / 1024 << " KB)"s << endl;
+        LOG_DURATION("flat index queries"s, cout);
+        double total_relevance = 0;
+        for (const string& query : queries) {
+            for (const auto& document : search_server.FindTopDocuments(query)) {
+                total_relevance += document.relevance;
+            }
+        }
+        cout << total_relevance << endl;
+    }
+}
+
+// Picks words with a frequency falling roughly as 1/rank, like natural text does.
+string GenerateZipfText(mt19937& generator, const vector<string>& dictionary, int word_count) {
+    string text;
+    for (int i = 0; i < word_count; ++i) {
+        if (!text.empty()) {
+            text.push_back(' ');
+        }
+        const double exponent = uniform_real_distribution<>(0, 1)(generator);
+        text += dictionary[static_cast<size_t>(pow(dictionary.size(), exponent)) - 1];
+    }
+    return text;
+}
+
 template <typename ExecutionPolicy>
 void Test(string_view mark, const SearchServer& search_server, const vector<string>& queries, ExecutionPolicy&& policy) {
-    LOG_DURATION(mark);
+    LOG_DURATION(string(mark), cout);
     double total_relevance = 0;
     for (const string_view query : queries) {
         for (const auto& document : search_server.FindTopDocuments(policy, query)) {
@@ -61,8 +205,659 @@ void Test(string_view mark, const SearchServer& search_server, const vector<stri
     }
     cout << total_relevance << endl;
 }
+void TestTokenizer(const vector<string>& documents) {
+    size_t word_count = 0;
+    {
+        LOG_DURATION("SplitIntoWords"s, cout);
+        for (int i = 0; i < 10; ++i) {
+            for (const string& document : documents) {
+                word_count += SplitIntoWords(document).size();
+            }
+        }
+    }
+    cout << word_count << endl;
+    word_count = 0;
+    {
+        LOG_DURATION("ForEachWord"s, cout);
+        for (int i = 0; i < 10; ++i) {
+            for (const string& document : documents) {
+                ForEachWord(document, [&word_count](string_view, bool is_valid) {
+                    word_count += is_valid;
+                });
+            }
+        }
+    }
+    cout << word_count << endl;
+}
+
+void TestPruning(mt19937& generator, const vector<string>& dictionary) {
+    SearchServer search_server(dictionary[0]);
+    for (int i = 0; i < 50'000; ++i) {
+        search_server.AddDocument(i, GenerateZipfText(generator, dictionary, 50), DocumentStatus::ACTUAL, { 1, 2, 3 });
+    }
+    vector<string> queries;
+    for (int i = 0; i < 100; ++i) {
+        queries.push_back(GenerateZipfText(generator, dictionary, 20));
+    }
+    Test("zipf seq"sv, search_server, queries, execution::seq);
+    Test("zipf block_max_wand"sv, search_server, queries, block_max_wand);
+}
+
 #define TEST(policy) Test(#policy, search_server, queries, execution::policy)
-int main() {
+template <typename ExecutionPolicy>
+void TestBulkAdd(string_view mark, const string& stop_word, const vector<DocumentToAdd>& batch, ExecutionPolicy&& policy) {
+    SearchServer search_server(stop_word);
+    {
+        LOG_DURATION(string(mark), cout);
+        search_server.AddDocuments(policy, batch);
+    }
+    cout << search_server.GetDocumentCount() << endl;
+}
+void TestBulkAdd(const string& stop_word, const vector<string>& documents) {
+    vector<DocumentToAdd> batch;
+    for (int i = 0; i < 20; ++i) {
+        for (const string& document : documents) {
+            batch.push_back({static_cast<int>(batch.size()), document, DocumentStatus::ACTUAL, { 1, 2, 3 }});
+        }
+    }
+    {
+        SearchServer search_server(stop_word);
+        {
+            LOG_DURATION("AddDocument loop"s, cout);
+            for (const DocumentToAdd& document : batch) {
+                search_server.AddDocument(document.id, document.text, document.status, document.ratings);
+            }
+        }
+        cout << search_server.GetDocumentCount() << endl;
+    }
+    TestBulkAdd("AddDocuments seq"sv, stop_word, batch, execution::seq);
+    TestBulkAdd("AddDocuments par"sv, stop_word, batch, execution::par);
+}
+double SumRelevance(const SearchServer& search_server, const vector<string>& queries) {
+    double relevance_sum = 0.0;
+    for (const string& query : queries) {
+        for (const Document& document : search_server.FindTopDocuments(query)) {
+            relevance_sum += document.relevance;
+        }
+    }
+    return relevance_sum;
+}
+void TestSnapshot(const string& stop_word, const vector<string>& documents, const vector<string>& queries) {
+    const string path = "search_server.snapshot"s;
+    vector<DocumentToAdd> batch;
+    for (int i = 0; i < 20; ++i) {
+        for (const string& document : documents) {
+            batch.push_back({static_cast<int>(batch.size()), document, DocumentStatus::ACTUAL, { 1, 2, 3 }});
+        }
+    }
+    {
+        SearchServer search_server(stop_word);
+        {
+            LOG_DURATION("rebuild from text"s, cout);
+            search_server.AddDocuments(execution::par, batch);
+        }
+        {
+            LOG_DURATION("save snapshot"s, cout);
+            search_server.SaveSnapshot(path);
+        }
+        LOG_DURATION("queries on rebuilt"s, cout);
+        cout << SumRelevance(search_server, queries) << endl;
+    }
+    {
+        LOG_DURATION("load snapshot"s, cout);
+        const SearchServer search_server = SearchServer::LoadSnapshot(path);
+        cout << search_server.GetDocumentCount() << endl;
+    }
+    {
+        const SearchServer search_server = SearchServer::LoadSnapshot(path);
+        LOG_DURATION("queries on snapshot"s, cout);
+        cout << SumRelevance(search_server, queries) << endl;
+    }
+    remove(path.c_str());
+}
+void TestWriteHeavy(const string& stop_word, const vector<string>& documents, const vector<string>& queries) {
+    // documents keep coming, some are taken down again and queries never stop
+    mt19937 generator;
+    SearchServer search_server(stop_word);
+    vector<int> document_ids;
+    double relevance_sum = 0.0;
+    {
+        LOG_DURATION("write-heavy mix"s, cout);
+        for (int i = 0; i < 20 * static_cast<int>(documents.size()); ++i) {
+            search_server.AddDocument(i, documents[i % documents.size()], DocumentStatus::ACTUAL, { 1, 2, 3 });
+            document_ids.push_back(i);
+            if (i % 1000 != 999) {
+                continue;
+            }
+            for (int j = 0; j < 100; ++j) {
+                swap(document_ids[uniform_int_distribution<size_t>(0, document_ids.size() - 1)(generator)], document_ids.back());
+                search_server.RemoveDocument(document_ids.back());
+                document_ids.pop_back();
+            }
+            for (const Document& document : search_server.FindTopDocuments(queries[i / 1000 % queries.size()])) {
+                relevance_sum += document.relevance;
+            }
+        }
+    }
+    cout << search_server.GetDocumentCount() << " "s << relevance_sum << endl;
+}
+void TestConcurrentReadWrite(const string& stop_word, const vector<string>& documents, const vector<string>& queries) {
+    // readers check that every version they see is consistent in itself
+    ConcurrentSearchServer search_server(stop_word);
+    atomic<bool> is_writing = true;
+    atomic<int> query_count = 0;
+    atomic<int> inconsistent_count = 0;
+    vector<thread> readers;
+    for (unsigned i = 0; i < max(2u, thread::hardware_concurrency()); ++i) {
+        readers.emplace_back([&, i] {
+            for (size_t query = i; is_writing; query += 7) {
+                search_server.Read([&](const SearchServer& version) {
+                    const auto documents = version.FindTopDocuments(queries[query % queries.size()]);
+                    const auto pruned_documents = version.FindTopDocuments(block_max_wand, queries[query % queries.size()]);
+                    const bool is_consistent = version.GetDocumentCount() == distance(version.begin(), version.end())
+                        && documents.size() == pruned_documents.size()
+                        && equal(documents.begin(), documents.end(), pruned_documents.begin(), [](const Document& lhs, const Document& rhs) {
+                               return lhs.id == rhs.id;
+                           });
+                    inconsistent_count += is_consistent ? 0 : 1;
+                });
+                ++query_count;
+            }
+        });
+    }
+    mt19937 generator;
+    vector<int> document_ids;
+    {
+        LOG_DURATION("write while serving"s, cout);
+        for (int i = 0; i < 20 * static_cast<int>(documents.size()); ++i) {
+            search_server.AddDocument(i, documents[i % documents.size()], DocumentStatus::ACTUAL, { 1, 2, 3 });
+            document_ids.push_back(i);
+            if (i % 1000 != 999) {
+                continue;
+            }
+            for (int j = 0; j < 100; ++j) {
+                swap(document_ids[uniform_int_distribution<size_t>(0, document_ids.size() - 1)(generator)], document_ids.back());
+                search_server.RemoveDocument(document_ids.back());
+                document_ids.pop_back();
+            }
+            search_server.Publish();
+        }
+        is_writing = false;
+        for (thread& reader : readers) {
+            reader.join();
+        }
+    }
+    cout << search_server.Read([](const SearchServer& version) {
+        return version.GetDocumentCount();
+    }) << " documents, "s << query_count << " queries served, "s << inconsistent_count << " inconsistent"s << endl;
+}
+void TestQueryCache(mt19937& generator, const vector<string>& dictionary, SearchServer& search_server) {
+    // Zipfian traffic: the top 1% of distinct queries make up about half of the calls
+    vector<string> distinct_queries;
+    vector<double> weights;
+    for (int i = 0; i < 10'000; ++i) {
+        distinct_queries.push_back(GenerateQuery(generator, dictionary, 10, 0.1));
+        weights.push_back(1.0 / (i + 1));
+    }
+    discrete_distribution<size_t> query_distribution(weights.begin(), weights.end());
+    vector<string> queries;
+    for (int i = 0; i < 20'000; ++i) {
+        queries.push_back(distinct_queries[query_distribution(generator)]);
+    }
+
+    Test("uncached"sv, search_server, queries, execution::seq);
+    search_server.SetQueryCacheCapacity(1000);
+    Test("cached"sv, search_server, queries, execution::seq);
+    const auto stats = search_server.GetQueryCacheStats();
+    cout << stats.hits << " hits, "s << stats.misses << " misses, "s << stats.evictions << " evictions"s << endl;
+    search_server.SetQueryCacheCapacity(0);
+}
+void TestMatchDocuments(const SearchServer& search_server, const vector<string>& queries) {
+    const vector<int> document_ids(search_server.begin(), search_server.end());
+    vector<SearchServer::PreparedQuery> prepared_queries;
+    for (const string& query : queries) {
+        prepared_queries.push_back(search_server.PrepareQuery(query));
+    }
+    // every thread matches all queries against its own share of the documents
+    const auto match = [&](string_view mark, unsigned thread_count, auto match_document) {
+        atomic<size_t> matched_word_count = 0;
+        {
+            LOG_DURATION(string(mark) + " x"s + to_string(thread_count), cout);
+            vector<thread> threads;
+            for (unsigned i = 0; i < thread_count; ++i) {
+                threads.emplace_back([&, i] {
+                    size_t word_count = 0;
+                    for (size_t query = 0; query < queries.size(); ++query) {
+                        for (size_t document = i; document < document_ids.size(); document += thread_count) {
+                            word_count += get<0>(match_document(query, document_ids[document])).size();
+                        }
+                    }
+                    matched_word_count += word_count;
+                });
+            }
+            for (thread& thread : threads) {
+                thread.join();
+            }
+        }
+        cout << matched_word_count << endl;
+    };
+    for (const unsigned thread_count : {1u, max(2u, thread::hardware_concurrency())}) {
+        match("MatchDocument"sv, thread_count, [&](size_t query, int document_id) {
+            return search_server.MatchDocument(queries[query], document_id);
+        });
+        match("MatchDocument prepared"sv, thread_count, [&](size_t query, int document_id) {
+            return search_server.MatchDocument(prepared_queries[query], document_id);
+        });
+    }
+
+    const auto match_batch = [&](string_view mark, auto policy) {
+        size_t matched_word_count = 0;
+        bool is_same = true;
+        {
+            LOG_DURATION(string(mark), cout);
+            for (const auto& prepared_query : prepared_queries) {
+                const auto results = search_server.MatchDocuments(policy, prepared_query, document_ids);
+                for (size_t i = 0; i < results.size(); ++i) {
+                    matched_word_count += get<0>(results[i]).size();
+                    if (i % 97 == 0) {
+                        is_same = is_same && results[i] == search_server.MatchDocument(prepared_query, document_ids[i]);
+                    }
+                }
+            }
+        }
+        cout << matched_word_count << (is_same ? ""s : " mismatch"s) << endl;
+    };
+    match_batch("MatchDocuments seq"sv, execution::seq);
+    match_batch("MatchDocuments par"sv, execution::par);
+}
+void TestQueryExecutor(mt19937& generator, const vector<string>& dictionary, const SearchServer& search_server) {
+    // many cheap queries with a few expensive ones among them
+    vector<string> queries;
+    for (int i = 0; i < 2000; ++i) {
+        queries.push_back(GenerateQuery(generator, dictionary, i % 100 == 0 ? 70 : 3, 0.1));
+    }
+    const auto sum_relevance = [](const vector<vector<Document>>& results) {
+        double relevance_sum = 0.0;
+        for (const auto& documents : results) {
+            for (const Document& document : documents) {
+                relevance_sum += document.relevance;
+            }
+        }
+        return relevance_sum;
+    };
+    {
+        LOG_DURATION("transform par"s, cout);
+        vector<vector<Document>> results(queries.size());
+        transform(execution::par, queries.begin(), queries.end(), results.begin(), [&search_server](const string& query) {
+            return search_server.FindTopDocuments(query);
+        });
+        cout << sum_relevance(results) << endl;
+    }
+    for (const size_t thread_count : {size_t{1}, size_t{4}}) {
+        QueryExecutor executor(thread_count);
+        LOG_DURATION("executor x"s + to_string(thread_count), cout);
+        cout << sum_relevance(ProcessQueries(executor, search_server, queries)) << endl;
+    }
+    {
+        QueryExecutor executor;
+        const auto start = chrono::steady_clock::now();
+        atomic<int64_t> first_result_us = -1;
+        ProcessQueries(executor, search_server, queries, [&](size_t, vector<Document>) {
+            int64_t expected = -1;
+            first_result_us.compare_exchange_strong(expected, chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count());
+        });
+        const auto total_us = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+        cout << "streaming: first result after "s << first_result_us << " us of "s << total_us << " us"s << endl;
+    }
+}
+void TestProcessQueriesJoined(mt19937& generator, const vector<string>& dictionary, const SearchServer& search_server) {
+    vector<string> queries;
+    for (int i = 0; i < 100'000; ++i) {
+        queries.push_back(GenerateQuery(generator, dictionary, 3));
+    }
+    malloc_trim(0);
+    GetPeakResidentMemoryDelta();
+    {
+        LOG_DURATION("nested then copied"s, cout);
+        vector<Document> documents;
+        for (const auto& query_documents : ProcessQueries(search_server, queries)) {
+            documents.insert(documents.end(), query_documents.begin(), query_documents.end());
+        }
+        cout << documents.size() << " documents"s << endl;
+    }
+    malloc_trim(0);
+    cout << "nested then copied peak: "s << GetPeakResidentMemoryDelta() / 1024 << " KB"s << endl;
+    {
+        LOG_DURATION("ProcessQueriesJoined"s, cout);
+        const auto documents = ProcessQueriesJoined(search_server, queries);
+        size_t page_count = 0;
+        for (const auto& page : Paginate(documents, 1000)) {
+            page_count += page.size() > 0;
+        }
+        cout << documents.size() << " documents, "s << page_count << " pages"s << endl;
+    }
+    malloc_trim(0);
+    cout << "ProcessQueriesJoined peak: "s << GetPeakResidentMemoryDelta() / 1024 << " KB"s << endl;
+}
+void TestRemoveDuplicates(const string& stop_word, const vector<string>& documents) {
+    // every text five times over, and every copy with its words in another order
+    SearchServer search_server(stop_word);
+    for (int copy = 0; copy < 5; ++copy) {
+        for (size_t i = 0; i < documents.size(); ++i) {
+            string text = documents[i];
+            if (const size_t space = text.find(' '); copy % 2 == 1 && space != string::npos) {
+                text = text.substr(space + 1) + ' ' + text.substr(0, space);
+            }
+            search_server.AddDocument(copy * documents.size() + i, text, DocumentStatus::ACTUAL, { 1, 2, 3 });
+        }
+    }
+    {
+        LOG_DURATION("set of word sets"s, cout);
+        set<set<string>> word_sets;
+        size_t duplicate_count = 0;
+        for (const int document_id : search_server) {
+            set<string> words;
+            for (const auto& [word, freq] : search_server.GetWordFrequencies(document_id)) {
+                words.emplace(word);
+            }
+            duplicate_count += !word_sets.insert(move(words)).second;
+        }
+        cout << duplicate_count << " duplicates"s << endl;
+    }
+    // the removals are reported one per line, which is not what is measured
+    auto* const output = cout.rdbuf(nullptr);
+    {
+        LOG_DURATION("RemoveDuplicates"s, cerr);
+        RemoveDuplicates(search_server);
+    }
+    cout.rdbuf(output);
+    cout.clear();
+    cout << search_server.GetDocumentCount() << " documents left"s << endl;
+}
+void TestBulkExpiry(const string& stop_word, const vector<string>& documents, const vector<string>& queries) {
+    // ten days of documents, each with a word of its own; three in ten expire at once, spread over all days
+    vector<DocumentToAdd> batch;
+    vector<string> texts;
+    texts.reserve(10 * documents.size());
+    for (size_t i = 0; i < 10 * documents.size(); ++i) {
+        texts.push_back(documents[i % documents.size()] + " tag"s + to_string(i));
+    }
+    vector<int> expired_ids;
+    for (size_t i = 0; i < texts.size(); ++i) {
+        batch.push_back({static_cast<int>(i), texts[i], DocumentStatus::ACTUAL, { 1, 2, 3 }});
+        if (i % 10 < 3) {
+            expired_ids.push_back(static_cast<int>(i));
+        }
+    }
+    SearchServer one_by_one(stop_word);
+    SearchServer batched(stop_word);
+    one_by_one.AddDocuments(batch);
+    batched.AddDocuments(batch);
+    {
+        LOG_DURATION("RemoveDocuments"s, cout);
+        batched.RemoveDocuments(expired_ids);
+    }
+    {
+        LOG_DURATION("RemoveDocument loop"s, cout);
+        for (const int document_id : expired_ids) {
+            one_by_one.RemoveDocument(document_id);
+        }
+    }
+    const size_t memory_usage = batched.GetIndexMemoryUsage();
+    {
+        LOG_DURATION("Compact"s, cout);
+        batched.Compact();
+    }
+    cout << "index "s << memory_usage / 1024 << " KB -> "s << batched.GetIndexMemoryUsage() / 1024 << " KB"s << endl;
+    size_t mismatch_count = 0;
+    for (const string& query : queries) {
+        const auto expected = one_by_one.FindTopDocuments(query);
+        const auto found = batched.FindTopDocuments(query);
+        mismatch_count += !equal(expected.begin(), expected.end(), found.begin(), found.end(), [](const Document& lhs, const Document& rhs) {
+            return lhs.id == rhs.id;
+        });
+    }
+    cout << batched.GetDocumentCount() << " documents left, "s << mismatch_count << " mismatches"s << endl;
+}
+void TestScoringModes(const string& stop_word, const vector<string>& documents, const vector<string>& queries) {
+    vector<DocumentToAdd> batch;
+    for (size_t i = 0; i < 5 * documents.size(); ++i) {
+        batch.push_back({static_cast<int>(i), documents[i % documents.size()], DocumentStatus::ACTUAL, { 1, 2, 3 }});
+    }
+    SearchServer exact_server(stop_word);
+    exact_server.AddDocuments(batch);
+    const auto exact = exact_server.CreateVersion();
+    for (const auto& [mark, scoring_mode] : {pair{"exact"s, ScoringMode::EXACT}, pair{"16-bit impacts"s, ScoringMode::IMPACT_16_BIT},
+                                             pair{"8-bit impacts"s, ScoringMode::IMPACT_8_BIT}}) {
+        SearchServer search_server(stop_word, scoring_mode);
+        search_server.AddDocuments(batch);
+        // only frozen segments store impacts
+        const auto version = search_server.CreateVersion();
+        cout << mark << " index memory: "s << version->GetIndexMemoryUsage() / 1024 << " KB"s << endl;
+        Test(mark + " seq"s, *version, queries, execution::seq);
+        double max_error = 0.0;
+        double max_bound = 0.0;
+        for (const string& query : queries) {
+            const auto documents_found = version->FindTopDocuments(query, DocumentStatus::ACTUAL, 1000);
+            for (const Document& document : exact->FindTopDocuments(query, DocumentStatus::ACTUAL, 1000)) {
+                const auto it = find_if(documents_found.begin(), documents_found.end(), [&document](const Document& found) {
+                    return found.id == document.id;
+                });
+                if (it != documents_found.end()) {
+                    max_error = max(max_error, abs(it->relevance - document.relevance));
+                }
+            }
+            max_bound = max(max_bound, version->GetRelevanceErrorBound(query));
+        }
+        cout << mark << " relevance error: "s << max_error << " (bound "s << max_bound << ")"s << endl;
+    }
+}
+
+void TestCompressedPostings(string_view mark, const string& stop_word, const vector<string>& documents, const vector<string>& queries) {
+    vector<DocumentToAdd> batch;
+    for (size_t i = 0; i < documents.size(); ++i) {
+        batch.push_back({static_cast<int>(i), documents[i], DocumentStatus::ACTUAL, { 1, 2, 3 }});
+    }
+    for (const auto& [mode_mark, scoring_mode] : {pair{"flat"s, ScoringMode::EXACT}, pair{"compressed"s, ScoringMode::COMPRESSED}}) {
+        const string prefix = string(mark) + " "s + mode_mark;
+        InvertedIndex index(scoring_mode);
+        index.AddDocuments(execution::seq, 0, documents.size(), [&](size_t i, vector<string_view>& words) {
+            ForEachWord(documents[i], [&](string_view word, bool) {
+                if (word != stop_word) {
+                    words.push_back(word);
+                }
+            });
+        });
+        index.Freeze();
+
+        InvertedIndex::PostingBuffers buffers;
+        size_t posting_count = 0;
+        double total_freq = 0.0;
+        const auto start = chrono::steady_clock::now();
+        for (TermId term = 0; term < index.GetTermCount(); ++term) {
+            buffers.Clear();
+            index.ForEachPostings(term, buffers, [&](const InvertedIndex::Postings& postings) {
+                posting_count += postings.size();
+                for (size_t i = 0; i < postings.size(); ++i) {
+                    total_freq += postings.term_freqs[i];
+                }
+            });
+        }
+        const double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        cout << prefix << ": "s << index.GetPostingMemoryUsage() * 1.0 / posting_count << " bytes per posting, "s
+             << posting_count / seconds / 1e6 << " M postings/s read ("s << total_freq << ")"s << endl;
+
+        SearchServer search_server(stop_word, scoring_mode);
+        search_server.AddDocuments(batch);
+        // only frozen segments are compressed
+        const auto version = search_server.CreateVersion();
+        cout << prefix << " index memory: "s << version->GetIndexMemoryUsage() / 1024 << " KB"s << endl;
+        Test(prefix + " queries"s, *version, queries, execution::seq);
+    }
+}
+
+void TestCompressedPostings(mt19937& generator, const vector<string>& dictionary, const string& stop_word,
+                            const vector<string>& documents, const vector<string>& queries) {
+    TestCompressedPostings("synthetic"sv, stop_word, documents, queries);
+    vector<string> zipf_documents;
+    for (int i = 0; i < 50'000; ++i) {
+        zipf_documents.push_back(GenerateZipfText(generator, dictionary, 50));
+    }
+    vector<string> zipf_queries;
+    for (int i = 0; i < 100; ++i) {
+        zipf_queries.push_back(GenerateZipfText(generator, dictionary, 10));
+    }
+    TestCompressedPostings("zipf"sv, stop_word, zipf_documents, zipf_queries);
+}
+
+void TestMetrics(const SearchServer& search_server, const vector<string>& queries) {
+    MetricsRegistry& metrics = MetricsRegistry::Get();
+    for (const bool is_enabled : {false, true}) {
+        metrics.SetEnabled(is_enabled);
+        Test(is_enabled ? "metrics on"s : "metrics off"s, search_server, queries, execution::seq);
+    }
+    constexpr int SAMPLE_COUNT = 1'000'000;
+    {
+        LOG_DURATION("1M stage samples"s, cout);
+        for (int i = 0; i < SAMPLE_COUNT; ++i) {
+            StageTimer timer(QueryStage::TOP_K_SELECTION);
+        }
+    }
+    metrics.Reset();
+    Test("metrics after reset"s, search_server, queries, execution::par);
+    const MetricsSnapshot snapshot = metrics.GetSnapshot();
+    snapshot.WriteText(cout);
+    snapshot.WriteJson(cout);
+    cout << endl;
+}
+
+void TestRequestQueue(const SearchServer& search_server, const vector<string>& queries) {
+    RequestQueue request_queue(search_server);
+    constexpr int RECORD_COUNT = 1'000'000;
+    {
+        LOG_DURATION("1M requests recorded by 4 threads"s, cout);
+        vector<thread> threads;
+        for (int i = 0; i < 4; ++i) {
+            threads.emplace_back([&request_queue, i] {
+                for (int j = 0; j < RECORD_COUNT / 4; ++j) {
+                    request_queue.RecordRequest((i + j) % 3 == 0, chrono::microseconds(j % 1000));
+                }
+            });
+        }
+        for (thread& thread : threads) {
+            thread.join();
+        }
+    }
+    {
+        LOG_DURATION("queries served through the queue"s, cout);
+        for (const string& query : queries) {
+            request_queue.AddFindRequest(query);
+        }
+    }
+    RequestQueue::WindowStats stats;
+    {
+        LOG_DURATION("1k window stats"s, cout);
+        for (int i = 0; i < 1000; ++i) {
+            stats = request_queue.GetWindowStats(chrono::hours(24));
+        }
+    }
+    cout << stats.request_count << " requests, "s << stats.no_result_count << " without results, p50 "s
+         << chrono::duration_cast<chrono::microseconds>(stats.GetLatencyPercentile(50)).count() << " us, p99 "s
+         << chrono::duration_cast<chrono::microseconds>(stats.GetLatencyPercentile(99)).count() << " us"s << endl;
+}
+
+void TestDeepPagination(SearchServer& search_server, const vector<string>& queries) {
+    // reading 50 pages of 20, against fetching the whole top for every page
+    constexpr size_t PAGE_SIZE = 20;
+    constexpr size_t PAGE_COUNT = 50;
+    size_t document_count = 0;
+    {
+        LOG_DURATION("top recomputed per page"s, cout);
+        for (const string& query : vector<string>(queries.begin(), queries.begin() + 10)) {
+            for (size_t page = 1; page <= PAGE_COUNT; ++page) {
+                document_count += search_server.FindTopDocuments(query, DocumentStatus::ACTUAL, page * PAGE_SIZE).size();
+            }
+        }
+    }
+    for (const size_t capacity : {0, 100}) {
+        search_server.SetPageCacheCapacity(capacity);
+        LOG_DURATION(capacity == 0 ? "cursor pages"s : "cursor pages, page cache"s, cout);
+        for (const string& query : vector<string>(queries.begin(), queries.begin() + 10)) {
+            string cursor;
+            for (size_t page = 1; page <= PAGE_COUNT; ++page) {
+                SearchPage result = search_server.FindPage(query, PAGE_SIZE, cursor);
+                document_count += result.documents.size();
+                cursor = move(result.next_cursor);
+            }
+        }
+    }
+    search_server.SetPageCacheCapacity(0);
+    cout << document_count << " documents"s << endl;
+}
+
+void TestPhraseQueries(mt19937& generator, const string& stop_word, const vector<string>& documents) {
+    // phrases of two and three words taken from the documents, so that they occur
+    vector<string> phrase_queries;
+    vector<string> word_queries;
+    for (int i = 0; i < 100; ++i) {
+        const string& document = documents[uniform_int_distribution<size_t>(0, documents.size() - 1)(generator)];
+        vector<string_view> words;
+        ForEachWord(document, [&words](string_view word, bool) {
+            words.push_back(word);
+        });
+        const size_t length = min<size_t>(2 + i % 2, words.size());
+        const size_t first = uniform_int_distribution<size_t>(0, words.size() - length)(generator);
+        string text;
+        for (size_t j = first; j < first + length; ++j) {
+            text += (text.empty() ? ""s : " "s) + string(words[j]);
+        }
+        phrase_queries.push_back("\""s + text + "\""s);
+        word_queries.push_back(text);
+    }
+
+    size_t word_count = 0;
+    for (const string& document : documents) {
+        ForEachWord(document, [&word_count](string_view, bool) {
+            ++word_count;
+        });
+    }
+    for (const bool is_positions_enabled : {false, true}) {
+        SearchServer search_server(stop_word);
+        search_server.SetPositionsEnabled(is_positions_enabled);
+        {
+            LOG_DURATION(is_positions_enabled ? "add with positions"s : "add without positions"s, cout);
+            for (size_t i = 0; i < documents.size(); ++i) {
+                search_server.AddDocument(i, documents[i], DocumentStatus::ACTUAL, { 1, 2, 3 });
+            }
+        }
+        cout << "index memory: "s << search_server.GetIndexMemoryUsage() / 1024 << " KB, positions "s
+             << search_server.GetPositionMemoryUsage() / 1024 << " KB, "s
+             << search_server.GetPositionMemoryUsage() * 1.0 / word_count << " bytes per word"s << endl;
+        if (is_positions_enabled) {
+            Test("words of the phrases"s, search_server, word_queries, execution::seq);
+            Test("phrases"s, search_server, phrase_queries, execution::seq);
+            Test("phrases, block_max_wand"s, search_server, phrase_queries, block_max_wand);
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    // main --benchmark [path] runs the benchmark suite alone and writes its JSON report
+    if (argc > 1 && argv[1] == "--benchmark"sv) {
+        if (argc > 2) {
+            ofstream out(argv[2]);
+            RunBenchmarks(BenchmarkConfig{}, out);
+        } else {
+            RunBenchmarks(BenchmarkConfig{}, cout);
+        }
+        return 0;
+    }
+    // main --test runs the behaviour tests alone
+    if (argc > 1 && argv[1] == "--test"sv) {
+        RunSearchServerTests();
+        return 0;
+    }
+
     mt19937 generator;
     const auto dictionary = GenerateDictionary(generator, 1000, 10);
     const auto documents = GenerateQueries(generator, dictionary, 10'000, 70);
@@ -73,4 +868,25 @@ int main() {
     const auto queries = GenerateQueries(generator, dictionary, 100, 70);
     TEST(seq);
     TEST(par);
+    Test("block_max_wand"sv, search_server, queries, block_max_wand);
+    TestQueryCache(generator, dictionary, search_server);
+    TestMatchDocuments(search_server, vector<string>(queries.begin(), queries.begin() + 10));
+    TestQueryExecutor(generator, dictionary, search_server);
+    TestProcessQueriesJoined(generator, dictionary, search_server);
+    TestRemoveDuplicates(dictionary[0], documents);
+    TestBulkExpiry(dictionary[0], documents, queries);
+    TestScoringModes(dictionary[0], documents, queries);
+    TestCompressedPostings(generator, dictionary, dictionary[0], documents, queries);
+    TestMetrics(search_server, queries);
+    TestRequestQueue(search_server, queries);
+    TestDeepPagination(search_server, queries);
+    TestPhraseQueries(generator, dictionary[0], documents);
+
+    TestIndexLayout(dictionary[0], documents, queries);
+    TestPruning(generator, dictionary);
+    TestTokenizer(documents);
+    TestBulkAdd(dictionary[0], documents);
+    TestSnapshot(dictionary[0], documents, queries);
+    TestWriteHeavy(dictionary[0], documents, queries);
+    TestConcurrentReadWrite(dictionary[0], documents, queries);
 }
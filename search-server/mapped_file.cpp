@@ -0,0 +1,66 @@
+#include "mapped_file.h"
+
+#include <stdexcept>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define MAPPED_FILE_MMAP
+#else
+#include <fstream>
+#endif
+
+using namespace std;
+
+#ifdef MAPPED_FILE_MMAP
+
+MappedFile::MappedFile(const string& path) {
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw runtime_error("Cannot open "s + path);
+    }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0) {
+        close(fd);
+        throw runtime_error("Cannot stat "s + path);
+    }
+    size_ = static_cast<size_t>(file_stat.st_size);
+    if (size_ > 0) {
+        void* data = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED) {
+            close(fd);
+            throw runtime_error("Cannot map "s + path);
+        }
+        data_ = static_cast<const char*>(data);
+    }
+    // the mapping keeps the file alive on its own
+    close(fd);
+}
+
+MappedFile::~MappedFile() {
+    if (data_ != nullptr) {
+        munmap(const_cast<char*>(data_), size_);
+    }
+}
+
+#else
+
+MappedFile::MappedFile(const string& path) {
+    ifstream input(path, ios::binary | ios::ate);
+    if (!input) {
+        throw runtime_error("Cannot open "s + path);
+    }
+    size_ = static_cast<size_t>(input.tellg());
+    buffer_ = make_unique<char[]>(size_);
+    input.seekg(0);
+    if (!input.read(buffer_.get(), size_)) {
+        throw runtime_error("Cannot read "s + path);
+    }
+    data_ = buffer_.get();
+}
+
+MappedFile::~MappedFile() = default;
+
+#endif
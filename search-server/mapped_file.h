@@ -0,0 +1,28 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+// Read-only contents of a whole file. On POSIX systems the file is mapped,
+// so pages are read on first access and shared with other processes mapping
+// it; elsewhere it is read into memory.
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path);
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile();
+
+    const char* data() const {
+        return data_;
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+    std::unique_ptr<char[]> buffer_;
+};
@@ -0,0 +1,173 @@
+#include "metrics.h"
+
+#include <cmath>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+using namespace std;
+
+static const string_view STAGE_NAMES[QUERY_STAGE_COUNT] = {
+    "parse"sv,
+    "resolve"sv,
+    "posting_traversal"sv,
+    "predicate_filtering"sv,
+    "minus_word_exclusion"sv,
+    "top_k_selection"sv,
+};
+
+static const string_view COUNTER_NAMES[INGESTION_COUNTER_COUNT] = {
+    "documents_added"sv,
+    "documents_removed"sv,
+    "terms_added"sv,
+    "terms_removed"sv,
+    "postings_added"sv,
+    "postings_removed"sv,
+};
+
+string_view GetStageName(QueryStage stage) {
+    return STAGE_NAMES[static_cast<size_t>(stage)];
+}
+
+string_view GetCounterName(IngestionCounter counter) {
+    return COUNTER_NAMES[static_cast<size_t>(counter)];
+}
+
+// Position of the highest set bit of a non-zero value.
+static unsigned GetHighestBit(uint64_t value) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanReverse64(&index, value);
+    return index;
+#else
+    return 63 - __builtin_clzll(value);
+#endif
+}
+
+size_t LatencyHistogram::GetBucket(uint64_t nanoseconds) {
+    if (nanoseconds < 4) {
+        return nanoseconds;
+    }
+    // the two bits below the highest one pick the quarter
+    const unsigned exponent = GetHighestBit(nanoseconds);
+    return 4 * (exponent - 1) + (nanoseconds >> (exponent - 2) & 3);
+}
+
+uint64_t LatencyHistogram::GetBucketLowerBound(size_t bucket) {
+    if (bucket < 4) {
+        return bucket;
+    }
+    return (4 + bucket % 4) << (bucket / 4 - 1);
+}
+
+uint64_t LatencyHistogram::GetPercentile(double percent) const {
+    if (count == 0) {
+        return 0;
+    }
+    const auto rank = max<uint64_t>(static_cast<uint64_t>(ceil(percent / 100 * count)), 1);
+    uint64_t seen = 0;
+    for (size_t bucket = 0; bucket + 1 < BUCKET_COUNT; ++bucket) {
+        seen += buckets[bucket];
+        if (seen >= rank) {
+            return GetBucketLowerBound(bucket + 1) - 1;
+        }
+    }
+    return UINT64_MAX;
+}
+
+void MetricsSnapshot::WriteText(ostream& out) const {
+    for (size_t stage = 0; stage < QUERY_STAGE_COUNT; ++stage) {
+        const LatencyHistogram& histogram = stages[stage];
+        out << STAGE_NAMES[stage] << ": "s << histogram.count << " samples, mean "s
+            << (histogram.count == 0 ? 0 : histogram.total_nanoseconds / histogram.count) << " ns, p50 "s
+            << histogram.GetPercentile(50) << " ns, p95 "s << histogram.GetPercentile(95) << " ns, p99 "s
+            << histogram.GetPercentile(99) << " ns"s << endl;
+    }
+    for (size_t counter = 0; counter < INGESTION_COUNTER_COUNT; ++counter) {
+        out << COUNTER_NAMES[counter] << ": "s << counters[counter] << endl;
+    }
+}
+
+void MetricsSnapshot::WriteJson(ostream& out) const {
+    out << "{\"stages\": {"s;
+    for (size_t stage = 0; stage < QUERY_STAGE_COUNT; ++stage) {
+        const LatencyHistogram& histogram = stages[stage];
+        out << (stage == 0 ? ""s : ", "s) << '"' << STAGE_NAMES[stage] << "\": {\"count\": "s << histogram.count
+            << ", \"total_ns\": "s << histogram.total_nanoseconds << ", \"p50_ns\": "s << histogram.GetPercentile(50)
+            << ", \"p95_ns\": "s << histogram.GetPercentile(95) << ", \"p99_ns\": "s << histogram.GetPercentile(99) << '}';
+    }
+    out << "}, \"counters\": {"s;
+    for (size_t counter = 0; counter < INGESTION_COUNTER_COUNT; ++counter) {
+        out << (counter == 0 ? ""s : ", "s) << '"' << COUNTER_NAMES[counter] << "\": "s << counters[counter];
+    }
+    out << "}}"s;
+}
+
+MetricsRegistry& MetricsRegistry::Get() {
+    static MetricsRegistry registry;
+    return registry;
+}
+
+void MetricsRegistry::Record(QueryStage stage, uint64_t nanoseconds) {
+    if (!IsEnabled()) {
+        return;
+    }
+    StageShard& shard = GetShard().stages[static_cast<size_t>(stage)];
+    Increment(shard.buckets[LatencyHistogram::GetBucket(nanoseconds)], 1);
+    Increment(shard.total_nanoseconds, nanoseconds);
+    Increment(shard.count, 1);
+}
+
+MetricsSnapshot MetricsRegistry::GetSnapshot() const {
+    lock_guard lock(mutex_);
+    MetricsSnapshot snapshot = SumShards();
+    for (size_t stage = 0; stage < QUERY_STAGE_COUNT; ++stage) {
+        LatencyHistogram& histogram = snapshot.stages[stage];
+        const LatencyHistogram& baseline = baseline_.stages[stage];
+        histogram.count -= baseline.count;
+        histogram.total_nanoseconds -= baseline.total_nanoseconds;
+        for (size_t bucket = 0; bucket < LatencyHistogram::BUCKET_COUNT; ++bucket) {
+            histogram.buckets[bucket] -= baseline.buckets[bucket];
+        }
+    }
+    for (size_t counter = 0; counter < INGESTION_COUNTER_COUNT; ++counter) {
+        snapshot.counters[counter] -= baseline_.counters[counter];
+    }
+    return snapshot;
+}
+
+void MetricsRegistry::Reset() {
+    lock_guard lock(mutex_);
+    baseline_ = SumShards();
+}
+
+MetricsRegistry::Shard& MetricsRegistry::GetShard() {
+    // the registry holds the shard too, so it outlives the thread
+    thread_local const shared_ptr<Shard> shard = [this] {
+        auto new_shard = make_shared<Shard>();
+        lock_guard lock(mutex_);
+        shards_.push_back(new_shard);
+        return new_shard;
+    }();
+    return *shard;
+}
+
+MetricsSnapshot MetricsRegistry::SumShards() const {
+    MetricsSnapshot snapshot;
+    for (const auto& shard : shards_) {
+        for (size_t stage = 0; stage < QUERY_STAGE_COUNT; ++stage) {
+            const StageShard& stage_shard = shard->stages[stage];
+            LatencyHistogram& histogram = snapshot.stages[stage];
+            histogram.count += stage_shard.count.load(memory_order_relaxed);
+            histogram.total_nanoseconds += stage_shard.total_nanoseconds.load(memory_order_relaxed);
+            for (size_t bucket = 0; bucket < LatencyHistogram::BUCKET_COUNT; ++bucket) {
+                histogram.buckets[bucket] += stage_shard.buckets[bucket].load(memory_order_relaxed);
+            }
+        }
+        for (size_t counter = 0; counter < INGESTION_COUNTER_COUNT; ++counter) {
+            snapshot.counters[counter] += shard->counters[counter].load(memory_order_relaxed);
+        }
+    }
+    return snapshot;
+}
@@ -0,0 +1,167 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string_view>
+#include <vector>
+
+// Stages of a query, each timed into its own histogram. The stages are
+// flat, not a breakdown of one another: none is timed inside another, so
+// no time is counted twice.
+enum class QueryStage {
+    // parsing the text into deduplicated plus and minus words and phrases
+    PARSE,
+    // looking the words up in the dictionary for postings and inverse
+    // document frequencies, and phrases up in the positions
+    RESOLVE,
+    // summing the scores of the plus words
+    POSTING_TRAVERSAL,
+    // dropping scored documents the predicate rejects
+    PREDICATE_FILTERING,
+    // excluding documents with minus words and removed documents
+    MINUS_WORD_EXCLUSION,
+    // collecting the best documents
+    TOP_K_SELECTION,
+};
+
+inline constexpr size_t QUERY_STAGE_COUNT = 6;
+
+enum class IngestionCounter {
+    DOCUMENTS_ADDED,
+    DOCUMENTS_REMOVED,
+    TERMS_ADDED,
+    TERMS_REMOVED,
+    POSTINGS_ADDED,
+    POSTINGS_REMOVED,
+};
+
+inline constexpr size_t INGESTION_COUNTER_COUNT = 6;
+
+std::string_view GetStageName(QueryStage stage);
+std::string_view GetCounterName(IngestionCounter counter);
+
+// Durations in nanoseconds over log-spaced buckets, four per power of two,
+// so a bucket is at most a quarter as wide as its lower bound.
+struct LatencyHistogram {
+    static constexpr size_t BUCKET_COUNT = 252;
+
+    uint64_t count = 0;
+    uint64_t total_nanoseconds = 0;
+    std::array<uint64_t, BUCKET_COUNT> buckets{};
+
+    static size_t GetBucket(uint64_t nanoseconds);
+    static uint64_t GetBucketLowerBound(size_t bucket);
+
+    // Upper end of the bucket holding the percentile, 0 if nothing was recorded.
+    uint64_t GetPercentile(double percent) const;
+};
+
+// Totals of all threads at the time of MetricsRegistry::GetSnapshot().
+struct MetricsSnapshot {
+    std::array<LatencyHistogram, QUERY_STAGE_COUNT> stages;
+    std::array<uint64_t, INGESTION_COUNTER_COUNT> counters{};
+
+    // One line per stage and counter.
+    void WriteText(std::ostream& out) const;
+    // A single object with "stages" and "counters", names as above in lower case.
+    void WriteJson(std::ostream& out) const;
+};
+
+// Process-wide stage histograms and ingestion counters.
+// Every thread writes to its own shard with plain relaxed stores, so a
+// sample takes a few nanoseconds plus the clock reads and never locks or
+// bounces cache lines between threads. Snapshots add up the shards while
+// they are being written, so a sample may show up in one histogram field a
+// moment before another. Shards outlive their threads, so nothing recorded
+// is lost.
+class MetricsRegistry {
+public:
+    static MetricsRegistry& Get();
+
+    // Disabled, StageTimer does not read the clock and nothing is recorded.
+    void SetEnabled(bool enabled) {
+        enabled_.store(enabled, std::memory_order_relaxed);
+    }
+
+    bool IsEnabled() const {
+        return enabled_.load(std::memory_order_relaxed);
+    }
+
+    void Record(QueryStage stage, uint64_t nanoseconds);
+
+    void Add(IngestionCounter counter, uint64_t value) {
+        if (IsEnabled() && value != 0) {
+            Increment(GetShard().counters[static_cast<size_t>(counter)], value);
+        }
+    }
+
+    MetricsSnapshot GetSnapshot() const;
+    // Later snapshots only count what is recorded from now on.
+    void Reset();
+
+private:
+    struct StageShard {
+        std::atomic<uint64_t> count{0};
+        std::atomic<uint64_t> total_nanoseconds{0};
+        std::array<std::atomic<uint64_t>, LatencyHistogram::BUCKET_COUNT> buckets{};
+    };
+    struct Shard {
+        std::array<StageShard, QUERY_STAGE_COUNT> stages;
+        std::array<std::atomic<uint64_t>, INGESTION_COUNTER_COUNT> counters{};
+    };
+
+    std::atomic<bool> enabled_{true};
+    mutable std::mutex mutex_;
+    std::vector<std::shared_ptr<Shard>> shards_;
+    // subtracted from the totals, shards are only ever written by their threads
+    MetricsSnapshot baseline_;
+
+    MetricsRegistry() = default;
+
+    Shard& GetShard();
+    MetricsSnapshot SumShards() const;
+
+    // Only the owning thread writes a shard, so no read-modify-write is needed.
+    static void Increment(std::atomic<uint64_t>& value, uint64_t delta) {
+        value.store(value.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+    }
+};
+
+// Times a query stage from construction to Stop() or destruction.
+class StageTimer {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit StageTimer(QueryStage stage)
+        : stage_(stage)
+        , is_running_(MetricsRegistry::Get().IsEnabled()) {
+        if (is_running_) {
+            start_time_ = Clock::now();
+        }
+    }
+
+    StageTimer(const StageTimer&) = delete;
+    StageTimer& operator=(const StageTimer&) = delete;
+
+    ~StageTimer() {
+        Stop();
+    }
+
+    void Stop() {
+        if (is_running_) {
+            is_running_ = false;
+            const auto duration = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start_time_);
+            MetricsRegistry::Get().Record(stage_, duration.count());
+        }
+    }
+
+private:
+    QueryStage stage_;
+    bool is_running_;
+    Clock::time_point start_time_;
+};
@@ -1,5 +1,8 @@
 #pragma once
-#include <deque>
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <ostream>
 
 template <typename Iterator>
 class IteratorRange {
@@ -7,7 +10,7 @@ public:
     IteratorRange(Iterator begin, Iterator end)
         : first_(begin)
         , last_(end)
-        , size_(distance(first_, last_)) {
+        , size_(std::distance(first_, last_)) {
     }
 
     Iterator begin() const {
@@ -35,37 +38,92 @@ std::ostream& operator<<(std::ostream& out, const IteratorRange<Iterator>& range
     return out;
 }
 
+// Splits a range into pages of page_size elements, the last one possibly
+// shorter. Pages are made as they are visited, so paginating costs nothing
+// up front and holds no page ranges, however long the range.
 template <typename Iterator>
 class Paginator {
 public:
-    Paginator(Iterator begin, Iterator end, size_t page_size) {
-        for (size_t left = distance(begin, end); left > 0;) {
-            const size_t current_page_size = std::min(page_size, left);
-            const Iterator current_page_end = next(begin, current_page_size);
-            pages_.push_back({begin, current_page_end});
-
-            left -= current_page_size;
-            begin = current_page_end;
+    class PageIterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = IteratorRange<Iterator>;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = IteratorRange<Iterator>;
+
+        PageIterator(Iterator begin, size_t left, size_t page_size)
+            : begin_(begin)
+            , left_(left)
+            , page_size_(page_size) {
+        }
+
+        IteratorRange<Iterator> operator*() const {
+            return {begin_, std::next(begin_, GetPageSize())};
+        }
+
+        PageIterator& operator++() {
+            const size_t current_page_size = GetPageSize();
+            begin_ = std::next(begin_, current_page_size);
+            left_ -= current_page_size;
+            return *this;
+        }
+
+        PageIterator operator++(int) {
+            PageIterator previous = *this;
+            ++*this;
+            return previous;
+        }
+
+        // elements left tell the pages apart, so iterators need not be comparable
+        bool operator==(const PageIterator& other) const {
+            return left_ == other.left_;
+        }
+
+        bool operator!=(const PageIterator& other) const {
+            return !(*this == other);
+        }
+
+    private:
+        Iterator begin_;
+        size_t left_;
+        size_t page_size_;
+
+        size_t GetPageSize() const {
+            return std::min(page_size_, left_);
         }
+    };
+
+    // A page size of 0 gives no pages.
+    Paginator(Iterator begin, Iterator end, size_t page_size)
+        : begin_(begin)
+        , end_(end)
+        , size_(page_size == 0 ? 0 : std::distance(begin, end))
+        , page_size_(page_size) {
     }
 
-    auto begin() const {
-        return pages_.begin();
+    PageIterator begin() const {
+        return {begin_, size_, page_size_};
     }
 
-    auto end() const {
-        return pages_.end();
+    PageIterator end() const {
+        return {end_, 0, page_size_};
     }
 
+    // number of pages
     size_t size() const {
-        return pages_.size();
+        return page_size_ == 0 ? 0 : (size_ + page_size_ - 1) / page_size_;
     }
 
 private:
-    std::vector<IteratorRange<Iterator>> pages_;
+    Iterator begin_;
+    Iterator end_;
+    // elements in the range
+    size_t size_;
+    size_t page_size_;
 };
 
 template <typename Container>
 auto Paginate(const Container& c, size_t page_size) {
-    return Paginator(begin(c), end(c), page_size);
+    return Paginator(std::begin(c), std::end(c), page_size);
 }
\ No newline at end of file
@@ -0,0 +1,130 @@
+#include "position_index.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+using namespace std;
+
+static void WriteVarint(uint32_t value, vector<uint8_t>& bytes) {
+    while (value >= 0x80) {
+        bytes.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    bytes.push_back(static_cast<uint8_t>(value));
+}
+
+static uint32_t ReadVarint(const uint8_t*& data) {
+    uint32_t value = 0;
+    for (int shift = 0;; shift += 7) {
+        const uint8_t byte = *data++;
+        value |= static_cast<uint32_t>(byte & 0x7f) << shift;
+        if (byte < 0x80) {
+            return value;
+        }
+    }
+}
+
+// ReadVarint for bytes from a file: false instead of reading past end or
+// shifting past 32 bits.
+static bool ReadVarint(const uint8_t*& data, const uint8_t* end, uint32_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 32 && data < end; shift += 7) {
+        const uint8_t byte = *data++;
+        value |= static_cast<uint32_t>(byte & 0x7f) << shift;
+        if (byte < 0x80) {
+            return true;
+        }
+    }
+    return false;
+}
+
+PositionIndex::PositionIndex(ArrayView<uint64_t> base_offsets, ArrayView<uint8_t> base_bytes)
+    : base_offsets_(base_offsets)
+    , base_bytes_(base_bytes) {
+    if (!base_offsets_.empty() && (base_offsets_[0] != 0 || base_offsets_.back() != base_bytes_.size() || !is_sorted(base_offsets_.begin(), base_offsets_.end()))) {
+        throw invalid_argument("Invalid positions"s);
+    }
+}
+
+void PositionIndex::Encode(vector<pair<uint32_t, uint32_t>>& rank_positions, vector<uint8_t>& bytes) {
+    sort(rank_positions.begin(), rank_positions.end());
+    bytes.clear();
+    vector<uint8_t> group;
+    for (size_t i = 0; i < rank_positions.size();) {
+        const uint32_t rank = rank_positions[i].first;
+        group.clear();
+        uint32_t previous = 0;
+        for (; i < rank_positions.size() && rank_positions[i].first == rank; ++i) {
+            WriteVarint(rank_positions[i].second - previous, group);
+            previous = rank_positions[i].second;
+        }
+        WriteVarint(static_cast<uint32_t>(group.size()), bytes);
+        bytes.insert(bytes.end(), group.begin(), group.end());
+    }
+}
+
+void PositionIndex::AddDocument(DocumentOrdinal document, const vector<uint8_t>& bytes) {
+    if (locations_.size() <= document) {
+        locations_.resize(document + 1);
+    }
+    if (bytes.empty()) {
+        locations_[document] = {};
+        return;
+    }
+    // a chunk a copy shares is not written again
+    if (chunks_.empty() || chunks_.back().use_count() > 1 || chunks_.back()->size() + bytes.size() > CHUNK_SIZE) {
+        chunks_.push_back(make_shared<vector<uint8_t>>());
+    }
+    vector<uint8_t>& chunk = *chunks_.back();
+    locations_[document] = {static_cast<uint32_t>(chunks_.size() - 1), static_cast<uint32_t>(chunk.size()), static_cast<uint32_t>(bytes.size())};
+    chunk.insert(chunk.end(), bytes.begin(), bytes.end());
+}
+
+void PositionIndex::GetPositions(DocumentOrdinal document, size_t rank, vector<uint32_t>& positions) const {
+    positions.clear();
+    if (!HasPositions(document)) {
+        return;
+    }
+    const uint8_t* data = GetBytes(document).data();
+    for (size_t i = 0; i < rank; ++i) {
+        const uint32_t size = ReadVarint(data);
+        data += size;
+    }
+    const uint32_t size = ReadVarint(data);
+    const uint8_t* const end = data + size;
+    uint32_t position = 0;
+    while (data < end) {
+        position += ReadVarint(data);
+        positions.push_back(position);
+    }
+}
+
+bool PositionIndex::IsValid(DocumentOrdinal document, size_t term_count) const {
+    const ArrayView<uint8_t> bytes = GetBytes(document);
+    if (bytes.empty()) {
+        return true;
+    }
+    const uint8_t* data = bytes.begin();
+    for (size_t group = 0; group < term_count; ++group) {
+        uint32_t size = 0;
+        if (!ReadVarint(data, bytes.end(), size) || size > static_cast<size_t>(bytes.end() - data)) {
+            return false;
+        }
+        const uint8_t* const end = data + size;
+        uint32_t gap = 0;
+        while (data < end) {
+            if (!ReadVarint(data, end, gap)) {
+                return false;
+            }
+        }
+    }
+    return data == bytes.end();
+}
+
+size_t PositionIndex::GetMemoryUsage() const {
+    size_t bytes = locations_.capacity() * sizeof(Location) + chunks_.capacity() * sizeof(chunks_[0]);
+    for (const auto& chunk : chunks_) {
+        bytes += chunk->capacity();
+    }
+    return bytes;
+}
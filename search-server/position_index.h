@@ -0,0 +1,120 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "array_view.h"
+#include "inverted_index.h"
+#include "snapshot.h"
+
+// Word positions of documents, for phrase queries.
+// The positions of a document are grouped by (term, document): one group per
+// term of its forward list, in the same order, each a byte length followed by
+// the gaps between positions as variable-length integers. Terms keep their
+// order in forward lists through Compact, so groups are found by the rank of
+// the term and not by its id.
+// Bytes are appended to chunks shared between copies; a copy costs 12 bytes
+// per document, and appending to a chunk that is shared starts a new one.
+// The positions of a loaded snapshot are read from its sections in place,
+// those of documents added later from the chunks.
+class PositionIndex {
+public:
+    PositionIndex() = default;
+    // Base positions from snapshot sections: bytes of document i at
+    // [offsets[i], offsets[i + 1]). Throws invalid_argument if the offsets
+    // do not fit the bytes, see IsValid for the bytes themselves.
+    PositionIndex(ArrayView<uint64_t> base_offsets, ArrayView<uint8_t> base_bytes);
+
+    // Encodes (rank of the term in the forward list, position) pairs, every
+    // rank from 0 up present, into bytes. Sorts the pairs.
+    static void Encode(std::vector<std::pair<uint32_t, uint32_t>>& rank_positions, std::vector<uint8_t>& bytes);
+
+    void AddDocument(DocumentOrdinal document, const std::vector<uint8_t>& bytes);
+    // Documents added while positions were off have none.
+    bool HasPositions(DocumentOrdinal document) const {
+        return !GetBytes(document).empty();
+    }
+    // Fills positions with those of the term of the given rank, ascending.
+    void GetPositions(DocumentOrdinal document, size_t rank, std::vector<uint32_t>& positions) const;
+    // Whether the bytes of a document decode to exactly term_count groups,
+    // so that GetPositions stays in bounds. For base positions, which come
+    // from a file.
+    bool IsValid(DocumentOrdinal document, size_t term_count) const;
+
+    // Drops the positions of the documents is_removed(document) holds for.
+    template <typename Predicate>
+    void Compact(Predicate is_removed);
+
+    // Writes the positions of documents below document_count as the
+    // POSITION_OFFSETS and POSITION_BYTES sections, none for those
+    // is_removed(document) holds for.
+    template <typename Predicate>
+    void Save(SnapshotWriter& writer, DocumentOrdinal document_count, Predicate is_removed) const;
+
+    // Heap memory, spare capacity included.
+    size_t GetMemoryUsage() const;
+
+private:
+    struct Location {
+        uint32_t chunk;
+        uint32_t offset;
+        uint32_t size;
+    };
+
+    static constexpr size_t CHUNK_SIZE = 1 << 20;
+
+    ArrayView<uint64_t> base_offsets_;
+    ArrayView<uint8_t> base_bytes_;
+    std::vector<std::shared_ptr<std::vector<uint8_t>>> chunks_;
+    // by ordinal, base documents included
+    std::vector<Location> locations_;
+
+    size_t GetBaseDocumentCount() const {
+        return base_offsets_.empty() ? 0 : base_offsets_.size() - 1;
+    }
+
+    ArrayView<uint8_t> GetBytes(DocumentOrdinal document) const {
+        if (document < GetBaseDocumentCount()) {
+            return base_bytes_.Slice(base_offsets_[document], base_offsets_[document + 1] - base_offsets_[document]);
+        }
+        if (document < locations_.size() && locations_[document].size != 0) {
+            const Location& location = locations_[document];
+            return {chunks_[location.chunk]->data() + location.offset, location.size};
+        }
+        return {};
+    }
+};
+
+template <typename Predicate>
+void PositionIndex::Compact(Predicate is_removed) {
+    PositionIndex compacted;
+    std::vector<uint8_t> bytes;
+    const size_t document_count = std::max(GetBaseDocumentCount(), locations_.size());
+    for (DocumentOrdinal document = 0; document < document_count; ++document) {
+        const ArrayView<uint8_t> document_bytes = GetBytes(document);
+        if (!document_bytes.empty() && !is_removed(document)) {
+            bytes.assign(document_bytes.begin(), document_bytes.end());
+            compacted.AddDocument(document, bytes);
+        }
+    }
+    compacted.locations_.resize(document_count);
+    *this = std::move(compacted);
+}
+
+template <typename Predicate>
+void PositionIndex::Save(SnapshotWriter& writer, DocumentOrdinal document_count, Predicate is_removed) const {
+    std::vector<uint64_t> offsets = {0};
+    std::vector<uint8_t> bytes;
+    for (DocumentOrdinal document = 0; document < document_count; ++document) {
+        if (!is_removed(document)) {
+            const ArrayView<uint8_t> document_bytes = GetBytes(document);
+            bytes.insert(bytes.end(), document_bytes.begin(), document_bytes.end());
+        }
+        offsets.push_back(bytes.size());
+    }
+    writer.Write(SnapshotSection::POSITION_OFFSETS, ArrayView<uint64_t>(offsets));
+    writer.Write(SnapshotSection::POSITION_BYTES, ArrayView<uint8_t>(bytes));
+}
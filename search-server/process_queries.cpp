@@ -3,29 +3,64 @@
 
 using namespace std;
 
+static QueryExecutor& GetSharedExecutor() {
+    static QueryExecutor executor;
+    return executor;
+}
+
+std::vector<std::vector<Document>> ProcessQueries(
+    const SearchServer& search_server,
+    const std::vector<std::string>& queries) {
+    return ProcessQueries(GetSharedExecutor(), search_server, queries);
+}
+
 std::vector<std::vector<Document>> ProcessQueries(
+    QueryExecutor& executor,
     const SearchServer& search_server,
     const std::vector<std::string>& queries) {
     std::vector<std::vector<Document>> d_vtr(queries.size());
-    std::transform(
-        std::execution::par,
-        std::make_move_iterator(queries.begin()), std::make_move_iterator(queries.end()),
-        std::make_move_iterator(d_vtr.begin()),
-        [&search_server](const string& query) {
-            return search_server.FindTopDocuments(query);
-        }
-    );
+    ProcessQueries(executor, search_server, queries, [&d_vtr](size_t index, std::vector<Document> documents) {
+        d_vtr[index] = std::move(documents);
+    });
     return d_vtr;
 }
 
-std::vector<Document> ProcessQueriesJoined(
+void ProcessQueries(
+    QueryExecutor& executor,
+    const SearchServer& search_server,
+    const std::vector<std::string>& queries,
+    const std::function<void(size_t, std::vector<Document>)>& callback) {
+    executor.Run(queries.size(), [&](size_t index) {
+        callback(index, search_server.FindTopDocuments(queries[index]));
+    });
+}
+
+JoinedDocuments ProcessQueriesJoined(
+    const SearchServer& search_server,
+    const std::vector<std::string>& queries) {
+    return ProcessQueriesJoined(GetSharedExecutor(), search_server, queries);
+}
+
+JoinedDocuments ProcessQueriesJoined(
+    QueryExecutor& executor,
     const SearchServer& search_server,
     const std::vector<std::string>& queries) {
-    vector<Document> result;
-    for (const auto& doc : ProcessQueries(search_server, queries)) {
-        result.insert(result.end(), doc.begin(),doc.end());
+    // every query fills a slot of its own, the slots are closed up afterwards
+    JoinedDocuments joined;
+    joined.documents_.resize(queries.size() * MAX_RESULT_DOCUMENT_COUNT);
+    joined.offsets_.assign(queries.size() + 1, 0);
+    ProcessQueries(executor, search_server, queries, [&joined](size_t index, std::vector<Document> documents) {
+        std::copy(documents.begin(), documents.end(), joined.documents_.begin() + index * MAX_RESULT_DOCUMENT_COUNT);
+        joined.offsets_[index + 1] = documents.size();
+    });
+
+    size_t size = 0;
+    for (size_t i = 0; i < queries.size(); ++i) {
+        const auto slot = joined.documents_.begin() + i * MAX_RESULT_DOCUMENT_COUNT;
+        std::copy(slot, slot + joined.offsets_[i + 1], joined.documents_.begin() + size);
+        size += joined.offsets_[i + 1];
+        joined.offsets_[i + 1] = size;
     }
-        
-        
-   return result;
-}
\ No newline at end of file
+    joined.documents_.resize(size);
+    return joined;
+}
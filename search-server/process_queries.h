@@ -4,17 +4,74 @@
 #include <list>
 #include<algorithm>
 #include<execution>
+#include<functional>
 #include<iostream>
 #include<list>
 #include<numeric>
 
 #include "document.h"
+#include "paginator.h"
+#include "query_executor.h"
 #include "search_server.h"
 
+// Results of a batch of queries, one query after another in a single buffer.
+class JoinedDocuments {
+public:
+    const Document* begin() const {
+        return documents_.data();
+    }
+
+    const Document* end() const {
+        return documents_.data() + documents_.size();
+    }
+
+    size_t size() const {
+        return documents_.size();
+    }
+
+    bool empty() const {
+        return documents_.empty();
+    }
+
+    // Results of the query with the given index in the batch.
+    IteratorRange<const Document*> GetQueryDocuments(size_t query) const {
+        return {begin() + offsets_[query], begin() + offsets_[query + 1]};
+    }
+
+private:
+    friend JoinedDocuments ProcessQueriesJoined(QueryExecutor&, const SearchServer&, const std::vector<std::string>&);
+
+    std::vector<Document> documents_;
+    // results of query i are [offsets_[i], offsets_[i + 1])
+    std::vector<size_t> offsets_;
+};
+
+// Runs on an executor shared by all callers, with a thread per core.
+std::vector<std::vector<Document>> ProcessQueries(
+    const SearchServer& search_server,
+    const std::vector<std::string>& queries);
+
 std::vector<std::vector<Document>> ProcessQueries(
+    QueryExecutor& executor,
+    const SearchServer& search_server,
+    const std::vector<std::string>& queries);
+
+// Streams the results: callback(index, documents) is called as soon as the
+// query with that index is done, by the worker that ran it, so calls for
+// different queries may overlap.
+void ProcessQueries(
+    QueryExecutor& executor,
+    const SearchServer& search_server,
+    const std::vector<std::string>& queries,
+    const std::function<void(size_t, std::vector<Document>)>& callback);
+
+// Every query writes its results straight into the joined buffer, no
+// per-query results are kept.
+JoinedDocuments ProcessQueriesJoined(
     const SearchServer& search_server,
     const std::vector<std::string>& queries);
 
-std::vector<Document> ProcessQueriesJoined(
+JoinedDocuments ProcessQueriesJoined(
+    QueryExecutor& executor,
     const SearchServer& search_server,
     const std::vector<std::string>& queries); 
\ No newline at end of file
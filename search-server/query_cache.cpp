@@ -0,0 +1,69 @@
+#include "query_cache.h"
+
+using namespace std;
+
+QueryCache::QueryCache(const QueryCache& other)
+    : capacity_(other.capacity_)
+{
+}
+
+void QueryCache::SetCapacity(size_t capacity) {
+    const lock_guard lock(mutex_);
+    capacity_ = capacity;
+    while (entries_.size() > capacity_) {
+        index_.erase(entries_.back().first);
+        entries_.pop_back();
+        ++stats_.evictions;
+    }
+}
+
+void QueryCache::MakeKey(const vector<string_view>& plus_words, const vector<string_view>& minus_words,
+                         DocumentStatus status, size_t top_count, string& key) {
+    // words never hold spaces, and plus words never start with a minus
+    key.clear();
+    for (const string_view word : plus_words) {
+        key.append(word).push_back(' ');
+    }
+    for (const string_view word : minus_words) {
+        key.append("-"s).append(word).push_back(' ');
+    }
+    key.append(to_string(static_cast<int>(status))).push_back(' ');
+    key.append(to_string(top_count));
+}
+
+optional<vector<Document>> QueryCache::Find(string_view key) {
+    const lock_guard lock(mutex_);
+    const auto it = index_.find(key);
+    if (it == index_.end()) {
+        ++stats_.misses;
+        return nullopt;
+    }
+    ++stats_.hits;
+    entries_.splice(entries_.begin(), entries_, it->second);
+    return it->second->second;
+}
+
+void QueryCache::Insert(string_view key, const vector<Document>& documents) {
+    const lock_guard lock(mutex_);
+    if (capacity_ == 0 || index_.count(key) != 0) {
+        return;
+    }
+    if (entries_.size() == capacity_) {
+        index_.erase(entries_.back().first);
+        entries_.pop_back();
+        ++stats_.evictions;
+    }
+    entries_.emplace_front(string(key), documents);
+    index_.emplace(entries_.front().first, entries_.begin());
+}
+
+void QueryCache::Clear() {
+    const lock_guard lock(mutex_);
+    index_.clear();
+    entries_.clear();
+}
+
+QueryCache::Stats QueryCache::GetStats() const {
+    const lock_guard lock(mutex_);
+    return stats_;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <list>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "document.h"
+
+// Size-bounded least recently used cache of query results, safe to use from
+// several threads at once.
+// Keys are built from parsed queries, so queries differing only in word
+// order, repeated words or stop words share an entry.
+class QueryCache {
+public:
+    struct Stats {
+        size_t hits = 0;
+        size_t misses = 0;
+        size_t evictions = 0;
+    };
+
+    QueryCache() = default;
+    // A copy starts out empty, with the capacity of the original.
+    QueryCache(const QueryCache& other);
+    QueryCache& operator=(const QueryCache&) = delete;
+
+    // A capacity of 0 turns the cache off.
+    void SetCapacity(size_t capacity);
+    bool IsEnabled() const {
+        return capacity_ != 0;
+    }
+
+    // Builds the key of a query from its sorted, deduplicated words.
+    static void MakeKey(const std::vector<std::string_view>& plus_words, const std::vector<std::string_view>& minus_words,
+                        DocumentStatus status, size_t top_count, std::string& key);
+
+    std::optional<std::vector<Document>> Find(std::string_view key);
+    void Insert(std::string_view key, const std::vector<Document>& documents);
+    void Clear();
+
+    Stats GetStats() const;
+
+private:
+    using Entry = std::pair<std::string, std::vector<Document>>;
+
+    mutable std::mutex mutex_;
+    size_t capacity_ = 0;
+    // most recently used first, indexed by views into the keys of the list
+    std::list<Entry> entries_;
+    std::unordered_map<std::string_view, std::list<Entry>::iterator> index_;
+    Stats stats_;
+};
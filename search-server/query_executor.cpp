@@ -0,0 +1,135 @@
+#include "query_executor.h"
+
+#include <stdexcept>
+
+using namespace std;
+
+QueryExecutor::QueryExecutor(size_t thread_count) {
+    if (thread_count == 0) {
+        throw invalid_argument("Executor needs at least one thread"s);
+    }
+    for (size_t i = 0; i < thread_count; ++i) {
+        queues_.push_back(make_unique<WorkerQueue>());
+    }
+    for (size_t i = 0; i < thread_count; ++i) {
+        workers_.emplace_back([this, i] {
+            Work(i);
+        });
+    }
+}
+
+QueryExecutor::~QueryExecutor() {
+    {
+        const lock_guard lock(mutex_);
+        stop_ = true;
+    }
+    wake_.notify_all();
+    for (thread& worker : workers_) {
+        worker.join();
+    }
+}
+
+void QueryExecutor::Run(size_t task_count, const function<void(size_t)>& task) {
+    if (task_count == 0) {
+        return;
+    }
+    Batch batch{&task, task_count, nullptr};
+    // neighbouring tasks start out on the same worker
+    const size_t worker_count = queues_.size();
+    for (size_t worker = 0; worker < worker_count; ++worker) {
+        WorkerQueue& queue = *queues_[worker];
+        const lock_guard lock(queue.mutex);
+        for (size_t index = task_count * worker / worker_count; index < task_count * (worker + 1) / worker_count; ++index) {
+            queue.tasks.push_back({&batch, index});
+        }
+    }
+
+    {
+        const lock_guard lock(mutex_);
+        ++generation_;
+    }
+    wake_.notify_all();
+
+    // help instead of waiting: a task calling Run from a worker would
+    // otherwise wait on tasks that worker holds. Only tasks of this batch,
+    // so that its latency does not depend on the batches of other callers.
+    Task next;
+    while (StealTask(0, worker_count, next, &batch)) {
+        RunTask(next);
+    }
+    // the rest of the batch is running on other threads
+    unique_lock lock(mutex_);
+    done_.wait(lock, [&batch] {
+        return batch.remaining == 0;
+    });
+    if (batch.error) {
+        rethrow_exception(batch.error);
+    }
+}
+
+void QueryExecutor::Work(size_t worker) {
+    uint64_t generation = 0;
+    while (true) {
+        {
+            unique_lock lock(mutex_);
+            wake_.wait(lock, [this, generation] {
+                return stop_ || generation_ != generation;
+            });
+            if (stop_) {
+                return;
+            }
+            generation = generation_;
+        }
+
+        Task task;
+        while (PopTask(worker, task)) {
+            RunTask(task);
+        }
+    }
+}
+
+void QueryExecutor::RunTask(const Task& task) {
+    exception_ptr error;
+    try {
+        (*task.batch->task)(task.index);
+    } catch (...) {
+        error = current_exception();
+    }
+    const lock_guard lock(mutex_);
+    if (error && !task.batch->error) {
+        task.batch->error = error;
+    }
+    if (--task.batch->remaining == 0) {
+        done_.notify_all();
+    }
+}
+
+bool QueryExecutor::PopTask(size_t worker, Task& task) {
+    {
+        WorkerQueue& queue = *queues_[worker];
+        const lock_guard lock(queue.mutex);
+        if (!queue.tasks.empty()) {
+            task = queue.tasks.front();
+            queue.tasks.pop_front();
+            return true;
+        }
+    }
+    return StealTask(worker + 1, queues_.size() - 1, task);
+}
+
+bool QueryExecutor::StealTask(size_t first_queue, size_t queue_count, Task& task, const Batch* batch) {
+    // steal the task furthest from the one its owner runs now
+    for (size_t i = 0; i < queue_count; ++i) {
+        WorkerQueue& queue = *queues_[(first_queue + i) % queues_.size()];
+        const lock_guard lock(queue.mutex);
+        const auto it = find_if(queue.tasks.rbegin(), queue.tasks.rend(), [batch](const Task& queued) {
+            return batch == nullptr || queued.batch == batch;
+        });
+        if (it != queue.tasks.rend()) {
+            task = *it;
+            queue.tasks.erase(next(it).base());
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed pool of worker threads running batches of independent tasks.
+// Every worker owns a queue and takes tasks from its front. A worker that
+// runs out steals from the back of the others, so a few expensive tasks
+// only hold up the workers running them, not the rest of the batch.
+// Workers live as long as the executor, so their thread-local scratch space
+// (parsed queries, scoring workspaces) is reused from batch to batch.
+class QueryExecutor {
+public:
+    explicit QueryExecutor(size_t thread_count = std::max(1u, std::thread::hardware_concurrency()));
+    QueryExecutor(const QueryExecutor&) = delete;
+    QueryExecutor& operator=(const QueryExecutor&) = delete;
+    ~QueryExecutor();
+
+    size_t GetThreadCount() const {
+        return workers_.size();
+    }
+
+    // Calls task(index) for every index below task_count on the workers, in
+    // no particular order, and returns once all calls are done. The calling
+    // thread takes tasks of its batch too until none are left, so batches
+    // submitted from several threads run side by side, and a task may call
+    // Run itself.
+    // The first exception thrown by a task is rethrown here, once the batch
+    // is over.
+    void Run(size_t task_count, const std::function<void(size_t)>& task);
+
+private:
+    struct Batch {
+        const std::function<void(size_t)>* task;
+        size_t remaining;
+        std::exception_ptr error;
+    };
+    struct Task {
+        Batch* batch;
+        size_t index;
+    };
+    struct WorkerQueue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    // guards generation_, stop_ and the progress of the running batches
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    uint64_t generation_ = 0;
+    bool stop_ = false;
+    std::vector<std::unique_ptr<WorkerQueue>> queues_;
+    std::vector<std::thread> workers_;
+
+    void Work(size_t worker);
+    void RunTask(const Task& task);
+    bool PopTask(size_t worker, Task& task);
+    // Takes a task of the given batch only, if there is one.
+    bool StealTask(size_t first_queue, size_t queue_count, Task& task, const Batch* batch = nullptr);
+};
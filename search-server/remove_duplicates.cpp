@@ -1,31 +1,195 @@
 #include <iostream>
 #include "remove_duplicates.h"
 
+#include <array>
+#include <cstdint>
+#include <execution>
+#include <unordered_map>
+
 using namespace std;
 
+using TermFreq = InvertedIndex::TermFreq;
+
+// splitmix64 finalizer
+static uint64_t MixBits(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111eb;
+    x ^= x >> 31;
+    return x;
+}
+
+struct Fingerprint {
+    uint64_t low = 0;
+    uint64_t high = 0;
+
+    bool operator==(const Fingerprint& other) const {
+        return low == other.low && high == other.high;
+    }
+
+    bool operator<(const Fingerprint& other) const {
+        return low < other.low || (low == other.low && high < other.high);
+    }
+};
+
+// two independent chains over the sorted term ids
+static Fingerprint ComputeFingerprint(ArrayView<TermFreq> terms) {
+    Fingerprint fingerprint{terms.size(), ~uint64_t{0}};
+    for (const TermFreq& term : terms) {
+        fingerprint.low = MixBits(fingerprint.low + term.term);
+        fingerprint.high = MixBits(fingerprint.high ^ (term.term * 0x9e3779b97f4a7c15 + 1));
+    }
+    return fingerprint;
+}
+
+static bool HaveSameTerms(ArrayView<TermFreq> lhs, ArrayView<TermFreq> rhs) {
+    return equal(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(), [](const TermFreq& lhs, const TermFreq& rhs) {
+        return lhs.term == rhs.term;
+    });
+}
+
+static double ComputeJaccardSimilarity(ArrayView<TermFreq> lhs, ArrayView<TermFreq> rhs) {
+    if (lhs.size() == 0 && rhs.size() == 0) {
+        return 1.0;
+    }
+    size_t common_count = 0;
+    for (auto left = lhs.begin(), right = rhs.begin(); left != lhs.end() && right != rhs.end();) {
+        if (left->term < right->term) {
+            ++left;
+        } else if (right->term < left->term) {
+            ++right;
+        } else {
+            ++common_count;
+            ++left;
+            ++right;
+        }
+    }
+    return static_cast<double>(common_count) / (lhs.size() + rhs.size() - common_count);
+}
+
+static void RemoveFound(SearchServer& search_server, vector<int>& found_duplicates) {
+    sort(found_duplicates.begin(), found_duplicates.end());
+    for (int id : found_duplicates) {
+        cout << "Found duplicate document id " << id << endl;
+    }
+    search_server.RemoveDocuments(found_duplicates);
+}
+
 void RemoveDuplicates(SearchServer& search_server) {
-    set<set<string>> docs;
+    struct FingerprintedDocument {
+        Fingerprint fingerprint;
+        int id;
+    };
+
+    const vector<int> document_ids(search_server.begin(), search_server.end());
+    vector<FingerprintedDocument> documents(document_ids.size());
+    transform(execution::par, document_ids.begin(), document_ids.end(), documents.begin(), [&search_server](int id) {
+        return FingerprintedDocument{ComputeFingerprint(search_server.GetDocumentTerms(id)), id};
+    });
+    sort(execution::par, documents.begin(), documents.end(), [](const FingerprintedDocument& lhs, const FingerprintedDocument& rhs) {
+        return lhs.fingerprint < rhs.fingerprint || (lhs.fingerprint == rhs.fingerprint && lhs.id < rhs.id);
+    });
+
+    // Within a run of equal fingerprints the smallest id of every distinct
+    // word set is kept. Different word sets only share a fingerprint by a
+    // collision, so a run hardly ever holds more than one of them.
     vector<int> found_duplicates;
+    vector<int> kept_ids;
+    for (size_t run = 0; run < documents.size();) {
+        size_t run_end = run + 1;
+        while (run_end < documents.size() && documents[run_end].fingerprint == documents[run].fingerprint) {
+            ++run_end;
+        }
+        kept_ids.clear();
+        for (size_t i = run; i < run_end; ++i) {
+            const auto terms = search_server.GetDocumentTerms(documents[i].id);
+            if (any_of(kept_ids.begin(), kept_ids.end(), [&](int kept_id) {
+                return HaveSameTerms(search_server.GetDocumentTerms(kept_id), terms);
+            })) {
+                found_duplicates.push_back(documents[i].id);
+            } else {
+                kept_ids.push_back(documents[i].id);
+            }
+        }
+        run = run_end;
+    }
 
-    for (int id : search_server) {
-        auto& freqs = search_server.GetWordFrequencies(id);
-        set<string> words_in_document;
+    RemoveFound(search_server, found_duplicates);
+}
 
-        transform(freqs.begin(), freqs.end(), inserter(words_in_document, words_in_document.begin()),
-            [](auto p) {
-                return p.first;
-            });
+void RemoveNearDuplicates(SearchServer& search_server, double similarity_threshold) {
+    static constexpr size_t SIGNATURE_SIZE = 128;
+    if (!(similarity_threshold > 0.0 && similarity_threshold <= 1.0)) {
+        throw invalid_argument("Similarity threshold must be in (0, 1]"s);
+    }
+
+    // Documents sharing all the rows of a band become candidates. More rows
+    // per band catch fewer pairs of low similarity; the likeliest pairs to
+    // be caught start around (1 / band_count) ^ (1 / row_count), so the
+    // largest row count keeping that at or below the threshold is used.
+    size_t row_count = 1;
+    while (row_count < SIGNATURE_SIZE
+           && pow(1.0 / (SIGNATURE_SIZE / (row_count * 2)), 1.0 / (row_count * 2)) <= similarity_threshold) {
+        row_count *= 2;
+    }
+    const size_t band_count = SIGNATURE_SIZE / row_count;
 
-        if (docs.count(words_in_document) > 0) {
-            cout << "Found duplicate document id " << id << endl;
-            found_duplicates.push_back(id);
+    array<uint64_t, SIGNATURE_SIZE> multipliers;
+    array<uint64_t, SIGNATURE_SIZE> offsets;
+    for (size_t i = 0; i < SIGNATURE_SIZE; ++i) {
+        multipliers[i] = MixBits(2 * i + 1) | 1;
+        offsets[i] = MixBits(2 * i + 2);
+    }
+
+    // only the band keys are kept, not the whole signatures
+    const vector<int> document_ids(search_server.begin(), search_server.end());
+    vector<uint64_t> band_keys(document_ids.size() * band_count);
+    for_each(execution::par, document_ids.begin(), document_ids.end(), [&](const int& id) {
+        array<uint32_t, SIGNATURE_SIZE> signature;
+        signature.fill(UINT32_MAX);
+        for (const TermFreq& term : search_server.GetDocumentTerms(id)) {
+            const uint64_t term_hash = MixBits(term.term);
+            for (size_t i = 0; i < SIGNATURE_SIZE; ++i) {
+                signature[i] = min(signature[i], static_cast<uint32_t>((term_hash * multipliers[i] + offsets[i]) >> 32));
+            }
         }
-        else {
-            docs.insert(words_in_document);
+        uint64_t* keys = &band_keys[(&id - document_ids.data()) * band_count];
+        for (size_t band = 0; band < band_count; ++band) {
+            uint64_t key = band;
+            for (size_t row = band * row_count; row < (band + 1) * row_count; ++row) {
+                key = MixBits(key ^ signature[row]);
+            }
+            keys[band] = key;
         }
-    }
+    });
 
-    for (int id : found_duplicates) {
-        search_server.RemoveDocument(id);
+    // documents are checked in id order against the kept ones sharing a band with them
+    vector<unordered_map<uint64_t, vector<int>>> buckets(band_count);
+    vector<int> found_duplicates;
+    vector<int> candidates;
+    for (size_t i = 0; i < document_ids.size(); ++i) {
+        const uint64_t* keys = &band_keys[i * band_count];
+        candidates.clear();
+        for (size_t band = 0; band < band_count; ++band) {
+            if (const auto it = buckets[band].find(keys[band]); it != buckets[band].end()) {
+                candidates.insert(candidates.end(), it->second.begin(), it->second.end());
+            }
+        }
+        sort(candidates.begin(), candidates.end());
+        candidates.erase(unique(candidates.begin(), candidates.end()), candidates.end());
+
+        const auto terms = search_server.GetDocumentTerms(document_ids[i]);
+        if (any_of(candidates.begin(), candidates.end(), [&](int kept_id) {
+            return ComputeJaccardSimilarity(search_server.GetDocumentTerms(kept_id), terms) >= similarity_threshold;
+        })) {
+            found_duplicates.push_back(document_ids[i]);
+            continue;
+        }
+        for (size_t band = 0; band < band_count; ++band) {
+            buckets[band][keys[band]].push_back(document_ids[i]);
+        }
     }
+
+    RemoveFound(search_server, found_duplicates);
 }
@@ -1,4 +1,14 @@
 #pragma once
 #include "search_server.h"
 
-void RemoveDuplicates(SearchServer& search_server);
\ No newline at end of file
+// Removes every document with the same set of words as a document with a
+// smaller id. Word sets are compared through 128-bit fingerprints of their
+// sorted term ids, and documents whose fingerprints collide are compared
+// exactly.
+void RemoveDuplicates(SearchServer& search_server);
+
+// Also removes documents whose word sets have a Jaccard similarity of at
+// least similarity_threshold, in (0, 1], with a kept document of a smaller id.
+// Candidates are found by MinHash signatures split into LSH bands, so a rare
+// near-duplicate may be missed, and every candidate is verified exactly.
+void RemoveNearDuplicates(SearchServer& search_server, double similarity_threshold);
\ No newline at end of file
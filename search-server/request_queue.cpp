@@ -1,3 +1,6 @@
+#include <cmath>
+#include <stdexcept>
+
 #include "document.h"
 #include "paginator.h"
 #include "read_input_functions.h"
@@ -7,12 +10,18 @@
 
 using namespace std;
 
-RequestQueue::RequestQueue(const SearchServer& search_server)
-    : search_server_(search_server) {
+RequestQueue::RequestQueue(const SearchServer& search_server, Clock::duration bucket_duration, size_t bucket_count)
+    : search_server_(search_server)
+    , start_time_(Clock::now())
+    , bucket_duration_(bucket_duration)
+    , buckets_(max<size_t>(bucket_count, 1)) {
+    if (bucket_duration <= Clock::duration::zero()) {
+        throw invalid_argument("Bucket duration must be positive"s);
+    }
 }
 
 vector<Document> RequestQueue::AddFindRequest(const string& raw_query, DocumentStatus status) {
-    return AddFindRequest(raw_query, [status](int document_id, DocumentStatus document_status, int rating) {
+    return AddFindRequest(raw_query, [status](int, DocumentStatus document_status, int) {
         return document_status == status;});
 }
 
@@ -20,12 +29,111 @@ vector<Document> RequestQueue::AddFindRequest(const string& raw_query) {
     return AddFindRequest(raw_query, DocumentStatus::ACTUAL);
 }
 
+void RequestQueue::RecordRequest(bool is_empty, Clock::duration latency, Clock::time_point time) {
+    const int64_t number = GetBucketNumber(time);
+    if (number > current_bucket_.load(memory_order_acquire) && mutex_.try_lock()) {
+        MoveRingTo(number);
+        mutex_.unlock();
+    }
+    const auto microseconds = chrono::duration_cast<chrono::microseconds>(latency).count();
+    size_t latency_bucket = 0;
+    while (latency_bucket + 1 < LATENCY_BUCKET_COUNT && (int64_t{1} << latency_bucket) < microseconds) {
+        ++latency_bucket;
+    }
+    latency_counts_[latency_bucket].fetch_add(1, memory_order_relaxed);
+    no_result_count_.fetch_add(is_empty ? 1 : 0, memory_order_relaxed);
+    // published last, see GetTotals
+    request_count_.fetch_add(1, memory_order_release);
+}
+
+RequestQueue::WindowStats RequestQueue::GetWindowStats(Clock::duration window, Clock::time_point time) const {
+    const int64_t number = GetBucketNumber(time);
+    const auto bucket_count = static_cast<int64_t>(buckets_.size());
+    const int64_t window_bucket_count = clamp<int64_t>((window + bucket_duration_ - Clock::duration(1)) / bucket_duration_, 1, bucket_count);
+    const int64_t first = number - window_bucket_count + 1;
+
+    lock_guard lock(mutex_);
+    MoveRingTo(number);
+    // totals as a bucket began, if the ring still holds it
+    const auto find_totals = [this, bucket_count](int64_t bucket) -> const WindowStats* {
+        const Bucket& slot = buckets_[bucket % bucket_count];
+        return slot.number == bucket ? &slot.totals : nullptr;
+    };
+    const int64_t current = current_bucket_.load(memory_order_relaxed);
+    // a window ending in the past ends where the bucket after it began
+    WindowStats stats;
+    if (number < current) {
+        const WindowStats* const end = find_totals(number + 1);
+        if (end == nullptr) {
+            return {};
+        }
+        stats = *end;
+    } else {
+        stats = GetTotals();
+    }
+    // a window reaching back before the first bucket counts everything
+    const int64_t kept_first = max(first, current - bucket_count + 1);
+    if (kept_first <= 0) {
+        return stats;
+    }
+    const WindowStats* const base = find_totals(kept_first);
+    if (base == nullptr) {
+        return {};
+    }
+    stats.request_count -= base->request_count;
+    stats.no_result_count -= base->no_result_count;
+    for (size_t i = 0; i < LATENCY_BUCKET_COUNT; ++i) {
+        stats.latency_counts[i] -= base->latency_counts[i];
+    }
+    return stats;
+}
+
 int RequestQueue::GetNoResultRequests() const {
-    int no_res_req = 0;
-    for (const auto& request : requests_) {
-        if (request.empty_request){
-            ++no_res_req;
+    return static_cast<int>(GetWindowStats(bucket_duration_ * buckets_.size()).no_result_count);
+}
+
+RequestQueue::Clock::duration RequestQueue::WindowStats::GetLatencyPercentile(double percent) const {
+    if (request_count == 0) {
+        return Clock::duration::zero();
+    }
+    const auto rank = max<uint64_t>(static_cast<uint64_t>(ceil(percent / 100 * request_count)), 1);
+    uint64_t seen = 0;
+    size_t bucket = 0;
+    for (; bucket + 1 < LATENCY_BUCKET_COUNT; ++bucket) {
+        seen += latency_counts[bucket];
+        if (seen >= rank) {
+            break;
         }
     }
-    return no_res_req;
-}
\ No newline at end of file
+    return chrono::microseconds(int64_t{1} << bucket);
+}
+
+int64_t RequestQueue::GetBucketNumber(Clock::time_point time) const {
+    return time <= start_time_ ? 0 : (time - start_time_) / bucket_duration_;
+}
+
+RequestQueue::WindowStats RequestQueue::GetTotals() const {
+    WindowStats totals;
+    // the request count is read first, so the other totals hold every request it counts
+    totals.request_count = request_count_.load(memory_order_acquire);
+    totals.no_result_count = no_result_count_.load(memory_order_relaxed);
+    for (size_t i = 0; i < LATENCY_BUCKET_COUNT; ++i) {
+        totals.latency_counts[i] = latency_counts_[i].load(memory_order_relaxed);
+    }
+    return totals;
+}
+
+void RequestQueue::MoveRingTo(int64_t number) const {
+    const int64_t current = current_bucket_.load(memory_order_relaxed);
+    if (number <= current) {
+        return;
+    }
+    // requests counted so far belong to the current bucket, so the buckets
+    // after it all start with the totals as they are now
+    const auto bucket_count = static_cast<int64_t>(buckets_.size());
+    const WindowStats totals = GetTotals();
+    for (int64_t next = max(current + 1, number - bucket_count + 1); next <= number; ++next) {
+        buckets_[next % bucket_count] = {next, totals};
+    }
+    current_bucket_.store(number, memory_order_release);
+}
@@ -1,67 +1,96 @@
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
 #include "document.h"
 #include "paginator.h"
 #include "read_input_functions.h"
-#include "request_queue.h"
 #include "search_server.h"
 #include "string_processing.h"
 
+// Request accounting shared by serving threads.
+// Time is split into buckets of bucket_duration, the last bucket_count of
+// them are kept in a ring. Requests only add to running atomic totals;
+// every bucket holds the totals as they were when it began, so statistics
+// over any window are the current totals minus those of the bucket the
+// window starts in, whatever the window length and request rate.
+// The thread that first records in a new bucket moves the ring on if no
+// other thread is doing so, without waiting, so a request made as a bucket
+// begins may be counted in the previous one.
 class RequestQueue {
 public:
-    explicit RequestQueue(const SearchServer& search_server);
-    
-    template<typename Query>
-    int SetTime(const Query& prev);
-    
- 
+    using Clock = std::chrono::steady_clock;
+
+    // latencies fall into buckets of powers of two of microseconds
+    static constexpr size_t LATENCY_BUCKET_COUNT = 32;
+
+    struct WindowStats {
+        uint64_t request_count = 0;
+        uint64_t no_result_count = 0;
+        // requests by latency bucket, bucket i up to 2^i microseconds
+        std::array<uint64_t, LATENCY_BUCKET_COUNT> latency_counts{};
+
+        // Upper end of the latency bucket holding the percentile, zero if there were no requests.
+        Clock::duration GetLatencyPercentile(double percent) const;
+    };
+
+    // The defaults keep a day in minutes.
+    explicit RequestQueue(const SearchServer& search_server, Clock::duration bucket_duration = std::chrono::minutes(1),
+                          size_t bucket_count = 1440);
+
+    // Safe to call from several threads at once.
     template <typename DocumentPredicate>
     std::vector<Document> AddFindRequest(const std::string& raw_query, DocumentPredicate document_predicate);
-    std::vector<Document> AddFindRequest(const std::string& raw_query, DocumentStatus status) ;
-    std::vector<Document> AddFindRequest(const std::string& raw_query) ;
+    std::vector<Document> AddFindRequest(const std::string& raw_query, DocumentStatus status);
+    std::vector<Document> AddFindRequest(const std::string& raw_query);
+
+    // Accounts for a request served elsewhere, made at the given time.
+    void RecordRequest(bool is_empty, Clock::duration latency, Clock::time_point time = Clock::now());
+
+    // Requests of the last window up to time, rounded up to whole buckets
+    // and cut to the ones the ring keeps; empty for a time older than the ring.
+    WindowStats GetWindowStats(Clock::duration window, Clock::time_point time = Clock::now()) const;
+
+    // Requests without results over the whole ring.
+    int GetNoResultRequests() const;
 
-    int GetNoResultRequests() const ;
 private:
-    struct QueryResult {
-        int time;
-        bool empty_request;
-        // определите, что должно быть в структуре
+    struct Bucket {
+        // tells a bucket from the older ones that shared its slot
+        int64_t number = 0;
+        WindowStats totals;
     };
-    std::deque<QueryResult> requests_;
-    const static int min_in_day_ = 1440;
-    // возможно, здесь вам понадобится что-то ещё
+
     const SearchServer& search_server_;
-};
+    const Clock::time_point start_time_;
+    const Clock::duration bucket_duration_;
+    std::atomic<uint64_t> request_count_{0};
+    std::atomic<uint64_t> no_result_count_{0};
+    std::array<std::atomic<uint64_t>, LATENCY_BUCKET_COUNT> latency_counts_{};
 
+    // guards buckets_, recorders only try to take it
+    mutable std::mutex mutex_;
+    // bucket number n is at n % size
+    mutable std::vector<Bucket> buckets_;
+    // number of the newest bucket in the ring
+    mutable std::atomic<int64_t> current_bucket_{0};
+
+    int64_t GetBucketNumber(Clock::time_point time) const;
+    WindowStats GetTotals() const;
+    // Starts buckets up to number with the current totals; mutex_ must be held.
+    void MoveRingTo(int64_t number) const;
+};
 
 template <typename DocumentPredicate>
 std::vector<Document> RequestQueue::AddFindRequest(const std::string& raw_query, DocumentPredicate document_predicate) {
-    QueryResult local;
-    std::vector<Document> find_local = search_server_.FindTopDocuments(raw_query, document_predicate);
-    
-    local.empty_request = find_local.empty();
-    
-    
-    if (requests_.size() != 0) {
-        
-        local.time = SetTime(requests_.back());
-        if (requests_.size() == min_in_day_){
-            requests_.pop_front();
-        }
-        requests_.push_back(local);
-    } else {
-        local.time = 1;
-        requests_.push_back(local);
-    }
-    return find_local;
+    const auto start_time = Clock::now();
+    std::vector<Document> documents = search_server_.FindTopDocuments(raw_query, document_predicate);
+    const auto end_time = Clock::now();
+    RecordRequest(documents.empty(), end_time - start_time, end_time);
+    return documents;
 }
-
-
-template<typename Query>
-int RequestQueue::SetTime(const Query& prev) {
-    if (prev.time < min_in_day_) {
-        return 1 + prev.time;
-    } else {
-        return 1;
-    }
-}
\ No newline at end of file
@@ -0,0 +1,27 @@
+#include "scoring_workspace.h"
+
+#include <algorithm>
+#include <limits>
+
+using namespace std;
+
+void ScoringWorkspace::Reset(DocumentOrdinal begin, DocumentOrdinal end) {
+    const size_t document_count = end - begin;
+    if (scores_.size() < document_count) {
+        scores_.resize(document_count);
+        stamps_.resize(document_count, 0);
+    }
+    begin_ = begin;
+    touched_.clear();
+    if (generation_ >= numeric_limits<uint32_t>::max() - 2) {
+        // stamps left from old queries could match the wrapped counter
+        fill(stamps_.begin(), stamps_.end(), 0);
+        generation_ = 0;
+    }
+    generation_ += 2;
+}
+
+ScoringWorkspace& ScoringWorkspace::ForCurrentThread() {
+    thread_local ScoringWorkspace workspace;
+    return workspace;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "inverted_index.h"
+
+// Scratch space for scoring one query at a time.
+// Scores live in a dense array indexed by document ordinal. Every entry is
+// stamped with the generation of the query that wrote it, so starting a new
+// query costs O(1) and only the touched documents are visited afterwards.
+// A workspace is not thread-safe: every thread owns its own.
+class ScoringWorkspace {
+public:
+    // Starts a new query over documents with ordinals below document_count.
+    void Reset(size_t document_count) {
+        Reset(0, static_cast<DocumentOrdinal>(document_count));
+    }
+
+    // Starts a new query over the documents with ordinals in [begin, end).
+    // Workspaces covering disjoint ranges can score one query side by side.
+    void Reset(DocumentOrdinal begin, DocumentOrdinal end);
+
+    void AddScore(DocumentOrdinal document, double score) {
+        const size_t slot = document - begin_;
+        if (stamps_[slot] != generation_) {
+            if (stamps_[slot] == generation_ + 1) {
+                return;
+            }
+            stamps_[slot] = generation_;
+            scores_[slot] = 0.0;
+            touched_.push_back(document);
+        }
+        scores_[slot] += score;
+    }
+
+    // Keeps the document out of the results whatever it scores.
+    void Exclude(DocumentOrdinal document) {
+        stamps_[document - begin_] = generation_ + 1;
+    }
+
+    bool IsExcluded(DocumentOrdinal document) const {
+        return stamps_[document - begin_] == generation_ + 1;
+    }
+
+    double GetScore(DocumentOrdinal document) const {
+        return scores_[document - begin_];
+    }
+
+    // Scored documents in the order they were first touched. Documents
+    // excluded after being scored are still listed, check IsExcluded.
+    const std::vector<DocumentOrdinal>& GetTouched() const {
+        return touched_;
+    }
+
+    // The workspace owned by the calling thread.
+    static ScoringWorkspace& ForCurrentThread();
+
+private:
+    std::vector<double> scores_;
+    // generation_ marks a scored entry, generation_ + 1 an excluded one
+    std::vector<uint32_t> stamps_;
+    std::vector<DocumentOrdinal> touched_;
+    DocumentOrdinal begin_ = 0;
+    uint32_t generation_ = 0;
+};
@@ -1,171 +1,395 @@
 #include "search_server.h"
 #include "log_duration.h"
 
+#include <charconv>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
+#include <numeric>
 
 using namespace std;
 
-SearchServer::SearchServer(const string& stop_words_text)
-    : SearchServer(SplitIntoWords(stop_words_text))
+SearchServer::SearchServer(const string& stop_words_text, ScoringMode scoring_mode)
+    : SearchServer(SplitIntoWords(stop_words_text), scoring_mode)
 {
 }
 
-SearchServer::SearchServer(const string_view stop_words_text)
-    : SearchServer(SplitIntoWords(stop_words_text))
+SearchServer::SearchServer(const string_view stop_words_text, ScoringMode scoring_mode)
+    : SearchServer(SplitIntoWords(stop_words_text), scoring_mode)
 {
 }
 
 void SearchServer::AddDocument(int document_id, const string_view document, DocumentStatus status, const vector<int>& ratings) {
-    if ((document_id < 0) || (documents_.count(document_id) > 0)) {
+    if (!IsValidDocumentId(document_id)) {
         throw invalid_argument(" Invalid document_id"s);
     }
     const auto words = SplitIntoWordsNoStop(document);
 
-    const double inv_word_count = 1.0 / words.size();
-    
-    for (const string& word : words) {
-        word_to_document_freqs_[word][document_id] += inv_word_count;
-        id_to_words_freqs_[document_id][word] += inv_word_count;
-        
+    const DocumentOrdinal ordinal = GetOrdinalCount();
+    index_.AddDocument(ordinal, words);
+    if (is_positions_enabled_) {
+        thread_local vector<pair<uint32_t, uint32_t>> rank_positions;
+        thread_local vector<uint8_t> bytes;
+        GetWordPositions(ordinal, document, rank_positions);
+        PositionIndex::Encode(rank_positions, bytes);
+        positions_.AddDocument(ordinal, bytes);
     }
-    documents_.emplace(document_id, DocumentData{ComputeAverageRating(ratings), status});
-    document_ids_.insert(document_id);
+    documents_.push_back({document_id, ComputeAverageRating(ratings), status});
+    document_ordinals_.emplace(document_id, ordinal);
+    query_cache_.Clear();
+    page_cache_.Clear();
 }
 
-vector<Document> SearchServer::FindTopDocuments(const string_view raw_query, DocumentStatus status) const {
-    return FindTopDocuments(raw_query, [status](int document_id, DocumentStatus document_status, int rating) {
-        return document_status == status;
-    });
+void SearchServer::AddDocuments(const vector<DocumentToAdd>& documents) {
+    AddDocuments(execution::seq, documents);
+}
+
+vector<Document> SearchServer::FindTopDocuments(const string_view raw_query, DocumentStatus status, size_t top_count) const {
+    return FindTopDocuments(execution::seq, raw_query, status, top_count);
 }
 
 vector<Document> SearchServer::FindTopDocuments(const string_view raw_query) const {
     return FindTopDocuments(raw_query, DocumentStatus::ACTUAL);
 }
 
-int SearchServer::GetDocumentCount() const {
-    return static_cast<int>(documents_.size());
+SearchPage SearchServer::FindPage(string_view raw_query, DocumentStatus status, size_t page_size, string_view cursor) const {
+    return FindPage(execution::seq, raw_query, status, page_size, cursor);
 }
 
-std::tuple<std::vector<std::string_view>, DocumentStatus>
-SearchServer::MatchDocument(
-              const std::execution::parallel_policy& policy,
-              const std::string_view raw_query,
-              int document_id) const {
-    assert(documents_.count(document_id) > 0);
+SearchPage SearchServer::FindPage(string_view raw_query, size_t page_size, string_view cursor) const {
+    return FindPage(raw_query, DocumentStatus::ACTUAL, page_size, cursor);
+}
 
-    const auto& word_freqs = id_to_words_freqs_.at(document_id);
-    static const auto query = ParseQuery( raw_query);
+string SearchServer::EncodeCursor(const Document& document) {
+    uint64_t relevance_bits;
+    memcpy(&relevance_bits, &document.relevance, sizeof(relevance_bits));
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "%016" PRIx64 ".%d.%d", relevance_bits, document.rating, document.id);
+    return buffer;
+}
 
-    if (std::any_of(policy, query.minus_words.begin(), query.minus_words.end(), [&word_freqs](const std::string word) {
-        return word_freqs.count(word) > 0;
-        
-    })) {
-        return { {}, documents_.at(document_id).status };
+optional<Document> SearchServer::DecodeCursor(string_view cursor) {
+    if (cursor.empty()) {
+        return nullopt;
     }
+    const char* const end = cursor.data() + cursor.size();
+    uint64_t relevance_bits = 0;
+    Document document;
+    from_chars_result result = from_chars(cursor.data(), end, relevance_bits, 16);
+    for (int* field : {&document.rating, &document.id}) {
+        if (result.ec != errc() || result.ptr == end || *result.ptr != '.') {
+            throw invalid_argument("Invalid page cursor"s);
+        }
+        result = from_chars(result.ptr + 1, end, *field);
+    }
+    if (result.ec != errc() || result.ptr != end) {
+        throw invalid_argument("Invalid page cursor"s);
+    }
+    memcpy(&document.relevance, &relevance_bits, sizeof(relevance_bits));
+    return document;
+}
+
+SearchPage SearchServer::MakePage(const vector<Document>& candidates, size_t page_size) {
+    SearchPage page;
+    page.documents.assign(candidates.begin(), candidates.begin() + min(page_size, candidates.size()));
+    if (page_size > 0 && candidates.size() > page_size) {
+        page.next_cursor = EncodeCursor(page.documents.back());
+    }
+    return page;
+}
 
+SearchServer::PreparedQuery SearchServer::PrepareQuery(string_view raw_query) const {
+    thread_local Query query;
+    ParseQuery(raw_query, query);
 
-    static std::vector<std::string_view> matched_words;
-    
-    matched_words.clear();
-    matched_words.reserve(query.plus_words.size());
-    std::copy_if( query.plus_words.begin(),
-                 query.plus_words.end(), back_inserter(matched_words),
-                 [&word_freqs](const std::string word) {
-                     return word_freqs.count(word) > 0 ;
-                 });
-   
-    std::sort( matched_words.begin(), matched_words.end());
-    matched_words.erase(std::unique( matched_words.begin(), matched_words.end()), matched_words.end());
+    // the words are copied into one string first, so views into it stay put
+    auto words = make_shared<PreparedQuery::Words>();
+    for (const auto* query_words : {&query.plus_words, &query.minus_words}) {
+        for (const string_view word : *query_words) {
+            words->text.append(word);
+        }
+    }
+    for (const PhraseWord& word : query.phrase_words) {
+        words->text.append(word.data);
+    }
+    size_t offset = 0;
+    const auto copy_words = [&words, &offset](const vector<string_view>& source, vector<string_view>& destination) {
+        destination.reserve(source.size());
+        for (const string_view word : source) {
+            destination.push_back(string_view(words->text).substr(offset, word.size()));
+            offset += word.size();
+        }
+    };
+    copy_words(query.plus_words, words->query.plus_words);
+    copy_words(query.minus_words, words->query.minus_words);
+    words->query.phrase_words.reserve(query.phrase_words.size());
+    for (const PhraseWord& word : query.phrase_words) {
+        words->query.phrase_words.push_back({string_view(words->text).substr(offset, word.data.size()), word.offset});
+        offset += word.data.size();
+    }
+    words->query.phrase_ends = query.phrase_ends;
+    return PreparedQuery(move(words));
+}
 
-    return { matched_words, documents_.at(document_id).status };
+vector<Document> SearchServer::FindTopDocuments(const PreparedQuery& query, DocumentStatus status, size_t top_count) const {
+    return FindTopDocuments(execution::seq, query, status, top_count);
 }
 
-std::tuple<vector<string_view>, DocumentStatus> SearchServer::MatchDocument(const std::execution::sequenced_policy& policy, const string_view raw_query, int document_id) const {
-    
-    if (documents_.count(document_id) == 0) {
-        throw std::out_of_range("id out of range");
+int SearchServer::GetDocumentCount() const {
+    return static_cast<int>(base_document_ordinals_.size() - removed_base_document_count_ + document_ordinals_.size());
+}
+
+tuple<vector<string_view>, DocumentStatus> SearchServer::MatchDocument(const execution::parallel_policy& policy, const string_view raw_query, int document_id) const {
+    return WithParsedQuery<execution::parallel_policy>(raw_query, [&](const Query& query) {
+        return MatchDocument(policy, query, document_id);
+    });
+}
+
+tuple<vector<string_view>, DocumentStatus> SearchServer::MatchDocument(const execution::sequenced_policy& policy, const string_view raw_query, int document_id) const {
+    thread_local Query query;
+    ParseQuery(raw_query, query);
+    return MatchDocument(policy, query, document_id);
+}
+
+tuple<vector<string_view>, DocumentStatus> SearchServer::MatchDocument(const string_view raw_query, int document_id) const {
+    return MatchDocument(execution::seq, raw_query, document_id);
+}
+
+tuple<vector<string_view>, DocumentStatus> SearchServer::MatchDocument(const execution::parallel_policy& policy, const PreparedQuery& query, int document_id) const {
+    return MatchDocument(policy, query.GetQuery(), document_id);
+}
+
+tuple<vector<string_view>, DocumentStatus> SearchServer::MatchDocument(const execution::sequenced_policy& policy, const PreparedQuery& query, int document_id) const {
+    return MatchDocument(policy, query.GetQuery(), document_id);
+}
+
+tuple<vector<string_view>, DocumentStatus> SearchServer::MatchDocument(const PreparedQuery& query, int document_id) const {
+    return MatchDocument(execution::seq, query.GetQuery(), document_id);
+}
+
+tuple<vector<string_view>, DocumentStatus> SearchServer::MatchDocument(const execution::parallel_policy& policy, const Query& query, int document_id) const {
+    const auto document_ordinal = FindDocumentOrdinal(document_id);
+    if (!document_ordinal) {
+        throw out_of_range("id out of range"s);
     }
-    
-    static const auto query = ParseQuery(raw_query);
+    const DocumentOrdinal ordinal = *document_ordinal;
 
-    static vector<string_view> matched_words;
-    matched_words.clear();
-    for (const string word : query.plus_words) {
-        if (word_to_document_freqs_.count(word) == 0) {
-            continue;
-        }
-        if (word_to_document_freqs_.at(word).count(document_id)) {
-            matched_words.push_back(word);
+    const auto find_in_document = [this, ordinal](const string_view word) -> optional<TermId> {
+        const auto term = index_.FindTerm(word);
+        return term && index_.FindDocumentTerm(ordinal, *term) != nullptr ? term : nullopt;
+    };
+
+    if (any_of(policy, query.minus_words.begin(), query.minus_words.end(), [&find_in_document](const string_view word) {
+        return find_in_document(word).has_value();
+    })) {
+        return {vector<string_view>{}, GetDocumentData(ordinal).status};
+    }
+
+    // plus words are sorted and unique already, so the matched ones are as well
+    vector<string_view> matched_words;
+    for (const string_view word : query.plus_words) {
+        if (const auto term = find_in_document(word)) {
+            matched_words.push_back(index_.GetTerm(*term));
         }
     }
-    for (const string word : query.minus_words) {
-        if (word_to_document_freqs_.count(word) == 0) {
-            continue;
+    return {move(matched_words), GetDocumentData(ordinal).status};
+}
+
+tuple<vector<string_view>, DocumentStatus> SearchServer::MatchDocument(const execution::sequenced_policy&, const Query& query, int document_id) const {
+    const auto document_ordinal = FindDocumentOrdinal(document_id);
+    if (!document_ordinal) {
+        throw out_of_range("id out of range"s);
+    }
+    const DocumentOrdinal ordinal = *document_ordinal;
+
+    const auto is_in_document = [this, ordinal](const string_view word) {
+        const auto term = index_.FindTerm(word);
+        return term && index_.FindDocumentTerm(ordinal, *term) != nullptr;
+    };
+
+    vector<string_view> matched_words;
+    for (const string_view word : query.minus_words) {
+        if (is_in_document(word)) {
+            return {move(matched_words), GetDocumentData(ordinal).status};
         }
-        if (word_to_document_freqs_.at(word).count(document_id)) {
-            matched_words.clear();
-            break;
+    }
+    for (const string_view word : query.plus_words) {
+        const auto term = index_.FindTerm(word);
+        if (term && index_.FindDocumentTerm(ordinal, *term) != nullptr) {
+            matched_words.push_back(index_.GetTerm(*term));
         }
     }
-    
-    return {matched_words, documents_.at(document_id).status};
-    
+    return {move(matched_words), GetDocumentData(ordinal).status};
 }
 
-tuple<vector<string_view>, DocumentStatus> SearchServer::MatchDocument(const string_view raw_query, int document_id) const {
-    if (documents_.count(document_id) == 0) {
-        throw std::out_of_range("id out of range");
+vector<tuple<vector<string_view>, DocumentStatus>> SearchServer::MatchDocuments(const execution::sequenced_policy& policy, string_view raw_query, const vector<int>& document_ids) const {
+    thread_local Query query;
+    ParseQuery(raw_query, query);
+    return MatchDocuments(policy, query, document_ids);
+}
+
+vector<tuple<vector<string_view>, DocumentStatus>> SearchServer::MatchDocuments(const execution::parallel_policy& policy, string_view raw_query, const vector<int>& document_ids) const {
+    return WithParsedQuery<execution::parallel_policy>(raw_query, [&](const Query& query) {
+        return MatchDocuments(policy, query, document_ids);
+    });
+}
+
+vector<tuple<vector<string_view>, DocumentStatus>> SearchServer::MatchDocuments(string_view raw_query, const vector<int>& document_ids) const {
+    return MatchDocuments(execution::seq, raw_query, document_ids);
+}
+
+vector<tuple<vector<string_view>, DocumentStatus>> SearchServer::MatchDocuments(const execution::sequenced_policy& policy, const PreparedQuery& query, const vector<int>& document_ids) const {
+    return MatchDocuments(policy, query.GetQuery(), document_ids);
+}
+
+vector<tuple<vector<string_view>, DocumentStatus>> SearchServer::MatchDocuments(const execution::parallel_policy& policy, const PreparedQuery& query, const vector<int>& document_ids) const {
+    return MatchDocuments(policy, query.GetQuery(), document_ids);
+}
+
+vector<tuple<vector<string_view>, DocumentStatus>> SearchServer::MatchDocuments(const PreparedQuery& query, const vector<int>& document_ids) const {
+    return MatchDocuments(execution::seq, query.GetQuery(), document_ids);
+}
+
+template <typename ExecutionPolicy>
+vector<tuple<vector<string_view>, DocumentStatus>> SearchServer::MatchDocuments(ExecutionPolicy&& policy, const Query& query, const vector<int>& document_ids) const {
+    struct MatchRequest {
+        DocumentOrdinal ordinal;
+        size_t index;
+    };
+    struct MatchTerm {
+        string_view word;
+        vector<InvertedIndex::Postings> postings;
+    };
+
+    vector<tuple<vector<string_view>, DocumentStatus>> results(document_ids.size());
+    vector<MatchRequest> requests;
+    requests.reserve(document_ids.size());
+    for (size_t i = 0; i < document_ids.size(); ++i) {
+        const auto ordinal = FindDocumentOrdinal(document_ids[i]);
+        if (!ordinal) {
+            throw out_of_range("id out of range"s);
+        }
+        requests.push_back({*ordinal, i});
+        get<1>(results[i]) = GetDocumentData(*ordinal).status;
     }
-    static const auto query = ParseQuery(raw_query);
-    
-    static vector<string_view> matched_words;
-    matched_words.clear();
-    
-    for (const string& word : query.plus_words) {
-        
-        if (word_to_document_freqs_.count(word) == 0) {
-            continue;
+    sort(requests.begin(), requests.end(), [](const MatchRequest& lhs, const MatchRequest& rhs) {
+        return lhs.ordinal < rhs.ordinal;
+    });
+
+    // plus words stay sorted, so the words matched in every document are as well
+    vector<MatchTerm> plus_terms;
+    InvertedIndex::PostingBuffers buffers;
+    for (const string_view word : query.plus_words) {
+        if (const auto term = index_.FindTerm(word)) {
+            MatchTerm& match_term = plus_terms.emplace_back(MatchTerm{index_.GetTerm(*term), {}});
+            index_.ForEachPostings(*term, buffers, [&match_term](const InvertedIndex::Postings& postings) {
+                match_term.postings.push_back(postings);
+            });
         }
-        if (word_to_document_freqs_.at(word).count(document_id)) {
-            
-            matched_words.push_back(word);
-            
+    }
+    vector<InvertedIndex::Postings> minus_postings;
+    for (const string_view word : query.minus_words) {
+        if (const auto term = index_.FindTerm(word)) {
+            index_.ForEachPostings(*term, buffers, [&minus_postings](const InvertedIndex::Postings& postings) {
+                minus_postings.push_back(postings);
+            });
         }
     }
-    for (const string& word : query.minus_words) {
-        if (word_to_document_freqs_.count(word) == 0) {
-            continue;
+
+    // Calls callback(request) for every request in [begin, end) whose document
+    // is in the postings. Few requests are looked up, many are merged with them.
+    const auto for_each_match = [&requests](const InvertedIndex::Postings& postings, size_t begin, size_t end, auto callback) {
+        auto document = lower_bound(postings.documents.begin(), postings.documents.end(), requests[begin].ordinal);
+        const auto last = upper_bound(document, postings.documents.end(), requests[end - 1].ordinal);
+        const bool is_sparse = (end - begin) * 16 < static_cast<size_t>(last - document);
+        for (size_t request = begin; request < end && document != last; ++request) {
+            if (is_sparse) {
+                document = lower_bound(document, last, requests[request].ordinal);
+            } else {
+                while (document != last && *document < requests[request].ordinal) {
+                    ++document;
+                }
+            }
+            if (document != last && *document == requests[request].ordinal) {
+                callback(request);
+            }
         }
-        if (word_to_document_freqs_.at(word).count(document_id)) {
-            matched_words.clear();
-            break;
+    };
+
+    // Every task matches its own range of requests, so tasks write to
+    // different results and never lock.
+    vector<char> is_excluded(requests.size(), false);
+    const size_t task_count = clamp<size_t>(requests.size() / MIN_DOCUMENTS_PER_TASK, 1, 4 * max(1u, thread::hardware_concurrency()));
+    vector<size_t> tasks(task_count);
+    iota(tasks.begin(), tasks.end(), 0);
+    for_each(policy, tasks.begin(), tasks.end(), [&](size_t task) {
+        const size_t begin = requests.size() * task / task_count;
+        const size_t end = requests.size() * (task + 1) / task_count;
+        if (begin == end) {
+            return;
         }
+        for (const InvertedIndex::Postings& postings : minus_postings) {
+            for_each_match(postings, begin, end, [&is_excluded](size_t request) {
+                is_excluded[request] = true;
+            });
+        }
+        for (const MatchTerm& term : plus_terms) {
+            for (const InvertedIndex::Postings& postings : term.postings) {
+                for_each_match(postings, begin, end, [&](size_t request) {
+                    if (!is_excluded[request]) {
+                        get<0>(results[requests[request].index]).push_back(term.word);
+                    }
+                });
+            }
+        }
+    });
+    return results;
+}
+
+bool SearchServer::IsValidDocumentId(int document_id) const {
+    return document_id >= 0 && !FindDocumentOrdinal(document_id);
+}
+
+optional<DocumentOrdinal> SearchServer::FindDocumentOrdinal(int document_id) const {
+    if (const auto it = document_ordinals_.find(document_id); it != document_ordinals_.end()) {
+        return it->second;
     }
-    
-    return {matched_words, documents_.at(document_id).status};
+    const auto it = lower_bound(base_document_ordinals_.begin(), base_document_ordinals_.end(), document_id,
+                                [](const DocumentIdOrdinal& lhs, int rhs) {
+        return lhs.id < rhs;
+    });
+    if (it != base_document_ordinals_.end() && it->id == document_id && !index_.IsRemoved(it->ordinal)) {
+        return it->ordinal;
+    }
+    return nullopt;
 }
 
-bool SearchServer::IsStopWord(const string& word) const {
-    return stop_words_.count(word) > 0;
+bool SearchServer::IsStopWord(string_view word) const {
+    return stop_words_.Contains(word);
 }
 
-bool SearchServer::IsValidWord(const string& word) {
+bool SearchServer::IsValidWord(string_view word) {
     return none_of(word.begin(), word.end(), [](char c) {
         return c >= '\0' && c < ' ';
     });
 }
 
-vector<string> SearchServer::SplitIntoWordsNoStop(const string_view text) const {
-    vector<string> words;
-    for (const auto word : SplitIntoWords(text)) {
-        if (!IsValidWord(word)) {
-            throw invalid_argument("Word "s + word + " is invalid"s);
+vector<string_view> SearchServer::SplitIntoWordsNoStop(const string_view text) const {
+    vector<string_view> words;
+    SplitIntoWordsNoStop(text, words);
+    return words;
+}
+
+void SearchServer::SplitIntoWordsNoStop(string_view text, vector<string_view>& result) const {
+    ForEachWord(text, [this, &result](string_view word, bool is_valid) {
+        if (!is_valid) {
+            throw invalid_argument("Word "s + string(word) + " is invalid"s);
         }
         if (!IsStopWord(word)) {
-            words.push_back(word);
+            result.push_back(word);
         }
-    }
-    return words;
+    });
 }
 
 int SearchServer::ComputeAverageRating(const vector<int>& ratings) {
@@ -177,36 +401,87 @@ int SearchServer::ComputeAverageRating(const vector<int>& ratings) {
     return rating_sum / static_cast<int>(ratings.size());
 }
 
-SearchServer::QueryWord SearchServer::ParseQueryWord(const string& text) const {
+SearchServer::QueryWord SearchServer::ParseQueryWord(string_view text, bool is_valid) const {
     if (text.empty()) {
         throw invalid_argument("Query word is empty"s);
     }
-    string word = text;
+    string_view word = text;
     bool is_minus = false;
-    if (*word.begin() == '-') {
+    if (word.front() == '-') {
         is_minus = true;
-        word = word.substr(1);
+        word.remove_prefix(1);
     }
-    if (word.empty() || *word.begin() == '-' || !IsValidWord(word)) {
-        throw invalid_argument("Query word "s + text + " is invalid");
+    if (word.empty() || word.front() == '-' || !is_valid) {
+        throw invalid_argument("Query word "s + string(text) + " is invalid");
     }
 
     return {word, is_minus, IsStopWord(word)};
 }
 
-SearchServer::Query SearchServer::ParseQuery(const string_view text) const {
-    
-    Query result;
-    
-    for (const string& word : SplitIntoWords(text)) {
-        const auto query_word = ParseQueryWord(word);
-        if (!query_word.is_stop) {
+void SearchServer::ParseQuery(string_view text, Query& result) const {
+    StageTimer timer(QueryStage::PARSE);
+    result.plus_words.clear();
+    result.minus_words.clear();
+    result.phrase_words.clear();
+    result.phrase_ends.clear();
+
+    // inside a phrase: where its words start and the place of the next one
+    bool in_phrase = false;
+    size_t phrase_first = 0;
+    uint32_t phrase_offset = 0;
+    ForEachWord(text, [&](string_view word, bool is_valid) {
+        if (!in_phrase && word.front() == '"') {
+            in_phrase = true;
+            phrase_first = result.phrase_words.size();
+            phrase_offset = 0;
+            word.remove_prefix(1);
+        }
+        if (!in_phrase) {
+            if (word.size() > 1 && word[0] == '-' && word[1] == '"') {
+                throw invalid_argument("Query phrases cannot be excluded"s);
+            }
+            const auto query_word = ParseQueryWord(word, is_valid);
+            if (!query_word.is_stop) {
+                if (query_word.is_minus) {
+                    result.minus_words.push_back(query_word.data);
+                } else {
+                    result.plus_words.push_back(query_word.data);
+                }
+            }
+            return;
+        }
+
+        const bool is_last = !word.empty() && word.back() == '"';
+        if (is_last) {
+            word.remove_suffix(1);
+        }
+        // a quote standing apart holds no word
+        if (!word.empty()) {
+            const auto query_word = ParseQueryWord(word, is_valid);
             if (query_word.is_minus) {
-                result.minus_words.push_back(query_word.data);
-            } else {
+                throw invalid_argument("Query phrase "s + string(word) + " holds a minus word"s);
+            }
+            if (!query_word.is_stop) {
+                result.phrase_words.push_back({query_word.data, phrase_offset});
                 result.plus_words.push_back(query_word.data);
             }
+            // places count from the first word that is not a stop word
+            if (result.phrase_words.size() > phrase_first) {
+                ++phrase_offset;
+            }
+        }
+        if (is_last) {
+            in_phrase = false;
+            // a single word needs no positions to be found
+            if (result.phrase_words.size() - phrase_first < 2) {
+                result.phrase_words.resize(phrase_first);
+            } else {
+                result.phrase_ends.push_back(result.phrase_words.size());
+            }
         }
+    });
+    if (in_phrase) {
+        throw invalid_argument("Query phrase is not closed"s);
     }
     
     std::sort( result.plus_words.begin(), result.plus_words.end());
@@ -214,89 +489,516 @@ SearchServer::Query SearchServer::ParseQuery(const string_view text) const {
     
     std::sort( result.minus_words.begin(), result.minus_words.end());
     result.minus_words.erase(std::unique( result.minus_words.begin(), result.minus_words.end()), result.minus_words.end());
-    return result;
 }
 
-double SearchServer::ComputeWordInverseDocumentFreq(const string& word) const {
-        return log(GetDocumentCount() * 1.0 / word_to_document_freqs_.at(word).size());
+void SearchServer::MakeQueryKey(const Query& query, DocumentStatus status, size_t top_count, string& key) {
+    QueryCache::MakeKey(query.plus_words, query.minus_words, status, top_count, key);
+    // phrase words are among the plus words already, phrases add their order and places
+    size_t first = 0;
+    for (const size_t end : query.phrase_ends) {
+        key.append(" \""s);
+        for (size_t i = first; i < end; ++i) {
+            key.append(to_string(query.phrase_words[i].offset)).push_back(':');
+            key.append(query.phrase_words[i].data).push_back(' ');
+        }
+        first = end;
     }
+}
 
-std::set<int>::const_iterator SearchServer::begin() const {
-    
-    return document_ids_.begin();
+void SearchServer::GetWordPositions(DocumentOrdinal document, string_view text, vector<pair<uint32_t, uint32_t>>& rank_positions) const {
+    rank_positions.clear();
+    const auto terms = index_.GetDocumentTerms(document);
+    uint32_t position = 0;
+    ForEachWord(text, [&](string_view word, bool) {
+        if (!IsStopWord(word)) {
+            const auto* term = index_.FindDocumentTerm(document, *index_.FindTerm(word));
+            rank_positions.push_back({static_cast<uint32_t>(term - terms.begin()), position});
+        }
+        ++position;
+    });
 }
 
-std::set<int>::const_iterator SearchServer::end() const {
-    return document_ids_.end();
+void SearchServer::ResolveQueryTerms(const Query& query, QueryTerms& result) const {
+    StageTimer timer(QueryStage::RESOLVE);
+    result.plus_terms.clear();
+    result.minus_postings.clear();
+    result.buffers.Clear();
+    const double log_document_count = log(GetDocumentCount());
+    for (const string_view word : query.plus_words) {
+        const auto term = index_.FindTerm(word);
+        if (!term || index_.GetDocumentFreq(*term) == 0) {
+            continue;
+        }
+        // a term has snapshot and in-memory postings, a document is in only one of them
+        const double inverse_document_freq = ComputeWordInverseDocumentFreq(*term, log_document_count);
+        index_.ForEachPostings(*term, result.buffers, [&result, inverse_document_freq](const InvertedIndex::Postings& postings) {
+            result.plus_terms.push_back({postings, inverse_document_freq});
+        });
+    }
+    for (const string_view word : query.minus_words) {
+        if (const auto term = index_.FindTerm(word)) {
+            index_.ForEachPostings(*term, result.buffers, [&result](const InvertedIndex::Postings& postings) {
+                result.minus_postings.push_back(postings);
+            });
+        }
+    }
+
+    // a document has to hold every phrase
+    result.has_phrases = !query.phrase_ends.empty();
+    result.phrase_documents.clear();
+    thread_local vector<DocumentOrdinal> phrase_documents;
+    thread_local vector<DocumentOrdinal> intersection;
+    size_t first = 0;
+    for (const size_t end : query.phrase_ends) {
+        FindPhraseDocuments(query, first, end, result.buffers, first == 0 ? result.phrase_documents : phrase_documents);
+        if (first != 0) {
+            intersection.clear();
+            set_intersection(result.phrase_documents.begin(), result.phrase_documents.end(), phrase_documents.begin(), phrase_documents.end(),
+                             back_inserter(intersection));
+            result.phrase_documents.swap(intersection);
+        }
+        first = end;
+    }
 }
 
-const map<string_view, double>& SearchServer::GetWordFrequencies(int document_id) const {
-    static map<string_view, double> empty_dictionary;
-    static map<string_view, double> dictionary;
-    if(documents_.count(document_id) != 0 ) {
-        for(auto& [word, freq] : id_to_words_freqs_.at(document_id)) {
-            dictionary[word] = freq;
+// First index from start on of a document not less than target. Steps double
+// until they pass it, so skipping n postings costs O(log n).
+static size_t GallopTo(ArrayView<DocumentOrdinal> documents, size_t start, DocumentOrdinal target) {
+    if (start >= documents.size() || documents[start] >= target) {
+        return start;
+    }
+    size_t low = start;
+    size_t step = 1;
+    while (low + step < documents.size() && documents[low + step] < target) {
+        low += step;
+        step *= 2;
+    }
+    const size_t high = min(low + step, documents.size());
+    return lower_bound(documents.begin() + low + 1, documents.begin() + high, target) - documents.begin();
+}
+
+void SearchServer::FindPhraseDocuments(const Query& query, size_t first, size_t last, InvertedIndex::PostingBuffers& buffers,
+                                       vector<DocumentOrdinal>& result) const {
+    result.clear();
+    const size_t word_count = last - first;
+    // postings of every word of the phrase, by word and then by segment
+    thread_local vector<TermId> terms;
+    thread_local vector<InvertedIndex::Postings> postings;
+    thread_local vector<size_t> postings_ends;
+    terms.clear();
+    postings.clear();
+    postings_ends.clear();
+    for (size_t i = first; i < last; ++i) {
+        const auto term = index_.FindTerm(query.phrase_words[i].data);
+        if (!term || index_.GetDocumentFreq(*term) == 0) {
+            return;
+        }
+        terms.push_back(*term);
+        index_.ForEachPostings(*term, buffers, [](const InvertedIndex::Postings& term_postings) {
+            postings.push_back(term_postings);
+        });
+        postings_ends.push_back(postings.size());
+    }
+
+    // A document is in one segment, so lists are intersected segment by
+    // segment. Candidates come from the shortest list and are galloped to in
+    // the others, so a phrase with a rare word costs little however common
+    // the rest are. Positions are only read for documents holding every word.
+    thread_local vector<const InvertedIndex::Postings*> lists;
+    thread_local vector<size_t> cursors;
+    for (size_t i = 0; i < postings_ends[0]; ++i) {
+        const size_t segment = postings[i].segment;
+        lists.clear();
+        for (size_t word = 0; word < word_count; ++word) {
+            const auto begin = postings.begin() + (word == 0 ? 0 : postings_ends[word - 1]);
+            const auto end = postings.begin() + postings_ends[word];
+            const auto it = find_if(begin, end, [segment](const InvertedIndex::Postings& word_postings) {
+                return word_postings.segment == segment;
+            });
+            if (it == end) {
+                break;
+            }
+            lists.push_back(&*it);
+        }
+        if (lists.size() < word_count) {
+            continue;
+        }
+        sort(lists.begin(), lists.end(), [](const InvertedIndex::Postings* lhs, const InvertedIndex::Postings* rhs) {
+            return lhs->size() < rhs->size();
+        });
+        cursors.assign(word_count, 0);
+        for (const DocumentOrdinal document : lists[0]->documents) {
+            bool is_in_all = true;
+            for (size_t list = 1; list < word_count && is_in_all; ++list) {
+                cursors[list] = GallopTo(lists[list]->documents, cursors[list], document);
+                is_in_all = cursors[list] < lists[list]->size() && lists[list]->documents[cursors[list]] == document;
+            }
+            if (is_in_all && HasPhrase(document, query.phrase_words.data() + first, terms.data(), word_count)) {
+                result.push_back(document);
+            }
+        }
+    }
+}
+
+bool SearchServer::HasPhrase(DocumentOrdinal document, const PhraseWord* words, const TermId* terms, size_t word_count) const {
+    if (!positions_.HasPositions(document)) {
+        return false;
+    }
+    const auto document_terms = index_.GetDocumentTerms(document);
+    thread_local vector<vector<uint32_t>> positions;
+    if (positions.size() < word_count) {
+        positions.resize(word_count);
+    }
+    size_t rarest = 0;
+    for (size_t i = 0; i < word_count; ++i) {
+        const auto* term = index_.FindDocumentTerm(document, terms[i]);
+        if (term == nullptr) {
+            return false;
+        }
+        positions_.GetPositions(document, term - document_terms.begin(), positions[i]);
+        if (positions[i].size() < positions[rarest].size()) {
+            rarest = i;
         }
-        return dictionary;
+    }
+    // Every place the rarest word allows the phrase to start at is checked.
+    // Starts only grow, so the other lists are walked forward once.
+    thread_local vector<size_t> cursors;
+    cursors.assign(word_count, 0);
+    for (const uint32_t position : positions[rarest]) {
+        if (position < words[rarest].offset) {
+            continue;
+        }
+        const uint32_t start = position - words[rarest].offset;
+        bool is_match = true;
+        for (size_t i = 0; i < word_count && is_match; ++i) {
+            const vector<uint32_t>& word_positions = positions[i];
+            size_t& cursor = cursors[i];
+            while (cursor < word_positions.size() && word_positions[cursor] < start + words[i].offset) {
+                ++cursor;
+            }
+            if (cursor == word_positions.size()) {
+                return false;
+            }
+            is_match = word_positions[cursor] == start + words[i].offset;
+        }
+        if (is_match) {
+            return true;
+        }
+    }
+    return false;
+}
+
+double SearchServer::ComputeWordInverseDocumentFreq(TermId term, double log_document_count) const {
+    return log_document_count - index_.GetLogDocumentFreq(term);
+}
+
+SearchServer::DocumentIdIterator SearchServer::begin() const {
+    return {*this, base_document_ordinals_.begin(), document_ordinals_.begin()};
+}
+
+SearchServer::DocumentIdIterator SearchServer::end() const {
+    return {*this, base_document_ordinals_.end(), document_ordinals_.end()};
+}
+
+SearchServer::DocumentIdIterator::DocumentIdIterator(const SearchServer& search_server, const DocumentIdOrdinal* base,
+                                                     map<int, DocumentOrdinal>::const_iterator added)
+    : search_server_(&search_server)
+    , base_(base)
+    , added_(added) {
+    SkipRemoved();
+}
+
+SearchServer::DocumentIdIterator& SearchServer::DocumentIdIterator::operator++() {
+    if (IsBaseFirst()) {
+        ++base_;
+        SkipRemoved();
     } else {
+        ++added_;
+    }
+    return *this;
+}
+
+SearchServer::DocumentIdIterator SearchServer::DocumentIdIterator::operator++(int) {
+    DocumentIdIterator result = *this;
+    ++*this;
+    return result;
+}
+
+bool SearchServer::DocumentIdIterator::IsBaseFirst() const {
+    return base_ != search_server_->base_document_ordinals_.end()
+        && (added_ == search_server_->document_ordinals_.end() || base_->id < added_->first);
+}
+
+void SearchServer::DocumentIdIterator::SkipRemoved() {
+    while (base_ != search_server_->base_document_ordinals_.end() && search_server_->index_.IsRemoved(base_->ordinal)) {
+        ++base_;
+    }
+}
+
+const map<string_view, double>& SearchServer::GetWordFrequencies(int document_id) const {
+    static const map<string_view, double> empty_dictionary;
+    // the index keeps compact per-document term lists, the map is only built on request
+    thread_local map<string_view, double> dictionary;
+    const auto ordinal = FindDocumentOrdinal(document_id);
+    if (!ordinal) {
         return empty_dictionary;
     }
+    dictionary.clear();
+    for (const auto [term, freq] : index_.GetDocumentTerms(*ordinal)) {
+        dictionary.emplace(index_.GetTerm(term), freq);
+    }
+    return dictionary;
+}
+
+ArrayView<InvertedIndex::TermFreq> SearchServer::GetDocumentTerms(int document_id) const {
+    const auto ordinal = FindDocumentOrdinal(document_id);
+    return ordinal ? index_.GetDocumentTerms(*ordinal) : ArrayView<InvertedIndex::TermFreq>();
 }
 
 void SearchServer::RemoveDocument(const std::execution::parallel_policy& policy, int document_id) {
-    if (documents_.count(document_id) == 0) {
+    const auto ordinal = FindDocumentOrdinal(document_id);
+    if (!ordinal) {
         return;
     }
-    
-    
-    std::map<std::string, double> words_freqs(std::move(id_to_words_freqs_.at(document_id))) ;
-    
-    documents_.erase(document_id);
+    index_.RemoveDocument(policy, *ordinal);
+    if (*ordinal < base_documents_.size()) {
+        ++removed_base_document_count_;
+    } else {
+        document_ordinals_.erase(document_id);
+    }
+    query_cache_.Clear();
+    page_cache_.Clear();
+}
 
-    document_ids_.erase(find(policy, document_ids_.begin(), document_ids_.end(), document_id));
-    
-    std::vector<const std::basic_string<char>*> words(words_freqs.size());
-   
-    std::transform(
-        policy,
-        std::make_move_iterator(words_freqs.begin()),
-        std::make_move_iterator(words_freqs.end()),
-        std::make_move_iterator(words.begin()),
-        []( auto& a) {
-             
-            return const_cast<std::basic_string<char>*>(&(a.first));
-        }
-    );
-   
-    
-    std::for_each(policy, words.begin(), words.end(), [this, document_id](auto a) {
-        word_to_document_freqs_[*a].erase(document_id);
-       
+void SearchServer::RemoveDocument(const std::execution::sequenced_policy& policy, int document_id) {
+    const auto ordinal = FindDocumentOrdinal(document_id);
+    if (!ordinal) {
+        return;
+    }
+    index_.RemoveDocument(policy, *ordinal);
+    if (*ordinal < base_documents_.size()) {
+        ++removed_base_document_count_;
+    } else {
+        document_ordinals_.erase(document_id);
+    }
+    query_cache_.Clear();
+    page_cache_.Clear();
+}
+
+void SearchServer::RemoveDocument(int document_id) {
+    const std::execution::sequenced_policy policy;
+    RemoveDocument(policy, document_id);
+}
+
+void SearchServer::RemoveDocuments(const std::execution::parallel_policy& policy, const vector<int>& document_ids) {
+    index_.RemoveDocuments(policy, ForgetDocuments(document_ids));
+    query_cache_.Clear();
+    page_cache_.Clear();
+}
+
+void SearchServer::RemoveDocuments(const std::execution::sequenced_policy& policy, const vector<int>& document_ids) {
+    index_.RemoveDocuments(policy, ForgetDocuments(document_ids));
+    query_cache_.Clear();
+    page_cache_.Clear();
+}
+
+void SearchServer::RemoveDocuments(const vector<int>& document_ids) {
+    const std::execution::sequenced_policy policy;
+    RemoveDocuments(policy, document_ids);
+}
+
+vector<DocumentOrdinal> SearchServer::ForgetDocuments(const vector<int>& document_ids) {
+    // base documents only count as removed once the index marks them, so repeated ids are dropped first
+    vector<int> ids = document_ids;
+    sort(ids.begin(), ids.end());
+    ids.erase(unique(ids.begin(), ids.end()), ids.end());
+    vector<DocumentOrdinal> ordinals;
+    ordinals.reserve(ids.size());
+    for (const int document_id : ids) {
+        const auto ordinal = FindDocumentOrdinal(document_id);
+        if (!ordinal) {
+            continue;
+        }
+        if (*ordinal < base_documents_.size()) {
+            ++removed_base_document_count_;
+        } else {
+            document_ordinals_.erase(document_id);
+        }
+        ordinals.push_back(*ordinal);
+    }
+    sort(ordinals.begin(), ordinals.end());
+    return ordinals;
+}
+
+void SearchServer::Compact() {
+    index_.Compact();
+    positions_.Compact([this](DocumentOrdinal document) {
+        return index_.IsRemoved(document);
     });
-    
-    
-    id_to_words_freqs_.erase(document_id);
+}
 
+size_t SearchServer::GetIndexMemoryUsage() const {
+    return index_.GetMemoryUsage() + documents_.capacity() * sizeof(DocumentData) + positions_.GetMemoryUsage();
 }
 
-void SearchServer::RemoveDocument(const std::execution::sequenced_policy& policy, int document_id) {
-    if (documents_.count(document_id) == 0) {
-        return;
+void SearchServer::SetPositionsEnabled(bool enabled) {
+    is_positions_enabled_ = enabled;
+}
+
+size_t SearchServer::GetPositionMemoryUsage() const {
+    return positions_.GetMemoryUsage();
+}
+
+double SearchServer::GetRelevanceErrorBound(string_view raw_query) const {
+    thread_local Query query;
+    ParseQuery(raw_query, query);
+    const double log_document_count = log(GetDocumentCount());
+    InvertedIndex::PostingBuffers buffers;
+    double bound = 0.0;
+    for (const string_view word : query.plus_words) {
+        const auto term = index_.FindTerm(word);
+        if (!term || index_.GetDocumentFreq(*term) == 0) {
+            continue;
+        }
+        // a document is in a single segment, so only the largest step of the word counts
+        double max_step = 0.0;
+        index_.ForEachPostings(*term, buffers, [&max_step](const InvertedIndex::Postings& postings) {
+            max_step = max(max_step, postings.impact_step);
+        });
+        bound += max_step / 2 * ComputeWordInverseDocumentFreq(*term, log_document_count);
     }
-    
-    documents_.erase(document_id);
+    return bound;
+}
+
+void SearchServer::SetQueryCacheCapacity(size_t capacity) {
+    query_cache_.SetCapacity(capacity);
+}
+
+QueryCache::Stats SearchServer::GetQueryCacheStats() const {
+    return query_cache_.GetStats();
+}
+
+void SearchServer::SetPageCacheCapacity(size_t capacity) {
+    page_cache_.SetCapacity(capacity);
+}
+
+QueryCache::Stats SearchServer::GetPageCacheStats() const {
+    return page_cache_.GetStats();
+}
 
-    document_ids_.erase(find(document_ids_.begin(), document_ids_.end(), document_id));
+void SearchServer::SaveSnapshot(const string& path) const {
+    SnapshotWriter writer(path);
 
-    for(auto& [word, _] : id_to_words_freqs_[document_id] ) {
-        word_to_document_freqs_[word].erase(document_id);
+    vector<uint64_t> stop_word_offsets = {0};
+    vector<char> stop_word_bytes;
+    for (const string_view word : stop_words_) {
+        stop_word_bytes.insert(stop_word_bytes.end(), word.begin(), word.end());
+        stop_word_offsets.push_back(stop_word_bytes.size());
     }
+    writer.Write(SnapshotSection::STOP_WORD_OFFSETS, ArrayView<uint64_t>(stop_word_offsets));
+    writer.Write(SnapshotSection::STOP_WORD_BYTES, ArrayView<char>(stop_word_bytes));
+
+    index_.Save(writer);
+
+    // removed documents keep their ordinals, only their ids are dropped
+    vector<DocumentData> documents(base_documents_.begin(), base_documents_.end());
+    documents.insert(documents.end(), documents_.begin(), documents_.end());
+    writer.Write(SnapshotSection::DOCUMENTS, ArrayView<DocumentData>(documents));
+    vector<DocumentIdOrdinal> document_ordinals;
+    for (const int document_id : *this) {
+        document_ordinals.push_back({document_id, *FindDocumentOrdinal(document_id)});
+    }
+    writer.Write(SnapshotSection::DOCUMENT_IDS, ArrayView<DocumentIdOrdinal>(document_ordinals));
+    positions_.Save(writer, static_cast<DocumentOrdinal>(documents.size()), [this](DocumentOrdinal document) {
+        return index_.IsRemoved(document);
+    });
 
-    id_to_words_freqs_.erase(document_id);
+    writer.Finish();
+}
 
+unique_ptr<const SearchServer> SearchServer::CreateVersion() {
+    FoldDocuments();
+    index_.Freeze();
+    auto version = make_unique<SearchServer>(*this);
+    version->SetQueryCacheCapacity(0);
+    version->SetPageCacheCapacity(0);
+    return version;
 }
 
-void SearchServer::RemoveDocument(int document_id) {
-    const std::execution::sequenced_policy policy;
-    RemoveDocument(policy, document_id);
+void SearchServer::FoldDocuments() {
+    if (documents_.empty() && removed_base_document_count_ == 0) {
+        return;
+    }
+    auto documents = make_shared<vector<DocumentData>>(base_documents_.begin(), base_documents_.end());
+    documents->insert(documents->end(), documents_.begin(), documents_.end());
+
+    // both lists are sorted by id, removed base documents are dropped on the way
+    auto document_ordinals = make_shared<vector<DocumentIdOrdinal>>();
+    document_ordinals->reserve(GetDocumentCount());
+    auto base = base_document_ordinals_.begin();
+    auto added = document_ordinals_.begin();
+    while (base != base_document_ordinals_.end() || added != document_ordinals_.end()) {
+        if (added == document_ordinals_.end() || (base != base_document_ordinals_.end() && base->id < added->first)) {
+            if (!index_.IsRemoved(base->ordinal)) {
+                document_ordinals->push_back(*base);
+            }
+            ++base;
+        } else {
+            document_ordinals->push_back({added->first, added->second});
+            ++added;
+        }
+    }
+
+    base_documents_ = *documents;
+    base_document_ordinals_ = *document_ordinals;
+    folded_documents_ = move(documents);
+    folded_document_ordinals_ = move(document_ordinals);
+    documents_.clear();
+    document_ordinals_.clear();
+    removed_base_document_count_ = 0;
+}
+
+SearchServer SearchServer::LoadSnapshot(const string& path, ScoringMode scoring_mode) {
+    return SearchServer(make_shared<const Snapshot>(path), scoring_mode);
+}
+
+static vector<string_view> ReadStopWords(const Snapshot& snapshot) {
+    const auto offsets = snapshot.Get<uint64_t>(SnapshotSection::STOP_WORD_OFFSETS);
+    const auto bytes = snapshot.Get<char>(SnapshotSection::STOP_WORD_BYTES);
+    vector<string_view> words;
+    for (size_t i = 0; i + 1 < offsets.size(); ++i) {
+        if (offsets[i] > offsets[i + 1] || offsets[i + 1] > bytes.size()) {
+            throw invalid_argument("Invalid snapshot stop words"s);
+        }
+        words.push_back({bytes.data() + offsets[i], offsets[i + 1] - offsets[i]});
+    }
+    return words;
+}
+
+SearchServer::SearchServer(shared_ptr<const Snapshot> snapshot, ScoringMode scoring_mode)
+    : snapshot_(move(snapshot))
+    , stop_words_(ReadStopWords(*snapshot_))
+    , index_(*snapshot_, scoring_mode)
+    , base_documents_(snapshot_->Get<DocumentData>(SnapshotSection::DOCUMENTS))
+    , base_document_ordinals_(snapshot_->Get<DocumentIdOrdinal>(SnapshotSection::DOCUMENT_IDS))
+    , positions_(snapshot_->Get<uint64_t>(SnapshotSection::POSITION_OFFSETS), snapshot_->Get<uint8_t>(SnapshotSection::POSITION_BYTES))
+{
+    if (base_documents_.size() + 1 != snapshot_->Get<uint64_t>(SnapshotSection::DOCUMENT_TERM_OFFSETS).size()) {
+        throw invalid_argument("Invalid snapshot documents"s);
+    }
+    // ids are searched by bisection and ordinals index the documents
+    for (size_t i = 0; i < base_document_ordinals_.size(); ++i) {
+        if ((i > 0 && base_document_ordinals_[i - 1].id >= base_document_ordinals_[i].id)
+            || base_document_ordinals_[i].ordinal >= base_documents_.size()) {
+            throw invalid_argument("Invalid snapshot document ids"s);
+        }
+    }
+    if (snapshot_->Get<uint64_t>(SnapshotSection::POSITION_OFFSETS).size() != base_documents_.size() + 1) {
+        throw invalid_argument("Invalid snapshot positions"s);
+    }
+    for (DocumentOrdinal document = 0; document < base_documents_.size(); ++document) {
+        if (!positions_.IsValid(document, index_.GetDocumentTerms(document).size())) {
+            throw invalid_argument("Invalid snapshot positions"s);
+        }
+    }
 }
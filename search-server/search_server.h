@@ -12,205 +12,780 @@
 #include <deque>
 #include <execution>
 #include <string_view>
+#include <thread>
 #include <list>
 #include <iterator>
+#include <limits>
+#include <type_traits>
 #include <cassert>
+#include <memory>
+#include <optional>
 #include <string_view>
 
+#include "array_view.h"
 #include "document.h"
 #include "string_processing.h"
-#include "concurrent_map.h"
+#include "inverted_index.h"
 #include "log_duration.h"
+#include "metrics.h"
+#include "position_index.h"
+#include "query_cache.h"
+#include "scoring_workspace.h"
+#include "snapshot.h"
+#include "term_dictionary.h"
+#include "top_documents.h"
 
 const int MAX_RESULT_DOCUMENT_COUNT = 5;
-constexpr double EPSILON = 1e-6;
+
+// Execution mode of FindTopDocuments, passed in place of a std::execution policy.
+// Scores documents one at a time and skips those whose Block-Max WAND upper
+// bound cannot reach the current top. Queries pruning cannot speed up are
+// scored like std::execution::seq does, so it is never much slower.
+struct BlockMaxWandPolicy {};
+inline constexpr BlockMaxWandPolicy block_max_wand;
+
+// Up to a page of results, best first, and the cursor that continues after
+// them, empty after the last page. The cursor is opaque to clients.
+struct SearchPage {
+    std::vector<Document> documents;
+    std::string next_cursor;
+};
+
+// One document of an AddDocuments batch. The text is only read during the call.
+struct DocumentToAdd {
+    int id;
+    std::string_view text;
+    DocumentStatus status;
+    std::vector<int> ratings;
+};
 
 class SearchServer {
 public:
+    class DocumentIdIterator;
+    class PreparedQuery;
+
+    // Impact and compressed scoring modes trade exact relevance or query time
+    // for smaller postings, see ScoringMode and GetRelevanceErrorBound.
     template <typename StringContainer>
-    explicit SearchServer(const StringContainer& stop_words);
+    explicit SearchServer(const StringContainer& stop_words, ScoringMode scoring_mode = ScoringMode::EXACT);
 
-    explicit SearchServer(const std::string& stop_words_text);
+    explicit SearchServer(const std::string& stop_words_text, ScoringMode scoring_mode = ScoringMode::EXACT);
     
-    explicit SearchServer(const std::string_view stop_words_text);
+    explicit SearchServer(const std::string_view stop_words_text, ScoringMode scoring_mode = ScoringMode::EXACT);
+
+    // Copies share the index segments and the document data of the last
+    // CreateVersion with the original.
+    SearchServer(const SearchServer& other) = default;
+    SearchServer& operator=(const SearchServer&) = delete;
 
     void AddDocument(int document_id, const std::string_view document, DocumentStatus status, const std::vector<int>& ratings);
 
+    // Adds the whole batch or, if any id or word is invalid, nothing.
+    template <typename ExecutionPolicy>
+    void AddDocuments(ExecutionPolicy&& policy, const std::vector<DocumentToAdd>& documents);
+    void AddDocuments(const std::vector<DocumentToAdd>& documents);
+
+    // A "quoted phrase" matches documents holding its words in order, stop
+    // words between them matching any word, and only documents added with
+    // positions, see SetPositionsEnabled. An unclosed phrase or a minus word
+    // in a phrase throws invalid_argument.
     template <typename DocumentPredicate>
-    std::vector<Document> FindTopDocuments(const std::string_view raw_query, DocumentPredicate document_predicate) const;
-    std::vector<Document> FindTopDocuments(const std::string_view raw_query, DocumentStatus status) const;
+    std::vector<Document> FindTopDocuments(const std::string_view raw_query, DocumentPredicate document_predicate, size_t top_count = MAX_RESULT_DOCUMENT_COUNT) const;
+    std::vector<Document> FindTopDocuments(const std::string_view raw_query, DocumentStatus status, size_t top_count = MAX_RESULT_DOCUMENT_COUNT) const;
     std::vector<Document> FindTopDocuments(const std::string_view raw_query) const;
 
     template <typename ExecutionPolicy, typename DocumentPredicate>
-    std::vector<Document> FindTopDocuments(ExecutionPolicy&& policy, std::string_view raw_query, DocumentPredicate document_predicate) const;
+    std::vector<Document> FindTopDocuments(ExecutionPolicy&& policy, std::string_view raw_query, DocumentPredicate document_predicate, size_t top_count = MAX_RESULT_DOCUMENT_COUNT) const;
     template <typename ExecutionPolicy>
-    std::vector<Document> FindTopDocuments(ExecutionPolicy&& policy, std::string_view raw_query, DocumentStatus status) const;
+    std::vector<Document> FindTopDocuments(ExecutionPolicy&& policy, std::string_view raw_query, DocumentStatus status, size_t top_count = MAX_RESULT_DOCUMENT_COUNT) const;
     template <typename ExecutionPolicy>
     std::vector<Document> FindTopDocuments(ExecutionPolicy&& policy, std::string_view raw_query) const;
 
+    // The page_size results ranked below the cursor, the first page for an
+    // empty one. A page only scores and keeps as many candidates as it
+    // returns, whatever its depth. Cursors belong to the query that returned
+    // them; after documents are added or removed, relevance shifts and a
+    // cursor resumes at the same relevance, rating and id rather than at the
+    // same position. A malformed cursor throws invalid_argument.
+    template <typename ExecutionPolicy, typename DocumentPredicate>
+    SearchPage FindPage(ExecutionPolicy&& policy, std::string_view raw_query, DocumentPredicate document_predicate, size_t page_size, std::string_view cursor = {}) const;
+    template <typename ExecutionPolicy>
+    SearchPage FindPage(ExecutionPolicy&& policy, std::string_view raw_query, DocumentStatus status, size_t page_size, std::string_view cursor = {}) const;
+    SearchPage FindPage(std::string_view raw_query, DocumentStatus status, size_t page_size, std::string_view cursor = {}) const;
+    SearchPage FindPage(std::string_view raw_query, size_t page_size, std::string_view cursor = {}) const;
+
+    // Parses the query once, so that it can be run any number of times.
+    PreparedQuery PrepareQuery(std::string_view raw_query) const;
+
+    template <typename ExecutionPolicy, typename DocumentPredicate>
+    std::vector<Document> FindTopDocuments(ExecutionPolicy&& policy, const PreparedQuery& query, DocumentPredicate document_predicate, size_t top_count = MAX_RESULT_DOCUMENT_COUNT) const;
+    template <typename ExecutionPolicy>
+    std::vector<Document> FindTopDocuments(ExecutionPolicy&& policy, const PreparedQuery& query, DocumentStatus status = DocumentStatus::ACTUAL, size_t top_count = MAX_RESULT_DOCUMENT_COUNT) const;
+    std::vector<Document> FindTopDocuments(const PreparedQuery& query, DocumentStatus status = DocumentStatus::ACTUAL, size_t top_count = MAX_RESULT_DOCUMENT_COUNT) const;
     
     int GetDocumentCount() const ;
     
-    std::set<int>::const_iterator begin() const ;
+    DocumentIdIterator begin() const ;
     
-    std::set<int>::const_iterator end() const ;
+    DocumentIdIterator end() const ;
 
+    // Matched words are views into the index, valid as long as it lives and is not compacted.
+    // Phrase words count as plus words, their order is not checked.
     std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(const std::execution::sequenced_policy& policy, const std::string_view raw_query, int document_id) const;
     std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(const std::execution::parallel_policy& policy, const std::string_view raw_query, int document_id) const;
     std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(const std::string_view raw_query, int document_id) const;
+    std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(const std::execution::sequenced_policy& policy, const PreparedQuery& query, int document_id) const;
+    std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(const std::execution::parallel_policy& policy, const PreparedQuery& query, int document_id) const;
+    std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(const PreparedQuery& query, int document_id) const;
+
+    // Matches the query against all the listed documents at once, walking the
+    // postings of every query word a single time. Results come in the order
+    // of the ids, an unknown id throws like MatchDocument does.
+    std::vector<std::tuple<std::vector<std::string_view>, DocumentStatus>> MatchDocuments(const std::execution::sequenced_policy& policy, std::string_view raw_query, const std::vector<int>& document_ids) const;
+    std::vector<std::tuple<std::vector<std::string_view>, DocumentStatus>> MatchDocuments(const std::execution::parallel_policy& policy, std::string_view raw_query, const std::vector<int>& document_ids) const;
+    std::vector<std::tuple<std::vector<std::string_view>, DocumentStatus>> MatchDocuments(std::string_view raw_query, const std::vector<int>& document_ids) const;
+    std::vector<std::tuple<std::vector<std::string_view>, DocumentStatus>> MatchDocuments(const std::execution::sequenced_policy& policy, const PreparedQuery& query, const std::vector<int>& document_ids) const;
+    std::vector<std::tuple<std::vector<std::string_view>, DocumentStatus>> MatchDocuments(const std::execution::parallel_policy& policy, const PreparedQuery& query, const std::vector<int>& document_ids) const;
+    std::vector<std::tuple<std::vector<std::string_view>, DocumentStatus>> MatchDocuments(const PreparedQuery& query, const std::vector<int>& document_ids) const;
 
     const std::map<std::string_view, double>& GetWordFrequencies(int document_id) const;
+    // The words of the document as term ids, sorted by id, with their
+    // frequencies. Every word has the same id in all documents, so equal word
+    // sets have equal id lists. Empty for an unknown id.
+    ArrayView<InvertedIndex::TermFreq> GetDocumentTerms(int document_id) const;
     
     void RemoveDocument(const std::execution::parallel_policy& policy, int document_id);
     void RemoveDocument(const std::execution::sequenced_policy& policy, int document_id);
     void RemoveDocument(int document_id);
+    // Removes all the listed documents in one step, unknown ids are skipped.
+    // Queries stop returning them at once; the space they took is reclaimed
+    // in the background once enough of a segment is removed, or by Compact.
+    void RemoveDocuments(const std::execution::parallel_policy& policy, const std::vector<int>& document_ids);
+    void RemoveDocuments(const std::execution::sequenced_policy& policy, const std::vector<int>& document_ids);
+    void RemoveDocuments(const std::vector<int>& document_ids);
+    // Rewrites the index without removed documents and drops the words no
+    // document has any more. Invalidates the words returned by MatchDocument
+    // and MatchDocuments before it.
+    void Compact();
+
+    size_t GetIndexMemoryUsage() const;
+
+    // Keeps the word positions of the documents added while on, off by
+    // default. Snapshots save the positions, not the setting.
+    void SetPositionsEnabled(bool enabled);
+    // Heap memory the positions take, included in GetIndexMemoryUsage.
+    size_t GetPositionMemoryUsage() const;
+
+    // How far the relevance FindTopDocuments reports for a document may be
+    // from the exact one: 0 in ScoringMode::EXACT and COMPRESSED, otherwise
+    // half an impact step of every query word, times its inverse document
+    // frequency.
+    double GetRelevanceErrorBound(std::string_view raw_query) const;
+
+    // Caches the results of up to capacity queries by status, 0 turns the
+    // cache off. Queries with a custom predicate always bypass it, and every
+    // added or removed document clears it, since it changes the inverse
+    // document frequency of all words.
+    void SetQueryCacheCapacity(size_t capacity);
+    QueryCache::Stats GetQueryCacheStats() const;
+
+    // Keeps the candidates of the next few pages of up to capacity paged
+    // queries by status, so that reading on does not score them again; 0,
+    // the default, turns it off. Cleared on every change like the query cache.
+    void SetPageCacheCapacity(size_t capacity);
+    QueryCache::Stats GetPageCacheStats() const;
+
+    // Writes the whole server to a versioned binary snapshot file.
+    void SaveSnapshot(const std::string& path) const;
+    // Serves the documents of a snapshot straight from the mapped file, without
+    // decoding it. Loading makes one pass over the sections to reject corrupt
+    // files with invalid_argument, nothing is copied.
+    // Documents added or removed afterwards only change the in-memory state.
+    // The snapshot keeps exact frequencies, scoring_mode applies to documents added later.
+    static SearchServer LoadSnapshot(const std::string& path, ScoringMode scoring_mode = ScoringMode::EXACT);
+
+    // Returns a read-only copy of the server as it is now, which later
+    // changes to the server do not affect. Documents added since the
+    // previous version are frozen into an index segment of their own, shared
+    // by the server and the copy, so the postings are not copied. Making it
+    // costs a pass over those documents, 20 bytes per document, 32 with
+    // positions, and a copy of the term dictionary and document frequencies,
+    // 44 to 60 bytes per distinct word. The copy caches nothing: a cache
+    // lookup takes a lock, and versions are meant to be read without one.
+    std::unique_ptr<const SearchServer> CreateVersion();
     
 private:
     struct DocumentData {
+        int id;
         int rating;
         DocumentStatus status;
     };
-    const std::set<std::string> stop_words_;
-    std::map<std::string, std::map<int, double>> word_to_document_freqs_;
-    std::map<int, std::map<std::string, double>, std::less<>> id_to_words_freqs_;
-    std::map<int, DocumentData> documents_;
-    std::set<int> document_ids_;
+    struct DocumentIdOrdinal {
+        int id;
+        DocumentOrdinal ordinal;
+    };
+
+    // owners of the base views: the snapshot, or the document data folded by CreateVersion
+    std::shared_ptr<const Snapshot> snapshot_;
+    std::shared_ptr<const std::vector<DocumentData>> folded_documents_;
+    std::shared_ptr<const std::vector<DocumentIdOrdinal>> folded_document_ordinals_;
+    const TermDictionary stop_words_;
+    InvertedIndex index_;
+    // by ordinal: the base documents, then those added after them
+    ArrayView<DocumentData> base_documents_;
+    std::vector<DocumentData> documents_;
+    // base documents sorted by id, removed ones included
+    ArrayView<DocumentIdOrdinal> base_document_ordinals_;
+    std::map<int, DocumentOrdinal> document_ordinals_;
+    size_t removed_base_document_count_ = 0;
+    PositionIndex positions_;
+    bool is_positions_enabled_ = false;
+    mutable QueryCache query_cache_;
+    // by query, status and cursor
+    mutable QueryCache page_cache_;
+
+    SearchServer(std::shared_ptr<const Snapshot> snapshot, ScoringMode scoring_mode);
+
+    const DocumentData& GetDocumentData(DocumentOrdinal document) const {
+        return document < base_documents_.size() ? base_documents_[document] : documents_[document - base_documents_.size()];
+    }
+
+    DocumentOrdinal GetOrdinalCount() const {
+        return static_cast<DocumentOrdinal>(base_documents_.size() + documents_.size());
+    }
+
+    std::optional<DocumentOrdinal> FindDocumentOrdinal(int document_id) const ;
+    // Forgets the ids of the listed documents, returning the sorted ordinals
+    // the index still has to remove.
+    std::vector<DocumentOrdinal> ForgetDocuments(const std::vector<int>& document_ids);
+
+    // Moves documents added since to the base arrays, shared with the copies made afterwards.
+    void FoldDocuments();
   
-    bool IsStopWord(const std::string& word) const ;
+    bool IsStopWord(std::string_view word) const ;
 
-    static bool IsValidWord(const std::string& word);
+    static bool IsValidWord(std::string_view word);
 
-    std::vector<std::string> SplitIntoWordsNoStop(const std::string_view text) const ;
+    std::vector<std::string_view> SplitIntoWordsNoStop(const std::string_view text) const ;
+    void SplitIntoWordsNoStop(std::string_view text, std::vector<std::string_view>& result) const ;
 
     static int ComputeAverageRating(const std::vector<int>& ratings) ;
 
     struct QueryWord {
-        std::string data;
+        std::string_view data;
         bool is_minus;
         bool is_stop;
     };
 
-    QueryWord ParseQueryWord(const std::string& text) const ;
+    QueryWord ParseQueryWord(std::string_view text, bool is_valid) const ;
+
+    // A non-stop word of a phrase and its place in it, stop words counted.
+    struct PhraseWord {
+        std::string_view data;
+        uint32_t offset;
+    };
 
+    // Words are views into the parsed text, so a query must not outlive it.
     struct Query {
-        std::vector<std::string> plus_words;
-        std::vector<std::string> minus_words;
+        // phrase words are plus words too
+        std::vector<std::string_view> plus_words;
+        std::vector<std::string_view> minus_words;
+        // phrases of two words or more, in query order, each ending at its phrase_ends entry
+        std::vector<PhraseWord> phrase_words;
+        std::vector<size_t> phrase_ends;
+    };
+
+    // Refills result in place: a reused Query parses without allocating.
+    void ParseQuery(std::string_view text, Query& result) const ;
+    // Returns search(query) on the parsed text. A thread waiting for a
+    // parallel search may run another search meanwhile, which would reparse a
+    // thread_local Query under it, so parallel policies parse into a local one.
+    template <typename ExecutionPolicy, typename Search>
+    auto WithParsedQuery(std::string_view text, Search search) const;
+    // Query cache key of the words and phrases.
+    static void MakeQueryKey(const Query& query, DocumentStatus status, size_t top_count, std::string& key);
+
+    // Position of every non-stop word of the text, stop words counted, as
+    // (rank of its term in the document's forward list, position) pairs.
+    void GetWordPositions(DocumentOrdinal document, std::string_view text, std::vector<std::pair<uint32_t, uint32_t>>& rank_positions) const ;
+
+    std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(const std::execution::sequenced_policy& policy, const Query& query, int document_id) const;
+    std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(const std::execution::parallel_policy& policy, const Query& query, int document_id) const;
+    // only instantiated in search_server.cpp
+    template <typename ExecutionPolicy>
+    std::vector<std::tuple<std::vector<std::string_view>, DocumentStatus>> MatchDocuments(ExecutionPolicy&& policy, const Query& query, const std::vector<int>& document_ids) const;
+
+    // log_document_count is computed once per query
+    double ComputeWordInverseDocumentFreq(TermId term, double log_document_count) const ;
+
+    bool IsValidDocumentId(int document_id) const ;
+
+    // ranges smaller than this are not worth a parallel task of their own
+    static constexpr size_t MIN_DOCUMENTS_PER_TASK = 4096;
+    // FindDocumentsWithPruning scores every posting instead for queries of
+    // fewer words or whose word score bounds are all within a factor of
+    // MIN_PRUNED_SCORE_SPREAD, and switches to it midway once its rounds pass
+    // fewer postings each on average, checked every PRUNING_CHECK_ROUNDS
+    static constexpr size_t MIN_PRUNED_WORD_COUNT = 2;
+    static constexpr double MIN_PRUNED_SCORE_SPREAD = 2.0;
+    static constexpr size_t MIN_POSTINGS_PER_PRUNING_ROUND = 64;
+    static constexpr size_t PRUNING_CHECK_ROUNDS = 64;
+
+    struct QueryTerm {
+        InvertedIndex::Postings postings;
+        double inverse_document_freq;
     };
 
-    Query ParseQuery(const std::string_view text) const ;
+    // Plus words with their postings, in query word order, and the postings of minus words.
+    struct QueryTerms {
+        std::vector<QueryTerm> plus_terms;
+        std::vector<InvertedIndex::Postings> minus_postings;
+        // sorted, the only documents that may match if the query has phrases
+        bool has_phrases = false;
+        std::vector<DocumentOrdinal> phrase_documents;
+        // hold the postings of compressed segments
+        InvertedIndex::PostingBuffers buffers;
+    };
 
-    double ComputeWordInverseDocumentFreq(const std::string& word) const ;
+    void ResolveQueryTerms(const Query& query, QueryTerms& result) const ;
+    // Documents holding the phrase of words [first, last), sorted.
+    void FindPhraseDocuments(const Query& query, size_t first, size_t last, InvertedIndex::PostingBuffers& buffers,
+                             std::vector<DocumentOrdinal>& result) const ;
+    // Whether the words with the given terms are at their places somewhere in
+    // the document, which holds all of them.
+    bool HasPhrase(DocumentOrdinal document, const PhraseWord* words, const TermId* terms, size_t word_count) const ;
 
+    static bool IsPhraseMatch(const QueryTerms& terms, DocumentOrdinal document) {
+        return !terms.has_phrases || std::binary_search(terms.phrase_documents.begin(), terms.phrase_documents.end(), document);
+    }
+
+    // Scores the documents with ordinals in [begin, end) and keeps the best of them in top_documents.
+    template <typename DocumentPredicate>
+    void ScoreDocumentRange(const QueryTerms& terms, DocumentOrdinal begin, DocumentOrdinal end,
+                            DocumentPredicate document_predicate, ScoringWorkspace& workspace, TopDocuments& top_documents) const ;
+
+    // Scores every document matching the query and keeps the best of them in top_documents.
+    template <typename DocumentPredicate>
+    void FindAllDocuments(const Query& query, DocumentPredicate document_predicate, TopDocuments& top_documents) const ;
+    template <typename ExecutionPolicy, typename DocumentPredicate>
+    void FindAllDocuments(ExecutionPolicy&& policy, const Query& query, DocumentPredicate document_predicate, TopDocuments& top_documents) const ;
+    // Same top as FindAllDocuments, but only scores documents that can still enter it.
     template <typename DocumentPredicate>
-    std::vector<Document> FindAllDocuments( const Query& query, DocumentPredicate document_predicate) const ;
+    void FindDocumentsWithPruning(const Query& query, DocumentPredicate document_predicate, TopDocuments& top_documents) const ;
+
+    // Runs the query the way the policy asks for.
+    template <typename ExecutionPolicy, typename DocumentPredicate>
+    void FindDocuments(ExecutionPolicy&& policy, const Query& query, DocumentPredicate document_predicate, TopDocuments& top_documents) const ;
+
     template <typename ExecutionPolicy, typename DocumentPredicate>
-    std::vector<Document> FindAllDocuments(ExecutionPolicy&& policy, const Query& query, DocumentPredicate document_predicate) const ;
+    std::vector<Document> FindTopDocuments(ExecutionPolicy&& policy, const Query& query, DocumentPredicate document_predicate, size_t top_count) const;
+    // Goes through the query cache.
+    template <typename ExecutionPolicy>
+    std::vector<Document> FindTopDocuments(ExecutionPolicy&& policy, const Query& query, DocumentStatus status, size_t top_count) const;
+
+    // pages fetched at once when the page cache is on
+    static constexpr size_t PREFETCHED_PAGE_COUNT = 4;
+
+    // The relevance is kept bit for bit, so the cursor document compares
+    // equal to itself when the query is run again.
+    static std::string EncodeCursor(const Document& document);
+    static std::optional<Document> DecodeCursor(std::string_view cursor);
+    // The first page_size candidates, with a cursor if more follow.
+    static SearchPage MakePage(const std::vector<Document>& candidates, size_t page_size);
     
 };
 
-//FAD without policyes
+// A query parsed once, to be run any number of times, from any thread.
+// It owns its words, so it may outlive the text it was prepared from.
+class SearchServer::PreparedQuery {
+private:
+    friend class SearchServer;
+
+    struct Words {
+        std::string text;
+        Query query;
+    };
+    // copies share the words
+    std::shared_ptr<const Words> words_;
+
+    explicit PreparedQuery(std::shared_ptr<const Words> words)
+        : words_(std::move(words))
+    {
+    }
+
+    const Query& GetQuery() const {
+        return words_->query;
+    }
+};
+
+class SearchServer::DocumentIdIterator {
+public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = int;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const int*;
+    using reference = const int&;
+
+    DocumentIdIterator(const SearchServer& search_server, const DocumentIdOrdinal* base,
+                       std::map<int, DocumentOrdinal>::const_iterator added);
+
+    reference operator*() const {
+        return IsBaseFirst() ? base_->id : added_->first;
+    }
+
+    DocumentIdIterator& operator++();
+    DocumentIdIterator operator++(int);
+
+    bool operator==(const DocumentIdIterator& other) const {
+        return base_ == other.base_ && added_ == other.added_;
+    }
+
+    bool operator!=(const DocumentIdIterator& other) const {
+        return !(*this == other);
+    }
+
+private:
+    const SearchServer* search_server_;
+    // ids of the snapshot and of documents added after it are merged on the fly
+    const DocumentIdOrdinal* base_;
+    std::map<int, DocumentOrdinal>::const_iterator added_;
+
+    bool IsBaseFirst() const;
+    void SkipRemoved();
+};
+
 template <typename DocumentPredicate>
-std::vector<Document> SearchServer::FindAllDocuments(const Query& query, DocumentPredicate document_predicate) const {
-    std::map<int, double> document_to_relevance;
-    for (const std::string& word : query.plus_words) {
-        if (word_to_document_freqs_.count(word) == 0) {
-            continue;
+void SearchServer::ScoreDocumentRange(const QueryTerms& terms, DocumentOrdinal begin, DocumentOrdinal end,
+                                      DocumentPredicate document_predicate, ScoringWorkspace& workspace, TopDocuments& top_documents) const {
+    workspace.Reset(begin, end);
+
+    const auto get_range = [begin, end](const InvertedIndex::Postings& postings) {
+        const auto first = std::lower_bound(postings.documents.begin(), postings.documents.end(), begin);
+        const auto last = std::lower_bound(first, postings.documents.end(), end);
+        return std::pair{static_cast<size_t>(first - postings.documents.begin()), static_cast<size_t>(last - postings.documents.begin())};
+    };
+
+    // excluding first spares scoring documents that are thrown away anyway
+    StageTimer exclusion_timer(QueryStage::MINUS_WORD_EXCLUSION);
+    index_.ForEachRemoved(begin, end, [&workspace](DocumentOrdinal document) {
+        workspace.Exclude(document);
+    });
+    for (const InvertedIndex::Postings& postings : terms.minus_postings) {
+        const auto [first, last] = get_range(postings);
+        for (size_t i = first; i < last; ++i) {
+            workspace.Exclude(postings.documents[i]);
         }
-        const double inverse_document_freq = ComputeWordInverseDocumentFreq(word);
-        for (const auto [document_id, term_freq] : word_to_document_freqs_.at(word)) {
-            const auto& document_data = documents_.at(document_id);
-            if (document_predicate(document_id, document_data.status, document_data.rating)) {
-                document_to_relevance[document_id] += term_freq * inverse_document_freq;
+    }
+    exclusion_timer.Stop();
+
+    StageTimer traversal_timer(QueryStage::POSTING_TRAVERSAL);
+    for (const QueryTerm& term : terms.plus_terms) {
+        const auto [first, last] = get_range(term.postings);
+        term.postings.VisitTermFreqs([&, first = first, last = last](auto get_term_freq) {
+            for (size_t i = first; i < last; ++i) {
+                workspace.AddScore(term.postings.documents[i], get_term_freq(i) * term.inverse_document_freq);
             }
-        }
+        });
     }
-
-    for (const std::string& word : query.minus_words) {
-        if (word_to_document_freqs_.count(word) == 0) {
-            continue;
-        }
-        for (const auto [document_id, _] : word_to_document_freqs_.at(word)) {
-            document_to_relevance.erase(document_id);
+    traversal_timer.Stop();
+
+    // the predicate runs once per scored document rather than once per posting
+    StageTimer filtering_timer(QueryStage::PREDICATE_FILTERING);
+    for (const DocumentOrdinal document : workspace.GetTouched()) {
+        const auto& document_data = GetDocumentData(document);
+        if (!workspace.IsExcluded(document) && (!IsPhraseMatch(terms, document)
+                                                || !document_predicate(document_data.id, document_data.status, document_data.rating))) {
+            workspace.Exclude(document);
         }
     }
+    filtering_timer.Stop();
 
-    std::vector<Document> matched_documents;
-    for (const auto [document_id, relevance] : document_to_relevance) {
-        matched_documents.push_back({document_id, relevance, documents_.at(document_id).rating});
+    StageTimer selection_timer(QueryStage::TOP_K_SELECTION);
+    for (const DocumentOrdinal document : workspace.GetTouched()) {
+        if (!workspace.IsExcluded(document)) {
+            const auto& document_data = GetDocumentData(document);
+            top_documents.Add({document_data.id, workspace.GetScore(document), document_data.rating});
+        }
     }
+}
 
-    return matched_documents;
+//FAD without policyes
+template <typename DocumentPredicate>
+void SearchServer::FindAllDocuments(const Query& query, DocumentPredicate document_predicate, TopDocuments& top_documents) const {
+    thread_local QueryTerms terms;
+    ResolveQueryTerms(query, terms);
+    ScoreDocumentRange(terms, 0, GetOrdinalCount(), document_predicate,
+                       ScoringWorkspace::ForCurrentThread(), top_documents);
 }
 
 //FAD par
 template <typename ExecutionPolicy, typename DocumentPredicate>
-std::vector<Document> SearchServer::FindAllDocuments(ExecutionPolicy&& policy, const Query& query, DocumentPredicate document_predicate) const {
-
-    std::map<int, double> document_to_relevance;
-    ConcurrentMap<int, double> local_document_to_relevance(100);
-       
-        for_each(policy, query.plus_words.begin(), query.plus_words.end(), [&](auto& a) {
-            if (word_to_document_freqs_.count(a) != 0) {
-                
-                const double inverse_document_freq = ComputeWordInverseDocumentFreq(a);
-                for (const auto [document_id, term_freq] : word_to_document_freqs_.at(a)) {
-                    const auto& document_data = documents_.at(document_id);
-                    if (document_predicate(document_id, document_data.status, document_data.rating)) {
-                        local_document_to_relevance[document_id].ref_to_value += term_freq * inverse_document_freq;
-                    }
-                }
-            }
-        });
-        
-    document_to_relevance = local_document_to_relevance.BuildOrdinaryMap();
+void SearchServer::FindAllDocuments(ExecutionPolicy&& policy, const Query& query, DocumentPredicate document_predicate, TopDocuments& top_documents) const {
+    QueryTerms terms;
+    ResolveQueryTerms(query, terms);
+
+    // Every task scores its own range of ordinals into its own workspace and
+    // top, so tasks share nothing but read-only postings and never lock.
+    const size_t document_count = GetOrdinalCount();
+    const size_t task_count = std::clamp<size_t>(document_count / MIN_DOCUMENTS_PER_TASK, 1, 4 * std::max(1u, std::thread::hardware_concurrency()));
+    std::vector<TopDocuments> task_tops(task_count, TopDocuments(top_documents.GetTopCount(), top_documents.GetAfter()));
+    for_each(policy, task_tops.begin(), task_tops.end(), [&](TopDocuments& task_top) {
+        const size_t task = &task_top - task_tops.data();
+        const auto begin = static_cast<DocumentOrdinal>(document_count * task / task_count);
+        const auto end = static_cast<DocumentOrdinal>(document_count * (task + 1) / task_count);
+        ScoreDocumentRange(terms, begin, end, document_predicate, ScoringWorkspace::ForCurrentThread(), task_top);
+    });
 
-    for (const std::string& word : query.minus_words) {
-        if (word_to_document_freqs_.count(word) == 0) {
-            continue;
-        }
-        for (const auto [document_id, _] : word_to_document_freqs_.at(word)) {
-            document_to_relevance.erase(document_id);
-        }
+    for (const TopDocuments& task_top : task_tops) {
+        top_documents.Merge(task_top);
     }
-    
+}
 
-    std::vector<Document> matched_documents;
-    for (const auto& [document_id, relevance] : document_to_relevance) {
-        matched_documents.push_back({document_id, relevance, documents_.at(document_id).rating});
+//Block-Max WAND
+template <typename DocumentPredicate>
+void SearchServer::FindDocumentsWithPruning(const Query& query, DocumentPredicate document_predicate, TopDocuments& top_documents) const {
+    struct TermCursor {
+        PostingCursor cursor;
+        double inverse_document_freq;
+        double max_score;
+        // that of the cursor, kept here so ordering does not chase the postings
+        DocumentOrdinal document;
+    };
+    if (top_documents.GetTopCount() == 0) {
+        return;
     }
 
-    return matched_documents;
-}
+    // kept in query word order, so relevance is summed exactly like FindAllDocuments does
+    thread_local QueryTerms query_terms;
+    ResolveQueryTerms(query, query_terms);
+    // A document is only skipped for missing some of several words, and
+    // cheaply only if those weigh more than the rest: otherwise a dense pass
+    // over every posting is faster.
+    double min_score = std::numeric_limits<double>::infinity();
+    double max_score = 0.0;
+    size_t segment_count = 0;
+    for (const QueryTerm& term : query_terms.plus_terms) {
+        min_score = std::min(min_score, term.postings.max_freq * term.inverse_document_freq);
+        max_score = std::max(max_score, term.postings.max_freq * term.inverse_document_freq);
+        segment_count = std::max(segment_count, term.postings.segment + 1);
+    }
+    if (query.plus_words.size() < MIN_PRUNED_WORD_COUNT || max_score < MIN_PRUNED_SCORE_SPREAD * min_score) {
+        ScoreDocumentRange(query_terms, 0, GetOrdinalCount(), document_predicate, ScoringWorkspace::ForCurrentThread(), top_documents);
+        return;
+    }
+    // scoring, filtering and exclusion are interleaved here, all of it counts as traversal
+    StageTimer timer(QueryStage::POSTING_TRAVERSAL);
 
-//FTD with parallel
-template <typename ExecutionPolicy, typename DocumentPredicate>
-std::vector<Document> SearchServer::FindTopDocuments(ExecutionPolicy&& policy, const std::string_view raw_query, DocumentPredicate document_predicate) const {
+    // A document can only enter a full top if its relevance comes within EPSILON
+    // of the worst kept one. The second EPSILON absorbs rounding in the bounds.
+    const auto get_threshold = [&top_documents] {
+        return top_documents.IsFull() ? top_documents.GetWorst().relevance - 2 * EPSILON : -std::numeric_limits<double>::infinity();
+    };
+
+    // Segments are searched one after another into the same top. A document
+    // lives in a single segment, so every term has at most one cursor per
+    // segment, and the threshold reached in a segment prunes the next ones.
+    std::vector<TermCursor> terms;
+    std::vector<PostingCursor> minus_cursors;
+    // By document, then by address, which is the query word order: cursors
+    // sharing a document are summed in the right order without sorting them.
+    std::vector<TermCursor*> order;
+    const auto is_before = [](const TermCursor* lhs, const TermCursor* rhs) {
+        return lhs->document < rhs->document || (lhs->document == rhs->document && lhs < rhs);
+    };
+    // Cursors only move forward, so the moved ones, the first count of the
+    // order, are carried right into place from the last one on.
+    const auto reorder = [&order, &is_before](size_t count) {
+        for (size_t i = count; i-- > 0;) {
+            for (size_t j = i; j + 1 < order.size() && is_before(order[j + 1], order[j]); ++j) {
+                std::swap(order[j], order[j + 1]);
+            }
+        }
+        while (!order.empty() && order.back()->document == PostingCursor::END) {
+            order.pop_back();
+        }
+    };
+    const auto skip_to = [](TermCursor& term, DocumentOrdinal document) {
+        term.cursor.SkipTo(document);
+        term.document = term.cursor.GetDocument();
+    };
+    // Pruning pays while a round passes many postings. If the bounds of most
+    // documents reach the threshold it does not, and the dense pass takes
+    // over from the first document the cursors have not passed.
+    size_t round_count = 0;
+    size_t passed_postings = 0;
+    const auto get_passed_postings = [&terms, &passed_postings] {
+        size_t passed = passed_postings;
+        for (const TermCursor& term : terms) {
+            passed += term.cursor.GetPosition();
+        }
+        return passed;
+    };
+    for (size_t segment = 0; segment < segment_count; ++segment) {
+        terms.clear();
+        for (const auto& [postings, inverse_document_freq] : query_terms.plus_terms) {
+            if (postings.segment == segment) {
+                PostingCursor cursor(postings);
+                terms.push_back({cursor, inverse_document_freq, postings.max_freq * inverse_document_freq, cursor.GetDocument()});
+            }
+        }
+        minus_cursors.clear();
+        for (const InvertedIndex::Postings& postings : query_terms.minus_postings) {
+            if (postings.segment == segment) {
+                minus_cursors.emplace_back(postings);
+            }
+        }
+        order.clear();
+        for (TermCursor& term : terms) {
+            order.push_back(&term);
+        }
+        std::sort(order.begin(), order.end(), is_before);
+        // drops empty lists
+        reorder(0);
+        while (true) {
+            // the pivot is the first document whose bound summed over all lists up to it reaches the threshold
+            const double threshold = get_threshold();
+            double bound = 0.0;
+            size_t pivot = 0;
+            while (pivot < order.size()) {
+                bound += order[pivot]->max_score;
+                if (bound >= threshold) {
+                    break;
+                }
+                ++pivot;
+            }
+            if (pivot == order.size()) {
+                break;
+            }
+            if (++round_count % PRUNING_CHECK_ROUNDS == 0 && get_passed_postings() < round_count * MIN_POSTINGS_PER_PRUNING_ROUND) {
+                timer.Stop();
+                ScoreDocumentRange(query_terms, order.front()->document, GetOrdinalCount(), document_predicate,
+                                   ScoringWorkspace::ForCurrentThread(), top_documents);
+                return;
+            }
+            const DocumentOrdinal pivot_document = order[pivot]->document;
+            // lists sharing the pivot document take part in its score as well
+            while (pivot + 1 < order.size() && order[pivot + 1]->document == pivot_document) {
+                ++pivot;
+            }
 
-    const auto query = ParseQuery(raw_query);
+            // tighter bound from the blocks the pivot document falls in
+            double block_bound = 0.0;
+            DocumentOrdinal next_candidate = pivot + 1 < order.size() ? order[pivot + 1]->document : PostingCursor::END;
+            for (size_t i = 0; i <= pivot; ++i) {
+                const auto [max_freq, last_document] = order[i]->cursor.GetBlockBound(pivot_document);
+                block_bound += max_freq * order[i]->inverse_document_freq;
+                next_candidate = std::min(next_candidate, last_document == PostingCursor::END ? last_document : last_document + 1);
+            }
+            if (block_bound < threshold) {
+                // no document before next_candidate can make it into the top
+                for (size_t i = 0; i <= pivot; ++i) {
+                    skip_to(*order[i], next_candidate);
+                }
+                reorder(pivot + 1);
+                continue;
+            }
 
-    auto matched_documents = FindAllDocuments(policy, query, document_predicate);
+            if (order.front()->document != pivot_document) {
+                // documents before the pivot cannot reach the threshold
+                size_t moved = 0;
+                for (; moved < pivot && order[moved]->document < pivot_document; ++moved) {
+                    skip_to(*order[moved], pivot_document);
+                }
+                reorder(moved);
+                continue;
+            }
 
-    sort(policy, matched_documents.begin(), matched_documents.end(), [](const Document& lhs, const Document& rhs) {
-        if (std::abs(lhs.relevance - rhs.relevance) < EPSILON) {
-            return lhs.rating > rhs.rating;
-        } else {
-            return lhs.relevance > rhs.relevance;
+            const auto& document_data = GetDocumentData(pivot_document);
+            const bool is_excluded = index_.IsRemoved(pivot_document) || !IsPhraseMatch(query_terms, pivot_document) || std::any_of(minus_cursors.begin(), minus_cursors.end(), [pivot_document](PostingCursor& cursor) {
+                cursor.SkipTo(pivot_document);
+                return cursor.GetDocument() == pivot_document;
+            });
+            if (!is_excluded && document_predicate(document_data.id, document_data.status, document_data.rating)) {
+                double relevance = 0.0;
+                for (size_t i = 0; i <= pivot; ++i) {
+                    relevance += order[i]->cursor.GetTermFreq() * order[i]->inverse_document_freq;
+                }
+                top_documents.Add({document_data.id, relevance, document_data.rating});
+            }
+            for (size_t i = 0; i <= pivot; ++i) {
+                order[i]->cursor.Next();
+                order[i]->document = order[i]->cursor.GetDocument();
+            }
+            reorder(pivot + 1);
         }
+        passed_postings = get_passed_postings();
+    }
+}
+
+//FTD with parallel
+template <typename ExecutionPolicy, typename Search>
+auto SearchServer::WithParsedQuery(std::string_view text, Search search) const {
+    if constexpr (std::is_same_v<std::decay_t<ExecutionPolicy>, std::execution::parallel_policy>) {
+        Query query;
+        ParseQuery(text, query);
+        return search(query);
+    } else {
+        thread_local Query query;
+        ParseQuery(text, query);
+        return search(query);
+    }
+}
+
+template <typename ExecutionPolicy, typename DocumentPredicate>
+std::vector<Document> SearchServer::FindTopDocuments(ExecutionPolicy&& policy, const std::string_view raw_query, DocumentPredicate document_predicate, size_t top_count) const {
+    return WithParsedQuery<ExecutionPolicy>(raw_query, [&](const Query& query) {
+        return FindTopDocuments(policy, query, document_predicate, top_count);
     });
-    if (matched_documents.size() > MAX_RESULT_DOCUMENT_COUNT) {
-        matched_documents.resize(MAX_RESULT_DOCUMENT_COUNT);
+}
+
+template <typename ExecutionPolicy, typename DocumentPredicate>
+void SearchServer::FindDocuments(ExecutionPolicy&& policy, const Query& query, DocumentPredicate document_predicate, TopDocuments& top_documents) const {
+    if constexpr (std::is_same_v<std::decay_t<ExecutionPolicy>, BlockMaxWandPolicy>) {
+        FindDocumentsWithPruning(query, document_predicate, top_documents);
+    } else if constexpr (std::is_same_v<std::decay_t<ExecutionPolicy>, std::execution::sequenced_policy>) {
+        FindAllDocuments(query, document_predicate, top_documents);
+    } else {
+        FindAllDocuments(policy, query, document_predicate, top_documents);
     }
+}
 
-    return matched_documents;
+template <typename ExecutionPolicy, typename DocumentPredicate>
+std::vector<Document> SearchServer::FindTopDocuments(ExecutionPolicy&& policy, const Query& query, DocumentPredicate document_predicate, size_t top_count) const {
+    TopDocuments top_documents(top_count);
+    FindDocuments(policy, query, document_predicate, top_documents);
+    return top_documents.Extract();
 }
 
 template <typename ExecutionPolicy>
 std::vector<Document> SearchServer::FindTopDocuments(ExecutionPolicy&& policy,
     std::string_view raw_query,
-    DocumentStatus status) const {
-    return FindTopDocuments(policy, raw_query, [status](int id, DocumentStatus document_status, int rating) {
-        return document_status == status;
-        });
+    DocumentStatus status, size_t top_count) const {
+    return WithParsedQuery<ExecutionPolicy>(raw_query, [&](const Query& query) {
+        return FindTopDocuments(policy, query, status, top_count);
+    });
+}
+
+template <typename ExecutionPolicy>
+std::vector<Document> SearchServer::FindTopDocuments(ExecutionPolicy&& policy, const Query& query, DocumentStatus status, size_t top_count) const {
+    const auto find = [&] {
+        return FindTopDocuments(policy, query, [status](int, DocumentStatus document_status, int) {
+            return document_status == status;
+        }, top_count);
+    };
+    if (!query_cache_.IsEnabled()) {
+        return find();
+    }
+
+    // every policy finds the same top, so they share the entries
+    std::string key;
+    MakeQueryKey(query, status, top_count, key);
+    if (auto documents = query_cache_.Find(key)) {
+        return std::move(*documents);
+    }
+    auto documents = find();
+    query_cache_.Insert(key, documents);
+    return documents;
 }
 
 template <typename ExecutionPolicy>
@@ -218,31 +793,124 @@ std::vector<Document> SearchServer::FindTopDocuments(ExecutionPolicy&& policy, s
     return FindTopDocuments(policy, raw_query, DocumentStatus::ACTUAL);
 }
 
+template <typename ExecutionPolicy, typename DocumentPredicate>
+std::vector<Document> SearchServer::FindTopDocuments(ExecutionPolicy&& policy, const PreparedQuery& query, DocumentPredicate document_predicate, size_t top_count) const {
+    return FindTopDocuments(policy, query.GetQuery(), document_predicate, top_count);
+}
+
+template <typename ExecutionPolicy>
+std::vector<Document> SearchServer::FindTopDocuments(ExecutionPolicy&& policy, const PreparedQuery& query, DocumentStatus status, size_t top_count) const {
+    return FindTopDocuments(policy, query.GetQuery(), status, top_count);
+}
+
+template <typename ExecutionPolicy, typename DocumentPredicate>
+SearchPage SearchServer::FindPage(ExecutionPolicy&& policy, std::string_view raw_query, DocumentPredicate document_predicate, size_t page_size, std::string_view cursor) const {
+    return WithParsedQuery<ExecutionPolicy>(raw_query, [&](const Query& query) {
+        // one candidate past the page tells whether another page follows
+        TopDocuments top_documents(page_size + 1, DecodeCursor(cursor));
+        FindDocuments(policy, query, document_predicate, top_documents);
+        return MakePage(top_documents.Extract(), page_size);
+    });
+}
+
+template <typename ExecutionPolicy>
+SearchPage SearchServer::FindPage(ExecutionPolicy&& policy, std::string_view raw_query, DocumentStatus status, size_t page_size, std::string_view cursor) const {
+    const auto document_predicate = [status](int, DocumentStatus document_status, int) {
+        return document_status == status;
+    };
+    if (!page_cache_.IsEnabled()) {
+        return FindPage(policy, raw_query, document_predicate, page_size, cursor);
+    }
+
+    return WithParsedQuery<ExecutionPolicy>(raw_query, [&](const Query& query) {
+        const std::optional<Document> after = DecodeCursor(cursor);
+        std::string key;
+        MakeQueryKey(query, status, 0, key);
+        const size_t query_key_size = key.size();
+        key.append(1, ' ').append(cursor);
+
+        // an entry is only used if it holds the whole page and tells whether more follow
+        std::vector<Document> candidates;
+        if (auto cached = page_cache_.Find(key); cached && cached->size() > page_size) {
+            candidates = std::move(*cached);
+        } else {
+            TopDocuments top_documents(PREFETCHED_PAGE_COUNT * page_size + 1, after);
+            FindDocuments(policy, query, document_predicate, top_documents);
+            candidates = top_documents.Extract();
+        }
+        SearchPage page = MakePage(candidates, page_size);
+        if (!page.next_cursor.empty()) {
+            key.resize(query_key_size);
+            key.append(1, ' ').append(page.next_cursor);
+            page_cache_.Insert(key, std::vector<Document>(candidates.begin() + page_size, candidates.end()));
+        }
+        return page;
+    });
+}
+
 //FTD without policyes
 template <typename DocumentPredicate>
-std::vector<Document> SearchServer::FindTopDocuments(const std::string_view raw_query, DocumentPredicate document_predicate) const {
-    const auto query = ParseQuery(raw_query);
+std::vector<Document> SearchServer::FindTopDocuments(const std::string_view raw_query, DocumentPredicate document_predicate, size_t top_count) const {
+    return FindTopDocuments(std::execution::seq, raw_query, document_predicate, top_count);
+}
 
-    auto matched_documents = FindAllDocuments(query, document_predicate);
 
-    sort(matched_documents.begin(), matched_documents.end(), [](const Document& lhs, const Document& rhs) {
-        if (std::abs(lhs.relevance - rhs.relevance) < EPSILON) {
-            return lhs.rating > rhs.rating;
-        } else {
-            return lhs.relevance > rhs.relevance;
+template <typename ExecutionPolicy>
+void SearchServer::AddDocuments(ExecutionPolicy&& policy, const std::vector<DocumentToAdd>& documents) {
+    std::vector<int> document_ids;
+    document_ids.reserve(documents.size());
+    for (const DocumentToAdd& document : documents) {
+        if (!IsValidDocumentId(document.id)) {
+            throw std::invalid_argument(" Invalid document_id");
         }
+        document_ids.push_back(document.id);
+    }
+    std::sort(document_ids.begin(), document_ids.end());
+    if (std::adjacent_find(document_ids.begin(), document_ids.end()) != document_ids.end()) {
+        throw std::invalid_argument(" Invalid document_id");
+    }
+
+    const auto invalid = std::find_if(policy, documents.begin(), documents.end(), [](const DocumentToAdd& document) {
+        bool is_valid_text = true;
+        ForEachWord(document.text, [&is_valid_text](std::string_view, bool is_valid) {
+            is_valid_text &= is_valid;
+        });
+        return !is_valid_text;
     });
-    if (matched_documents.size() > MAX_RESULT_DOCUMENT_COUNT) {
-        matched_documents.resize(MAX_RESULT_DOCUMENT_COUNT);
+    if (invalid != documents.end()) {
+        // throws on the first invalid word of the first invalid document
+        SplitIntoWordsNoStop(invalid->text);
     }
 
-    return matched_documents;
+    const DocumentOrdinal first = GetOrdinalCount();
+    index_.AddDocuments(policy, first, documents.size(), [this, &documents](size_t index, std::vector<std::string_view>& words) {
+        SplitIntoWordsNoStop(documents[index].text, words);
+    });
+    if (is_positions_enabled_) {
+        std::vector<std::vector<uint8_t>> position_bytes(documents.size());
+        std::for_each(policy, position_bytes.begin(), position_bytes.end(), [&](std::vector<uint8_t>& bytes) {
+            const size_t index = &bytes - position_bytes.data();
+            std::vector<std::pair<uint32_t, uint32_t>> rank_positions;
+            GetWordPositions(first + static_cast<DocumentOrdinal>(index), documents[index].text, rank_positions);
+            PositionIndex::Encode(rank_positions, bytes);
+        });
+        for (size_t i = 0; i < documents.size(); ++i) {
+            positions_.AddDocument(first + static_cast<DocumentOrdinal>(i), position_bytes[i]);
+        }
+    }
+    query_cache_.Clear();
+    page_cache_.Clear();
+    documents_.reserve(documents_.size() + documents.size());
+    for (const DocumentToAdd& document : documents) {
+        document_ordinals_.emplace(document.id, GetOrdinalCount());
+        documents_.push_back({document.id, ComputeAverageRating(document.ratings), document.status});
+    }
 }
 
-
 template <typename StringContainer>
-SearchServer::SearchServer(const StringContainer& stop_words)
+SearchServer::SearchServer(const StringContainer& stop_words, ScoringMode scoring_mode)
     : stop_words_(MakeUniqueNonEmptyStrings(stop_words))
+    , index_(scoring_mode)
 {
     if (!all_of(stop_words_.begin(), stop_words_.end(), IsValidWord)) {
         throw std::invalid_argument("Some of stop words are invalid");
@@ -0,0 +1,1989 @@
+#include "search_server_tests.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <execution>
+#include <fstream>
+#include <iterator>
+#include <list>
+#include <iostream>
+#include <map>
+#include <numeric>
+#include <random>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "concurrent_search_server.h"
+#include "metrics.h"
+#include "paginator.h"
+#include "process_queries.h"
+#include "query_executor.h"
+#include "remove_duplicates.h"
+#include "request_queue.h"
+#include "scoring_workspace.h"
+#include "search_server.h"
+#include "snapshot.h"
+#include "string_processing.h"
+#include "term_dictionary.h"
+#include "top_documents.h"
+
+using namespace std;
+
+// Words "w0".."w<vocabulary - 1>", the low ones far more common, as in natural text.
+static string GenerateText(mt19937& generator, int vocabulary, int word_count) {
+    string text;
+    for (int i = 0; i < word_count; ++i) {
+        const double exponent = uniform_real_distribution<>(0, 1)(generator);
+        text += (i == 0 ? "w"s : " w"s) + to_string(static_cast<int>(pow(vocabulary, exponent)) - 1);
+    }
+    return text;
+}
+
+static vector<string> SplitText(const string& text) {
+    vector<string> words;
+    istringstream input(text);
+    for (string word; input >> word;) {
+        words.push_back(word);
+    }
+    return words;
+}
+
+// A live document of a server, kept next to it by the tests.
+struct ReferenceDocument {
+    // stop words left out
+    map<string, int> word_counts;
+    int word_count = 0;
+    DocumentStatus status = DocumentStatus::ACTUAL;
+    int rating = 0;
+};
+
+static ReferenceDocument MakeReferenceDocument(const string& text, const set<string>& stop_words, DocumentStatus status, int rating) {
+    ReferenceDocument document{{}, 0, status, rating};
+    for (const string& word : SplitText(text)) {
+        if (stop_words.count(word) == 0) {
+            ++document.word_counts[word];
+            ++document.word_count;
+        }
+    }
+    return document;
+}
+
+// Relevance of every live document matching a query of plain words and
+// -minus words, by the definition: term frequency times log(documents /
+// documents with the word), summed over the distinct plus words.
+static map<int, double> ComputeReferenceRelevance(const map<int, ReferenceDocument>& documents, const set<string>& stop_words, const string& query) {
+    set<string> plus_words;
+    set<string> minus_words;
+    for (const string& word : SplitText(query)) {
+        if (word[0] == '-') {
+            minus_words.insert(word.substr(1));
+        } else if (stop_words.count(word) == 0) {
+            plus_words.insert(word);
+        }
+    }
+    map<string, int> document_freqs;
+    for (const auto& [id, document] : documents) {
+        for (const string& word : plus_words) {
+            document_freqs[word] += document.word_counts.count(word);
+        }
+    }
+    map<int, double> relevance;
+    for (const auto& [id, document] : documents) {
+        const bool is_excluded = any_of(minus_words.begin(), minus_words.end(), [&document](const string& word) {
+            return document.word_counts.count(word) != 0;
+        });
+        bool is_matched = false;
+        double score = 0.0;
+        for (const string& word : plus_words) {
+            if (const auto it = document.word_counts.find(word); it != document.word_counts.end()) {
+                is_matched = true;
+                score += it->second * 1.0 / document.word_count * log(documents.size() * 1.0 / document_freqs[word]);
+            }
+        }
+        if (is_matched && !is_excluded) {
+            relevance[id] = score;
+        }
+    }
+    return relevance;
+}
+
+// Whether found is a valid top of top_count out of the reference relevance
+// of the documents the predicate accepts: right scores, nothing better left out.
+template <typename DocumentPredicate>
+static bool IsReferenceTop(const vector<Document>& found, const map<int, double>& relevance, const map<int, ReferenceDocument>& documents,
+                           DocumentPredicate document_predicate, size_t top_count) {
+    size_t match_count = 0;
+    for (const auto& [id, score] : relevance) {
+        const ReferenceDocument& document = documents.at(id);
+        match_count += document_predicate(id, document.status, document.rating);
+    }
+    if (found.size() != min(top_count, match_count)) {
+        return false;
+    }
+    set<int> found_ids;
+    for (const Document& document : found) {
+        const auto it = relevance.find(document.id);
+        if (it == relevance.end() || abs(it->second - document.relevance) > 1e-9) {
+            return false;
+        }
+        found_ids.insert(document.id);
+    }
+    for (const auto& [id, score] : relevance) {
+        const ReferenceDocument& document = documents.at(id);
+        if (!found.empty() && found_ids.count(id) == 0 && document_predicate(id, document.status, document.rating)
+            && score > found.back().relevance + 1e-6) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool IsSameTop(const vector<Document>& lhs, const vector<Document>& rhs) {
+    return equal(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(), [](const Document& l, const Document& r) {
+        return l.id == r.id && l.relevance == r.relevance && l.rating == r.rating;
+    });
+}
+
+// Block-Max WAND, with its fallbacks, finds exactly what scoring every
+// document finds, across segments, removals, minus words and predicates.
+static void TestPruningMatchesExhaustiveScoring() {
+    mt19937 generator(4);
+    const set<string> stop_words = {"w0"s};
+    SearchServer search_server("w0"s);
+    map<int, ReferenceDocument> documents;
+    // enough documents for frozen segments besides the mutable one
+    for (int id = 0; id < 40'000; ++id) {
+        const string text = GenerateText(generator, 400, 1 + generator() % 24);
+        const auto status = generator() % 4 == 0 ? DocumentStatus::BANNED : DocumentStatus::ACTUAL;
+        const int rating = static_cast<int>(generator() % 9) - 4;
+        search_server.AddDocument(id, text, status, {rating});
+        documents[id] = MakeReferenceDocument(text, stop_words, status, rating);
+    }
+    for (int i = 0; i < 3000; ++i) {
+        const int id = static_cast<int>(generator() % 40'000);
+        search_server.RemoveDocument(id);
+        documents.erase(id);
+    }
+
+    const auto is_even = [](int document_id, DocumentStatus, int) {
+        return document_id % 2 == 0;
+    };
+    const auto is_actual = [](int, DocumentStatus status, int) {
+        return status == DocumentStatus::ACTUAL;
+    };
+    for (int i = 0; i < 60; ++i) {
+        // from single words to long queries with a few minus words
+        string query = GenerateText(generator, 400, 1 + i % 20);
+        if (i % 3 == 0) {
+            query += " -w"s + to_string(generator() % 400);
+        }
+        const auto relevance = ComputeReferenceRelevance(documents, stop_words, query);
+        for (const size_t top_count : {1, 5, 50}) {
+            const auto exhaustive = search_server.FindTopDocuments(execution::seq, query, is_even, top_count);
+            assert(IsReferenceTop(exhaustive, relevance, documents, is_even, top_count));
+            assert(IsSameTop(search_server.FindTopDocuments(block_max_wand, query, is_even, top_count), exhaustive));
+            assert(IsSameTop(search_server.FindTopDocuments(execution::par, query, is_even, top_count), exhaustive));
+
+            const auto actual = search_server.FindTopDocuments(execution::seq, query, DocumentStatus::ACTUAL, top_count);
+            assert(IsReferenceTop(actual, relevance, documents, is_actual, top_count));
+            assert(IsSameTop(search_server.FindTopDocuments(block_max_wand, query, DocumentStatus::ACTUAL, top_count), actual));
+        }
+    }
+}
+
+// Both servers hold the same documents and answer queries alike, the
+// first one also as the reference says.
+static void CheckSameServer(const SearchServer& expected, const SearchServer& actual, const map<int, ReferenceDocument>& documents,
+                            const set<string>& stop_words, const vector<string>& queries) {
+    assert(expected.GetDocumentCount() == static_cast<int>(documents.size()));
+    assert(actual.GetDocumentCount() == expected.GetDocumentCount());
+    assert(equal(expected.begin(), expected.end(), actual.begin(), actual.end()));
+    const auto is_any = [](int, DocumentStatus, int) {
+        return true;
+    };
+    for (const string& query : queries) {
+        const auto expected_top = expected.FindTopDocuments(execution::seq, query, is_any, 20);
+        assert(IsReferenceTop(expected_top, ComputeReferenceRelevance(documents, stop_words, query), documents, is_any, 20));
+        assert(IsSameTop(actual.FindTopDocuments(execution::seq, query, is_any, 20), expected_top));
+        assert(IsSameTop(actual.FindTopDocuments(execution::par, query, is_any, 20), expected_top));
+        assert(IsSameTop(actual.FindTopDocuments(block_max_wand, query, is_any, 20), expected_top));
+        for (const Document& document : expected_top) {
+            assert(expected.MatchDocument(query, document.id) == actual.MatchDocument(query, document.id));
+        }
+    }
+}
+
+static string ReadFile(const string& path) {
+    ifstream input(path, ios::binary);
+    return {istreambuf_iterator<char>(input), istreambuf_iterator<char>()};
+}
+
+// Rewrites one section of a valid snapshot and expects loading to refuse it.
+template <typename T, typename Corruption>
+static void CheckCorruptSnapshotRejected(const string& bytes, const string& path, SnapshotSection section, Corruption corrupt) {
+    SnapshotHeader header;
+    memcpy(&header, bytes.data(), sizeof(header));
+    const auto [offset, size] = header.sections[static_cast<size_t>(section)];
+    vector<T> values(size / sizeof(T));
+    memcpy(values.data(), bytes.data() + offset, size);
+    corrupt(values);
+    string corrupt_bytes = bytes;
+    memcpy(corrupt_bytes.data() + offset, values.data(), size);
+    ofstream(path, ios::binary) << corrupt_bytes;
+    try {
+        SearchServer::LoadSnapshot(path);
+        assert(false);
+    } catch (const invalid_argument&) {
+    }
+}
+
+// A loaded snapshot, and a snapshot of it after further changes, serve what
+// the server that saved it serves; damaged snapshots are refused on load.
+static void TestSnapshotRoundTrip() {
+    const string path = "search_server_test.snapshot"s;
+    mt19937 generator(9);
+    const set<string> stop_words = {"w0"s};
+    SearchServer search_server("w0"s);
+    search_server.SetPositionsEnabled(true);
+    map<int, ReferenceDocument> documents;
+    // sparse ids, and enough documents for a frozen segment
+    for (int id = 0; id < 60'000; id += 3) {
+        const string text = GenerateText(generator, 300, 1 + generator() % 16);
+        const auto status = static_cast<DocumentStatus>(generator() % 4);
+        const int rating = static_cast<int>(generator() % 9) - 4;
+        search_server.AddDocument(id, text, status, {rating});
+        documents[id] = MakeReferenceDocument(text, stop_words, status, rating);
+    }
+    for (int i = 0; i < 2000; ++i) {
+        const int id = static_cast<int>(generator() % 20'000) * 3;
+        search_server.RemoveDocument(id);
+        documents.erase(id);
+    }
+    vector<string> queries;
+    for (int i = 0; i < 20; ++i) {
+        queries.push_back(GenerateText(generator, 300, 1 + i % 6) + (i % 4 == 0 ? " -w"s + to_string(generator() % 300) : ""s));
+    }
+    queries.push_back("w0"s);
+
+    search_server.SaveSnapshot(path);
+    SearchServer loaded = SearchServer::LoadSnapshot(path);
+    CheckSameServer(search_server, loaded, documents, stop_words, queries);
+
+    // changes on top of the snapshot, then a snapshot of the result
+    for (int i = 0; i < 3000; ++i) {
+        const int id = static_cast<int>(generator() % 25'000) * 3;
+        if (documents.count(id) == 0) {
+            const string text = GenerateText(generator, 300, 1 + generator() % 16);
+            search_server.AddDocument(id, text, DocumentStatus::ACTUAL, {i % 5});
+            loaded.AddDocument(id, text, DocumentStatus::ACTUAL, {i % 5});
+            documents[id] = MakeReferenceDocument(text, stop_words, DocumentStatus::ACTUAL, i % 5);
+        } else {
+            search_server.RemoveDocument(id);
+            loaded.RemoveDocument(id);
+            documents.erase(id);
+        }
+    }
+    CheckSameServer(search_server, loaded, documents, stop_words, queries);
+    loaded.SaveSnapshot(path);
+    CheckSameServer(search_server, SearchServer::LoadSnapshot(path), documents, stop_words, queries);
+
+    const string bytes = ReadFile(path);
+    const string corrupt_path = path + ".corrupt"s;
+    ofstream(corrupt_path, ios::binary) << bytes.substr(0, bytes.size() / 2);
+    try {
+        SearchServer::LoadSnapshot(corrupt_path);
+        assert(false);
+    } catch (const invalid_argument&) {
+    }
+    CheckCorruptSnapshotRejected<uint64_t>(bytes, corrupt_path, SnapshotSection::POSTING_OFFSETS, [](vector<uint64_t>& offsets) {
+        offsets[offsets.size() / 2] = offsets[offsets.size() / 2 + 1] + 1;
+    });
+    CheckCorruptSnapshotRejected<TermDictionary::Slot>(bytes, corrupt_path, SnapshotSection::TERM_SLOTS, [](vector<TermDictionary::Slot>& slots) {
+        find_if(slots.begin(), slots.end(), [](const TermDictionary::Slot& slot) {
+            return slot.term != TermDictionary::EMPTY_SLOT;
+        })->term = TermDictionary::EMPTY_SLOT - 1;
+    });
+    // an id and its ordinal take 8 bytes, so swapping two of those swaps ids
+    CheckCorruptSnapshotRejected<uint64_t>(bytes, corrupt_path, SnapshotSection::DOCUMENT_IDS, [](vector<uint64_t>& ids) {
+        swap(ids[0], ids[1]);
+    });
+    CheckCorruptSnapshotRejected<uint64_t>(bytes, corrupt_path, SnapshotSection::POSITION_OFFSETS, [](vector<uint64_t>& offsets) {
+        offsets[1] = offsets.back() + 1;
+    });
+    CheckCorruptSnapshotRejected<uint8_t>(bytes, corrupt_path, SnapshotSection::POSITION_BYTES, [](vector<uint8_t>& position_bytes) {
+        fill(position_bytes.begin(), position_bytes.end(), 0xff);
+    });
+    remove(path.c_str());
+    remove(corrupt_path.c_str());
+}
+
+// Readers of a ConcurrentSearchServer only ever see whole published
+// versions, and a version stays intact while a reader is on it. Round r
+// adds batch r and removes batch r - 2, so every version holds one or two
+// adjacent batches, a contiguous run of ids.
+static void TestConcurrentReadersSeePublishedVersions() {
+    const int round_count = 40;
+    const int batch_size = 200;
+    mt19937 generator(11);
+    vector<string> texts(round_count * batch_size);
+    for (string& text : texts) {
+        text = "all "s + GenerateText(generator, 100, 1 + generator() % 10);
+    }
+    vector<string> queries = {"all"s};
+    for (int i = 0; i < 10; ++i) {
+        queries.push_back(GenerateText(generator, 100, 1 + i % 4) + " -w"s + to_string(generator() % 100));
+    }
+
+    ConcurrentSearchServer search_server("w0"s);
+    atomic<bool> is_done = false;
+    atomic<int> published_round = -1;
+    const auto read = [&](int reader) {
+        mt19937 reader_generator(reader);
+        int last_first_id = 0;
+        while (!is_done) {
+            const int round = published_round;
+            search_server.Read([&](const SearchServer& version) {
+                const vector<int> ids(version.begin(), version.end());
+                assert(static_cast<int>(ids.size()) == version.GetDocumentCount());
+                if (ids.empty()) {
+                    assert(round < 0);
+                    return 0;
+                }
+                assert(ids.size() == batch_size || ids.size() == 2 * batch_size);
+                assert(ids.front() % batch_size == 0 && ids.front() >= last_first_id);
+                assert(ids.back() - ids.front() + 1 == static_cast<int>(ids.size()));
+                last_first_id = ids.front();
+
+                const string& query = queries[reader_generator() % queries.size()];
+                const auto top = version.FindTopDocuments(execution::seq, query, DocumentStatus::ACTUAL, ids.size());
+                assert(query != "all"s || top.size() == ids.size());
+                for (const Document& document : top) {
+                    assert(document.id >= ids.front() && document.id <= ids.back());
+                    assert(!version.GetWordFrequencies(document.id).empty());
+                }
+                assert(IsSameTop(version.FindTopDocuments(execution::par, query, DocumentStatus::ACTUAL, ids.size()), top));
+                // the writer may publish meanwhile, this version stays as it was
+                this_thread::yield();
+                assert(IsSameTop(version.FindTopDocuments(block_max_wand, query, DocumentStatus::ACTUAL, ids.size()), top));
+                assert(equal(ids.begin(), ids.end(), version.begin(), version.end()));
+                return 0;
+            });
+        }
+    };
+    vector<thread> readers;
+    for (int reader = 0; reader < 3; ++reader) {
+        readers.emplace_back(read, reader);
+    }
+    for (int round = 0; round < round_count; ++round) {
+        const int first_id = round * batch_size;
+        if (round % 2 == 0) {
+            for (int id = first_id; id < first_id + batch_size; ++id) {
+                search_server.AddDocument(id, texts[id], DocumentStatus::ACTUAL, {round});
+            }
+        } else {
+            vector<DocumentToAdd> batch;
+            for (int id = first_id; id < first_id + batch_size; ++id) {
+                batch.push_back({id, texts[id], DocumentStatus::ACTUAL, {round}});
+            }
+            search_server.AddDocuments(execution::par, batch);
+        }
+        if (round >= 2) {
+            vector<int> document_ids(batch_size);
+            iota(document_ids.begin(), document_ids.end(), first_id - 2 * batch_size);
+            search_server.RemoveDocuments(execution::par, document_ids);
+        }
+        search_server.Publish();
+        published_round = round;
+        this_thread::yield();
+    }
+    is_done = true;
+    for (thread& reader : readers) {
+        reader.join();
+    }
+    search_server.Read([&](const SearchServer& version) {
+        assert(version.GetDocumentCount() == 2 * batch_size);
+        assert(*version.begin() == (round_count - 2) * batch_size);
+        return 0;
+    });
+}
+
+// QueryExecutor runs every task of a batch exactly once, also for tasks
+// calling Run themselves and for batches submitted from several threads at
+// once, and rethrows what a task throws.
+static void TestQueryExecutorBatches() {
+    mt19937 generator(15);
+    SearchServer search_server("w0"s);
+    for (int id = 0; id < 3000; ++id) {
+        search_server.AddDocument(id, GenerateText(generator, 200, 1 + generator() % 12), DocumentStatus::ACTUAL, {id % 7});
+    }
+    vector<string> queries(50);
+    for (string& query : queries) {
+        query = GenerateText(generator, 200, 1 + generator() % 5);
+    }
+    vector<vector<Document>> expected;
+    for (const string& query : queries) {
+        expected.push_back(search_server.FindTopDocuments(query));
+    }
+
+    for (const size_t thread_count : {1, 2, 4}) {
+        QueryExecutor executor(thread_count);
+        atomic<size_t> sum = 0;
+        executor.Run(20, [&](size_t i) {
+            executor.Run(10, [&](size_t j) {
+                executor.Run(3, [&](size_t k) {
+                    sum += i * 100 + j * 10 + k;
+                });
+            });
+        });
+        size_t expected_sum = 0;
+        for (size_t i = 0; i < 20; ++i) {
+            for (size_t j = 0; j < 10; ++j) {
+                for (size_t k = 0; k < 3; ++k) {
+                    expected_sum += i * 100 + j * 10 + k;
+                }
+            }
+        }
+        assert(sum == expected_sum);
+
+        vector<thread> callers;
+        for (int caller = 0; caller < 4; ++caller) {
+            callers.emplace_back([&] {
+                for (int round = 0; round < 5; ++round) {
+                    const auto results = ProcessQueries(executor, search_server, queries);
+                    assert(equal(results.begin(), results.end(), expected.begin(), expected.end(), IsSameTop));
+                    const JoinedDocuments joined = ProcessQueriesJoined(executor, search_server, queries);
+                    for (size_t query = 0; query < queries.size(); ++query) {
+                        const auto documents = joined.GetQueryDocuments(query);
+                        assert(IsSameTop(vector<Document>(documents.begin(), documents.end()), expected[query]));
+                    }
+                }
+            });
+        }
+        for (thread& caller : callers) {
+            caller.join();
+        }
+
+        bool is_thrown = false;
+        try {
+            executor.Run(5, [&](size_t i) {
+                executor.Run(2, [i](size_t) {
+                    if (i == 3) {
+                        throw runtime_error("task failed"s);
+                    }
+                });
+            });
+        } catch (const runtime_error&) {
+            is_thrown = true;
+        }
+        assert(is_thrown);
+        // and the executor goes on working
+        atomic<size_t> count = 0;
+        executor.Run(100, [&count](size_t) {
+            ++count;
+        });
+        assert(count == 100);
+    }
+}
+
+// Every page of a query, following the cursors from the first one. The
+// filter is a document predicate or a status, as FindPage takes either.
+template <typename ExecutionPolicy, typename DocumentFilter>
+static vector<Document> FindAllPages(const SearchServer& search_server, ExecutionPolicy&& policy, const string& query,
+                                     DocumentFilter document_filter, size_t page_size) {
+    vector<Document> documents;
+    string cursor;
+    do {
+        const SearchPage page = search_server.FindPage(policy, query, document_filter, page_size, cursor);
+        // only the last page may be short
+        assert(page.documents.size() == page_size || (page.documents.size() < page_size && page.next_cursor.empty()));
+        documents.insert(documents.end(), page.documents.begin(), page.documents.end());
+        cursor = page.next_cursor;
+    } while (!cursor.empty());
+    return documents;
+}
+
+// Pages concatenated in cursor order are one full ranking of the matches,
+// for every policy, page size and with the page cache on or off.
+static void TestPagesMatchFullRanking() {
+    mt19937 generator(24);
+    const set<string> stop_words = {"w0"s};
+    SearchServer search_server("w0"s);
+    map<int, ReferenceDocument> documents;
+    for (int id = 0; id < 5000; ++id) {
+        const string text = GenerateText(generator, 200, 1 + generator() % 20);
+        const auto status = id % 7 == 0 ? DocumentStatus::BANNED : DocumentStatus::ACTUAL;
+        // few distinct ratings, so that relevance ties are broken further down
+        const int rating = static_cast<int>(generator() % 3);
+        search_server.AddDocument(id, text, status, {rating});
+        documents[id] = MakeReferenceDocument(text, stop_words, status, rating);
+    }
+    const auto is_actual = [](int, DocumentStatus status, int) {
+        return status == DocumentStatus::ACTUAL;
+    };
+    const auto is_third = [](int document_id, DocumentStatus, int) {
+        return document_id % 3 == 0;
+    };
+    const size_t all_count = documents.size();
+    for (const string& query : {"w1"s, "w2 w3 w4"s, "w5 -w6"s, "w7 w8 w9 w10 w11 -w12"s, "w150 w190"s, "nothing"s}) {
+        const auto relevance = ComputeReferenceRelevance(documents, stop_words, query);
+        const auto full = search_server.FindTopDocuments(execution::seq, query, DocumentStatus::ACTUAL, all_count);
+        assert(IsReferenceTop(full, relevance, documents, is_actual, all_count));
+        const auto full_third = search_server.FindTopDocuments(execution::seq, query, is_third, all_count);
+        assert(IsReferenceTop(full_third, relevance, documents, is_third, all_count));
+        for (const size_t page_size : {size_t{1}, size_t{7}, size_t{50}, all_count}) {
+            if (page_size == 1 && full.size() > 500) {
+                continue;
+            }
+            for (const size_t cache_capacity : {0, 10}) {
+                search_server.SetPageCacheCapacity(cache_capacity);
+                assert(IsSameTop(FindAllPages(search_server, execution::seq, query, DocumentStatus::ACTUAL, page_size), full));
+                assert(IsSameTop(FindAllPages(search_server, execution::par, query, DocumentStatus::ACTUAL, page_size), full));
+                assert(IsSameTop(FindAllPages(search_server, block_max_wand, query, DocumentStatus::ACTUAL, page_size), full));
+            }
+            assert(IsSameTop(FindAllPages(search_server, execution::seq, query, is_third, page_size), full_third));
+            assert(IsSameTop(FindAllPages(search_server, block_max_wand, query, is_third, page_size), full_third));
+        }
+    }
+
+    // a cursor outlives the document it points at and resumes below it,
+    // though relevance shifts with the removal
+    const string query = "w1 w2"s;
+    const SearchPage first_page = search_server.FindPage(query, 10);
+    assert(first_page.documents.size() == 10);
+    const Document last = first_page.documents.back();
+    search_server.RemoveDocument(last.id);
+    const auto full = search_server.FindTopDocuments(query, DocumentStatus::ACTUAL, all_count);
+    const auto below = find_if(full.begin(), full.end(), [&last](const Document& document) {
+        return IsMoreRelevant(last, document);
+    });
+    const vector<Document> expected(below, below + min<ptrdiff_t>(10, full.end() - below));
+    assert(IsSameTop(search_server.FindPage(query, 10, first_page.next_cursor).documents, expected));
+
+    for (const string& cursor : {"x"s, "1.2"s, "1.2.3."s, ".1.2"s}) {
+        try {
+            search_server.FindPage(query, 5, cursor);
+            assert(false);
+        } catch (const invalid_argument&) {
+        }
+    }
+
+    vector<int> values(23);
+    iota(values.begin(), values.end(), 0);
+    const list<int> listed(values.begin(), values.end());
+    for (const size_t page_size : {1, 5, 23, 30}) {
+        vector<int> concatenated;
+        size_t page_count = 0;
+        for (const auto& page : Paginate(listed, page_size)) {
+            assert(page.size() == min(page_size, values.size() - page_count * page_size));
+            concatenated.insert(concatenated.end(), page.begin(), page.end());
+            ++page_count;
+        }
+        assert(concatenated == values);
+        assert(page_count == Paginate(values, page_size).size());
+    }
+}
+
+// Whether the words of a phrase follow each other in the text, by trying
+// every start. Stop words match any word in their place, or are left out
+// at the ends of the phrase.
+static bool HasReferencePhrase(const vector<string>& words, const vector<string>& phrase, const set<string>& stop_words) {
+    const auto is_stop_word = [&stop_words](const string& word) {
+        return stop_words.count(word) != 0;
+    };
+    const auto first = find_if_not(phrase.begin(), phrase.end(), is_stop_word);
+    const auto last = find_if_not(phrase.rbegin(), make_reverse_iterator(first), is_stop_word).base();
+    const size_t length = last - first;
+    for (size_t start = 0; start + length <= words.size(); ++start) {
+        bool is_found = true;
+        for (size_t i = 0; i < length && is_found; ++i) {
+            is_found = is_stop_word(first[i]) || words[start + i] == first[i];
+        }
+        if (is_found) {
+            return true;
+        }
+    }
+    return false;
+}
+
+struct PhraseQuery {
+    string text;
+    // the query without quotes
+    string words;
+    vector<vector<string>> phrases;
+};
+
+// Documents without positions are left out of document_words.
+static size_t CheckPhraseQueries(const SearchServer& search_server, const vector<PhraseQuery>& queries, const map<int, ReferenceDocument>& documents,
+                                 const map<int, vector<string>>& document_words, const set<string>& stop_words) {
+    const auto is_any = [](int, DocumentStatus, int) {
+        return true;
+    };
+    size_t match_count = 0;
+    for (const PhraseQuery& query : queries) {
+        auto relevance = ComputeReferenceRelevance(documents, stop_words, query.words);
+        for (const vector<string>& phrase : query.phrases) {
+            // a phrase of one word is a plain word
+            if (count_if(phrase.begin(), phrase.end(), [&stop_words](const string& word) { return stop_words.count(word) == 0; }) < 2) {
+                continue;
+            }
+            for (auto it = relevance.begin(); it != relevance.end();) {
+                const auto words = document_words.find(it->first);
+                it = words == document_words.end() || !HasReferencePhrase(words->second, phrase, stop_words) ? relevance.erase(it) : next(it);
+            }
+        }
+        const auto top = search_server.FindTopDocuments(execution::seq, query.text, is_any, documents.size());
+        assert(IsReferenceTop(top, relevance, documents, is_any, documents.size()));
+        assert(IsSameTop(search_server.FindTopDocuments(execution::par, query.text, is_any, documents.size()), top));
+        assert(IsSameTop(search_server.FindTopDocuments(block_max_wand, query.text, is_any, documents.size()), top));
+        assert(IsSameTop(search_server.FindTopDocuments(block_max_wand, query.text, is_any, 5),
+                         vector<Document>(top.begin(), top.begin() + min<size_t>(5, top.size()))));
+        match_count += top.size();
+    }
+    return match_count;
+}
+
+// Phrase queries find the documents of the same query without quotes that
+// hold every phrase, by a scan of their text, also after a snapshot.
+static void TestPhrasesMatchTextScan() {
+    const string path = "search_server_test.snapshot"s;
+    mt19937 generator(25);
+    const set<string> stop_words = {"w0"s};
+    SearchServer search_server("w0"s);
+    map<int, ReferenceDocument> documents;
+    map<int, vector<string>> document_words;
+    const auto add_document = [&](SearchServer& server, int id, bool has_positions) {
+        const string text = GenerateText(generator, 40, 3 + generator() % 15);
+        server.SetPositionsEnabled(has_positions);
+        server.AddDocument(id, text, DocumentStatus::ACTUAL, {id % 5});
+        documents[id] = MakeReferenceDocument(text, stop_words, DocumentStatus::ACTUAL, id % 5);
+        if (has_positions) {
+            document_words[id] = SplitText(text);
+        } else {
+            document_words.erase(id);
+        }
+    };
+    const auto remove_document = [&](SearchServer& server, int id) {
+        server.RemoveDocument(id);
+        documents.erase(id);
+        document_words.erase(id);
+    };
+    // enough documents for a frozen segment, a few of them without positions
+    for (int id = 0; id < 20'000; ++id) {
+        add_document(search_server, id, id % 20 != 0);
+    }
+    for (int i = 0; i < 2000; ++i) {
+        remove_document(search_server, static_cast<int>(generator() % 20'000));
+    }
+
+    // phrases cut out of documents, so that some match, next to plain and minus words
+    vector<PhraseQuery> queries;
+    for (int i = 0; i < 40; ++i) {
+        PhraseQuery query;
+        if (i % 3 == 1) {
+            query.text = "w"s + to_string(generator() % 40) + " -w"s + to_string(1 + generator() % 39);
+            query.words = query.text;
+        }
+        for (int phrase_index = 0; phrase_index <= i % 2; ++phrase_index) {
+            auto it = document_words.begin();
+            advance(it, generator() % document_words.size());
+            const vector<string>& words = it->second;
+            const size_t length = min<size_t>(words.size(), 2 + generator() % 3);
+            const size_t start = generator() % (words.size() - length + 1);
+            vector<string> phrase(words.begin() + start, words.begin() + start + length);
+            if (i % 5 == 0) {
+                reverse(phrase.begin(), phrase.end());
+            }
+            string phrase_text;
+            for (const string& word : phrase) {
+                phrase_text += (phrase_text.empty() ? ""s : " "s) + word;
+            }
+            query.text += " \""s + phrase_text + "\""s;
+            query.words += ' ' + phrase_text;
+            query.phrases.push_back(move(phrase));
+        }
+        queries.push_back(move(query));
+    }
+
+    assert(CheckPhraseQueries(search_server, queries, documents, document_words, stop_words) > 0);
+    search_server.SaveSnapshot(path);
+    SearchServer loaded = SearchServer::LoadSnapshot(path);
+    assert(CheckPhraseQueries(loaded, queries, documents, document_words, stop_words) > 0);
+    for (int id = 20'000; id < 21'000; ++id) {
+        add_document(loaded, id, true);
+    }
+    for (int i = 0; i < 1000; ++i) {
+        const int id = static_cast<int>(generator() % 21'000);
+        if (documents.count(id) != 0) {
+            remove_document(loaded, id);
+        }
+    }
+    CheckPhraseQueries(loaded, queries, documents, document_words, stop_words);
+    loaded.Compact();
+    CheckPhraseQueries(loaded, queries, documents, document_words, stop_words);
+    loaded.SaveSnapshot(path);
+    CheckPhraseQueries(SearchServer::LoadSnapshot(path), queries, documents, document_words, stop_words);
+    remove(path.c_str());
+
+    // without positions a phrase of two words or more matches nothing
+    SearchServer plain_server("w0"s);
+    for (int id = 0; id < 1000; ++id) {
+        plain_server.AddDocument(id, GenerateText(generator, 40, 3 + generator() % 15), DocumentStatus::ACTUAL, {1});
+    }
+    assert(plain_server.FindTopDocuments("\"w1 w2\""s).empty());
+    assert(plain_server.FindTopDocuments("\"w1\""s).size() == plain_server.FindTopDocuments("w1"s).size());
+
+    for (const string& query : {"\"w1 w2"s, "\"w1 -w2\""s, "-\"w1 w2\""s}) {
+        try {
+            search_server.FindTopDocuments(query);
+            assert(false);
+        } catch (const invalid_argument&) {
+        }
+    }
+}
+
+// Whether the index holds exactly the live documents, by their words: the
+// postings and frequency of every word and the forward list of every
+// document. Frequencies may be off by max_freq_error where impacts are stored.
+static bool IsIndexOfDocuments(const InvertedIndex& index, const map<DocumentOrdinal, vector<string>>& documents, double max_freq_error) {
+    map<string, map<DocumentOrdinal, double>> postings;
+    for (const auto& [document, words] : documents) {
+        for (const string& word : words) {
+            postings[word][document] += 1.0 / words.size();
+        }
+    }
+    size_t used_term_count = 0;
+    for (TermId term = 0; term < index.GetTermCount(); ++term) {
+        used_term_count += index.GetDocumentFreq(term) != 0;
+    }
+    if (used_term_count != postings.size()) {
+        return false;
+    }
+    InvertedIndex::PostingBuffers buffers;
+    for (const auto& [word, expected] : postings) {
+        const auto term = index.FindTerm(word);
+        if (!term || index.GetDocumentFreq(*term) != expected.size()) {
+            return false;
+        }
+        map<DocumentOrdinal, double> found;
+        buffers.Clear();
+        index.ForEachPostings(*term, buffers, [&](const InvertedIndex::Postings& term_postings) {
+            for (size_t i = 0; i < term_postings.size(); ++i) {
+                if (!index.IsRemoved(term_postings.documents[i])) {
+                    found[term_postings.documents[i]] = term_postings.GetTermFreq(i);
+                }
+            }
+        });
+        if (!equal(found.begin(), found.end(), expected.begin(), expected.end(), [max_freq_error](const auto& lhs, const auto& rhs) {
+            return lhs.first == rhs.first && abs(lhs.second - rhs.second) <= max_freq_error + 1e-12;
+        })) {
+            return false;
+        }
+    }
+    for (const auto& [document, words] : documents) {
+        map<string, double> expected;
+        for (const string& word : words) {
+            expected[word] += 1.0 / words.size();
+        }
+        const auto terms = index.GetDocumentTerms(document);
+        if (terms.size() != expected.size()) {
+            return false;
+        }
+        for (const InvertedIndex::TermFreq& term_freq : terms) {
+            const auto it = expected.find(string(index.GetTerm(term_freq.term)));
+            if (it == expected.end() || abs(it->second - term_freq.freq) > 1e-12) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// The flat posting arrays hold every word of every live document with its
+// frequency, in document order, and forget removed documents.
+static void TestIndexMatchesDocumentWords() {
+    mt19937 generator(1);
+    InvertedIndex index;
+    map<DocumentOrdinal, vector<string>> documents;
+    for (DocumentOrdinal document = 0; document < 3000; ++document) {
+        vector<string> words = SplitText(GenerateText(generator, 300, 1 + generator() % 20));
+        index.AddDocument(document, vector<string_view>(words.begin(), words.end()));
+        documents[document] = move(words);
+    }
+    assert(IsIndexOfDocuments(index, documents, 0.0));
+    for (DocumentOrdinal document = 0; document < 3000; document += 7) {
+        index.RemoveDocument(document);
+        documents.erase(document);
+    }
+    assert(IsIndexOfDocuments(index, documents, 0.0));
+    assert(!index.FindTerm("missing"sv));
+
+    // the server reports the same frequencies by word
+    SearchServer search_server("w0"s);
+    map<int, map<string, double>> expected_freqs;
+    for (int id = 0; id < 500; ++id) {
+        const vector<string> words = SplitText(GenerateText(generator, 100, 1 + generator() % 20));
+        string text;
+        vector<string> kept_words;
+        for (const string& word : words) {
+            text += word + ' ';
+            if (word != "w0"s) {
+                kept_words.push_back(word);
+            }
+        }
+        search_server.AddDocument(id * 2, text, DocumentStatus::ACTUAL, {1});
+        for (const string& word : kept_words) {
+            expected_freqs[id * 2][word] += 1.0 / kept_words.size();
+        }
+    }
+    for (const auto& [id, expected] : expected_freqs) {
+        const auto& found = search_server.GetWordFrequencies(id);
+        assert(equal(found.begin(), found.end(), expected.begin(), expected.end(), [](const auto& lhs, const auto& rhs) {
+            return lhs.first == rhs.first && abs(lhs.second - rhs.second) < 1e-12;
+        }));
+        assert(search_server.GetDocumentTerms(id).size() == expected.size());
+    }
+    assert(search_server.GetWordFrequencies(1).empty());
+    assert(search_server.GetDocumentTerms(1).empty());
+}
+
+// The term dictionary gives every distinct term one dense id, in insertion
+// order, like a std::map does, and its views survive the table growing.
+static void TestTermDictionaryMatchesMap() {
+    mt19937 generator(2);
+    TermDictionary dictionary;
+    map<string, TermId> expected;
+    vector<string_view> views;
+    // short and long terms, a term longer than a chunk, many repeats
+    vector<string> terms;
+    for (int i = 0; i < 50'000; ++i) {
+        terms.push_back("t"s + to_string(generator() % 20'000) + string(generator() % 3 == 0 ? generator() % 40 : 0, 'x'));
+    }
+    terms.push_back(string(100'000, 'y'));
+    terms.push_back("t1"s);
+    for (const string& term : terms) {
+        const TermId term_id = dictionary.Insert(term);
+        const auto [it, is_new] = expected.emplace(term, static_cast<TermId>(expected.size()));
+        assert(term_id == it->second);
+        if (is_new) {
+            views.push_back(dictionary.GetTerm(term_id));
+        }
+    }
+    assert(dictionary.size() == expected.size());
+    assert(dictionary.GetSlots().size() >= 2 * dictionary.size());
+    for (const auto& [term, term_id] : expected) {
+        assert(dictionary.Find(term) != nullptr && *dictionary.Find(term) == term_id);
+        assert(dictionary.GetTerm(term_id) == term && views[term_id] == term);
+    }
+    assert(!dictionary.Contains("t"sv) && !dictionary.Contains("t1z"sv) && !dictionary.Contains(""sv));
+
+    // a copy goes its own way and leaves the original as it was
+    TermDictionary copy = dictionary;
+    assert(copy.Insert("new"sv) == dictionary.size());
+    assert(!dictionary.Contains("new"sv) && copy.Contains("new"sv));
+    assert(*copy.Find("t1"sv) == expected.at("t1"s));
+
+    // the slot table and the term bytes serve the same lookups frozen
+    vector<uint64_t> offsets = {0};
+    string bytes;
+    for (const string_view term : dictionary) {
+        bytes += term;
+        offsets.push_back(bytes.size());
+    }
+    const FrozenTermDictionary frozen(dictionary.GetSlots(), ArrayView<uint64_t>(offsets), ArrayView<char>(bytes.data(), bytes.size()));
+    assert(frozen.size() == expected.size());
+    for (const auto& [term, term_id] : expected) {
+        assert(frozen.Find(term) != nullptr && *frozen.Find(term) == term_id && frozen.GetTerm(term_id) == term);
+    }
+    assert(frozen.Find("new"sv) == nullptr);
+}
+
+// The bounded heap keeps the same documents, in the same order, as sorting
+// all of them would; ties on relevance and rating fall back to the id.
+static void TestTopDocumentsMatchFullSort() {
+    mt19937 generator(3);
+    for (int round = 0; round < 200; ++round) {
+        // few distinct relevances and ratings, so most documents tie on both
+        vector<Document> documents;
+        const int document_count = generator() % 300;
+        for (int id = 0; id < document_count; ++id) {
+            const double noise = (generator() % 3) * EPSILON / 10;
+            documents.push_back({id * 3 % 1000, (generator() % 5) * 0.25 + noise, static_cast<int>(generator() % 3) - 1});
+        }
+        shuffle(documents.begin(), documents.end(), generator);
+        vector<Document> sorted = documents;
+        sort(sorted.begin(), sorted.end(), IsMoreRelevant);
+
+        const size_t top_count = generator() % 12;
+        optional<Document> after;
+        if (!sorted.empty() && generator() % 2 == 0) {
+            after = sorted[generator() % sorted.size()];
+        }
+        auto first = sorted.begin();
+        if (after) {
+            first = upper_bound(sorted.begin(), sorted.end(), *after, IsMoreRelevant);
+        }
+        const vector<Document> expected(first, first + min<size_t>(top_count, sorted.end() - first));
+
+        // one collector, and the same documents split over merged collectors
+        TopDocuments top(top_count, after);
+        TopDocuments left(top_count, after);
+        TopDocuments right(top_count, after);
+        for (size_t i = 0; i < documents.size(); ++i) {
+            top.Add(documents[i]);
+            (i % 2 == 0 ? left : right).Add(documents[i]);
+        }
+        left.Merge(right);
+        assert(top.size() == expected.size() && top.IsFull() == (expected.size() == top_count));
+        for (const vector<Document>& found : {top.Extract(), left.Extract()}) {
+            assert(equal(found.begin(), found.end(), expected.begin(), expected.end(), [](const Document& lhs, const Document& rhs) {
+                return lhs.id == rhs.id && lhs.relevance == rhs.relevance && lhs.rating == rhs.rating;
+            }));
+        }
+        assert(top.size() == 0);
+    }
+}
+
+// A workspace reused across queries, ranges and servers of different sizes
+// starts every query clean, as a fresh std::map would.
+static void TestScoringWorkspaceReuse() {
+    mt19937 generator(5);
+    ScoringWorkspace workspace;
+    for (int round = 0; round < 300; ++round) {
+        const DocumentOrdinal begin = generator() % 50;
+        const DocumentOrdinal end = begin + generator() % (round % 2 == 0 ? 2000 : 20);
+        workspace.Reset(begin, end);
+        map<DocumentOrdinal, double> expected;
+        set<DocumentOrdinal> excluded;
+        for (int i = 0; begin != end && i < 100; ++i) {
+            const DocumentOrdinal document = begin + generator() % (end - begin);
+            if (generator() % 5 == 0) {
+                workspace.Exclude(document);
+                excluded.insert(document);
+            } else {
+                workspace.AddScore(document, 0.5);
+                if (excluded.count(document) == 0) {
+                    expected[document] += 0.5;
+                }
+            }
+        }
+        map<DocumentOrdinal, double> found;
+        for (const DocumentOrdinal document : workspace.GetTouched()) {
+            assert(document >= begin && document < end);
+            if (!workspace.IsExcluded(document)) {
+                assert(found.emplace(document, workspace.GetScore(document)).second);
+            }
+        }
+        for (const DocumentOrdinal document : excluded) {
+            assert(workspace.IsExcluded(document));
+            expected.erase(document);
+        }
+        assert(found == expected);
+    }
+
+    // the thread's own workspace serves a large server, a small one, then
+    // the large one again
+    const set<string> stop_words = {"w0"s};
+    vector<SearchServer> servers;
+    vector<map<int, ReferenceDocument>> documents(2);
+    for (const int document_count : {3000, 40}) {
+        SearchServer& search_server = servers.emplace_back("w0"s);
+        for (int id = 0; id < document_count; ++id) {
+            const string text = GenerateText(generator, 200, 1 + generator() % 16);
+            search_server.AddDocument(id, text, DocumentStatus::ACTUAL, {id % 5});
+            documents[servers.size() - 1][id] = MakeReferenceDocument(text, stop_words, DocumentStatus::ACTUAL, id % 5);
+        }
+    }
+    const auto is_any = [](int, DocumentStatus, int) {
+        return true;
+    };
+    for (int i = 0; i < 60; ++i) {
+        const size_t server = i % 3 == 1;
+        const string query = GenerateText(generator, 200, 1 + i % 6) + (i % 4 == 0 ? " -w3"s : ""s);
+        const auto relevance = ComputeReferenceRelevance(documents[server], stop_words, query);
+        const auto found = servers[server].FindTopDocuments(execution::seq, query, is_any, 10);
+        assert(IsReferenceTop(found, relevance, documents[server], is_any, 10));
+    }
+}
+
+// Parallel scoring splits documents into ranges by task; whatever the split,
+// including ranges around a task boundary, it finds what sequential scoring
+// finds, also when several threads search at once.
+static void TestParallelScoringMatchesSequential() {
+    mt19937 generator(6);
+    const set<string> stop_words = {"w0"s};
+    const auto is_any = [](int, DocumentStatus, int) {
+        return true;
+    };
+    for (const int document_count : {0, 1, 4095, 4097, 3 * 4096 + 5}) {
+        SearchServer search_server("w0"s);
+        map<int, ReferenceDocument> documents;
+        for (int id = 0; id < document_count; ++id) {
+            const string text = GenerateText(generator, 300, 1 + generator() % 16);
+            search_server.AddDocument(id, text, DocumentStatus::ACTUAL, {id % 7});
+            documents[id] = MakeReferenceDocument(text, stop_words, DocumentStatus::ACTUAL, id % 7);
+        }
+        for (int id = 0; id < document_count; id += 11) {
+            search_server.RemoveDocument(id);
+            documents.erase(id);
+        }
+        vector<string> queries;
+        for (int i = 0; i < 20; ++i) {
+            queries.push_back(GenerateText(generator, 300, 1 + i % 8) + (i % 3 == 0 ? " -w2"s : ""s));
+        }
+        vector<vector<Document>> expected;
+        for (const string& query : queries) {
+            expected.push_back(search_server.FindTopDocuments(execution::seq, query, is_any, 20));
+            assert(IsReferenceTop(expected.back(), ComputeReferenceRelevance(documents, stop_words, query), documents, is_any, 20));
+            assert(IsSameTop(search_server.FindTopDocuments(execution::par, query, is_any, 20), expected.back()));
+        }
+
+        vector<thread> threads;
+        atomic<int> mismatch_count = 0;
+        for (int t = 0; t < 4; ++t) {
+            threads.emplace_back([&, t] {
+                for (size_t i = t; i < queries.size(); i += 2) {
+                    mismatch_count += !IsSameTop(search_server.FindTopDocuments(execution::par, queries[i], is_any, 20), expected[i]);
+                }
+            });
+        }
+        for (thread& thread : threads) {
+            thread.join();
+        }
+        assert(mismatch_count == 0);
+    }
+}
+
+// A word holds a control character when it has a byte in [0, ' ').
+static bool HasControlCharacter(const string& word) {
+    return any_of(word.begin(), word.end(), [](char c) {
+        return c >= '\0' && c < ' ';
+    });
+}
+
+// ForEachWord splits text like SplitIntoWords does and flags the same words
+// as invalid, around the vector widths and block size and on non-ASCII bytes.
+static void TestForEachWordMatchesSplitIntoWords() {
+    mt19937 generator(7);
+    const string alphabet = "  ab\t\x01\x1f\x7f\x80\xd0\xbf\xff"s + '\0';
+    vector<string> texts = {""s, " "s, "привет мир"s, "  ünïcödé\twörds "s, string(64, ' '), string(64, 'x')};
+    for (const size_t size : {15, 16, 17, 31, 32, 33, 63, 64, 65, 127, 128, 129, 1000}) {
+        for (int i = 0; i < 40; ++i) {
+            string text;
+            for (size_t j = 0; j < size; ++j) {
+                // mostly letters, so that words run across blocks too
+                text += generator() % 4 == 0 ? alphabet[generator() % alphabet.size()] : 'a' + generator() % 26;
+            }
+            texts.push_back(text);
+        }
+        // a word ending exactly at the size, and a space there
+        texts.push_back(string(size - 1, 'a') + 'b');
+        texts.push_back(string(size - 1, 'a') + ' ');
+    }
+    for (const string& text : texts) {
+        const vector<string> expected = SplitIntoWords(text);
+        vector<string> words;
+        ForEachWord(text, [&](string_view word, bool is_valid) {
+            assert(word.data() >= text.data() && word.data() + word.size() <= text.data() + text.size());
+            words.emplace_back(word);
+            assert(is_valid == !HasControlCharacter(words.back()));
+        });
+        assert(words == expected);
+    }
+
+    // the masks of every prefix of a block dense with spaces and controls
+    string block(TEXT_BLOCK_SIZE, ' ');
+    for (char& c : block) {
+        c = alphabet[generator() % alphabet.size()];
+    }
+    for (size_t size = 0; size <= TEXT_BLOCK_SIZE; ++size) {
+        const TextBlockMasks masks = ScanTextBlock(block.data(), size);
+        for (size_t i = 0; i < TEXT_BLOCK_SIZE; ++i) {
+            assert((masks.spaces >> i & 1) == (i < size && block[i] == ' '));
+            assert((masks.controls >> i & 1) == (i < size && HasControlCharacter(string(1, block[i]))));
+        }
+    }
+}
+
+// A batch adds what adding its documents one by one adds, and a batch with
+// an invalid id or word leaves the server as it was.
+static void TestAddDocumentsMatchesAddDocument() {
+    mt19937 generator(8);
+    const set<string> stop_words = {"w0"s};
+    SearchServer one_by_one("w0"s);
+    SearchServer seq_batches("w0"s);
+    SearchServer par_batches("w0"s);
+    for (SearchServer* search_server : {&one_by_one, &seq_batches, &par_batches}) {
+        search_server->SetPositionsEnabled(true);
+    }
+    map<int, ReferenceDocument> documents;
+    vector<string> queries;
+    for (int batch = 0; batch < 30; ++batch) {
+        vector<string> texts;
+        vector<DocumentToAdd> batch_documents;
+        const int batch_size = batch % 5 == 0 ? 0 : 1 + generator() % 300;
+        for (int i = 0; i < batch_size; ++i) {
+            texts.push_back(GenerateText(generator, 300, 1 + generator() % 16));
+        }
+        for (int i = 0; i < batch_size; ++i) {
+            const int id = batch * 1000 + i * 3;
+            const auto status = i % 4 == 0 ? DocumentStatus::IRRELEVANT : DocumentStatus::ACTUAL;
+            batch_documents.push_back({id, texts[i], status, {i % 9, -1}});
+            one_by_one.AddDocument(id, texts[i], status, {i % 9, -1});
+            documents[id] = MakeReferenceDocument(texts[i], stop_words, status, (i % 9 - 1) / 2);
+        }
+        seq_batches.AddDocuments(batch_documents);
+        par_batches.AddDocuments(execution::par, batch_documents);
+        if (!texts.empty()) {
+            queries.push_back(texts.back() + " -w5"s);
+            queries.push_back(GenerateText(generator, 300, 3));
+            queries.push_back('"' + texts.front() + '"');
+        }
+    }
+    // phrase queries are only compared between the servers
+    const auto check_same = [&](const SearchServer& batches) {
+        CheckSameServer(one_by_one, batches, documents, stop_words, {});
+        for (const auto& [id, document] : documents) {
+            assert(batches.GetWordFrequencies(id) == one_by_one.GetWordFrequencies(id));
+        }
+        for (const string& query : queries) {
+            assert(IsSameTop(batches.FindTopDocuments(query, DocumentStatus::ACTUAL, 20), one_by_one.FindTopDocuments(query, DocumentStatus::ACTUAL, 20)));
+        }
+    };
+    check_same(seq_batches);
+    check_same(par_batches);
+
+    // the bad document comes last, after documents that would have been added
+    const string text = "w1 w2 w3"s;
+    const string bad_text = "w1 w\x12"s;
+    const int existing_id = documents.rbegin()->first;
+    const vector<vector<DocumentToAdd>> bad_batches = {
+        {{100'000, text, DocumentStatus::ACTUAL, {1}}, {100'001, text, DocumentStatus::ACTUAL, {1}}, {100'000, text, DocumentStatus::ACTUAL, {1}}},
+        {{100'000, text, DocumentStatus::ACTUAL, {1}}, {existing_id, text, DocumentStatus::ACTUAL, {1}}},
+        {{100'000, text, DocumentStatus::ACTUAL, {1}}, {-1, text, DocumentStatus::ACTUAL, {1}}},
+        {{100'000, text, DocumentStatus::ACTUAL, {1}}, {100'001, bad_text, DocumentStatus::ACTUAL, {1}}},
+    };
+    for (const vector<DocumentToAdd>& bad_batch : bad_batches) {
+        for (SearchServer* batches : {&seq_batches, &par_batches}) {
+            bool is_thrown = false;
+            try {
+                if (batches == &seq_batches) {
+                    batches->AddDocuments(bad_batch);
+                } else {
+                    batches->AddDocuments(execution::par, bad_batch);
+                }
+            } catch (const invalid_argument&) {
+                is_thrown = true;
+            }
+            assert(is_thrown);
+            check_same(*batches);
+        }
+    }
+}
+
+// An index of many frozen segments, merged in the background and with
+// removals in all of them, holds what a single segment of the live documents
+// holds, before and after compaction.
+static void TestSegmentsMatchSingleSegment() {
+    mt19937 generator(10);
+    InvertedIndex index;
+    map<DocumentOrdinal, vector<string>> documents;
+    DocumentOrdinal next_document = 0;
+    for (int round = 0; round < 40; ++round) {
+        for (int i = 0; i < 500; ++i, ++next_document) {
+            vector<string> words = SplitText(GenerateText(generator, 500, 1 + generator() % 12));
+            index.AddDocument(next_document, vector<string_view>(words.begin(), words.end()));
+            documents[next_document] = move(words);
+        }
+        for (int i = 0; i < 100; ++i) {
+            const DocumentOrdinal document = generator() % next_document;
+            index.RemoveDocument(document);
+            documents.erase(document);
+        }
+        if (round % 10 == 9) {
+            assert(IsIndexOfDocuments(index, documents, 0.0));
+        }
+        if (round % 3 != 2) {
+            index.Freeze();
+        }
+    }
+    index.Compact();
+    assert(index.GetSegmentCount() == 1);
+    assert(IsIndexOfDocuments(index, documents, 0.0));
+    // the compacted index goes on taking documents and removals
+    for (int i = 0; i < 500; ++i, ++next_document) {
+        vector<string> words = SplitText(GenerateText(generator, 500, 1 + generator() % 12));
+        index.AddDocument(next_document, vector<string_view>(words.begin(), words.end()));
+        documents[next_document] = move(words);
+        index.RemoveDocument(next_document - 700);
+        documents.erase(next_document - 700);
+    }
+    assert(index.GetSegmentCount() == 2);
+    assert(IsIndexOfDocuments(index, documents, 0.0));
+
+    // a server searching its segments and versions finds what a server built
+    // with only the live documents finds, compacted into one segment
+    const set<string> stop_words = {"w0"s};
+    SearchServer segmented("w0"s);
+    map<int, ReferenceDocument> reference;
+    map<int, string> texts;
+    vector<unique_ptr<const SearchServer>> versions;
+    for (int round = 0; round < 20; ++round) {
+        for (int i = 0; i < 400; ++i) {
+            const int id = round * 400 + i;
+            texts[id] = GenerateText(generator, 300, 1 + generator() % 12);
+            segmented.AddDocument(id, texts[id], DocumentStatus::ACTUAL, {id % 5});
+            reference[id] = MakeReferenceDocument(texts[id], stop_words, DocumentStatus::ACTUAL, id % 5);
+        }
+        for (int i = 0; i < 60; ++i) {
+            const int id = generator() % ((round + 1) * 400);
+            segmented.RemoveDocument(id);
+            reference.erase(id);
+            texts.erase(id);
+        }
+        versions.push_back(segmented.CreateVersion());
+    }
+    SearchServer single("w0"s);
+    for (const auto& [id, text] : texts) {
+        single.AddDocument(id, text, DocumentStatus::ACTUAL, {id % 5});
+    }
+    single.Compact();
+    vector<string> queries;
+    for (int i = 0; i < 30; ++i) {
+        queries.push_back(GenerateText(generator, 300, 1 + i % 6) + (i % 4 == 0 ? " -w1"s : ""s));
+    }
+    CheckSameServer(single, segmented, reference, stop_words, queries);
+    CheckSameServer(single, *versions.back(), reference, stop_words, queries);
+}
+
+// The query cache answers normalized repeats of a query, never a custom
+// predicate, and nothing from before a document was added or removed.
+static void TestQueryCacheInvalidation() {
+    mt19937 generator(12);
+    SearchServer cached("w0"s);
+    SearchServer uncached("w0"s);
+    cached.SetQueryCacheCapacity(4);
+    const auto add_document = [&](int id, const string& text) {
+        cached.AddDocument(id, text, DocumentStatus::ACTUAL, {id % 3});
+        uncached.AddDocument(id, text, DocumentStatus::ACTUAL, {id % 3});
+    };
+    for (int id = 0; id < 2000; ++id) {
+        add_document(id, GenerateText(generator, 100, 1 + generator() % 10));
+    }
+    const auto check_same = [&](const string& query, size_t top_count = 5) {
+        assert(IsSameTop(cached.FindTopDocuments(query, DocumentStatus::ACTUAL, top_count), uncached.FindTopDocuments(query, DocumentStatus::ACTUAL, top_count)));
+    };
+
+    // word order, repeats and stop words do not matter, the top count does
+    check_same("w1 w2 -w3"s);
+    check_same("w2 w1 w2 -w3 w0"s);
+    check_same("-w3 w1 w0 w2"s);
+    check_same("w1 w2 -w3"s, 6);
+    assert(cached.GetQueryCacheStats().hits == 2 && cached.GetQueryCacheStats().misses == 2);
+    assert(IsSameTop(cached.FindTopDocuments(execution::par, "w1 w2 -w3"s, DocumentStatus::ACTUAL, 5), uncached.FindTopDocuments("w1 w2 -w3"s, DocumentStatus::ACTUAL, 5)));
+    assert(cached.FindTopDocuments("w1 w2 -w3"s, DocumentStatus::BANNED, 5).empty());
+    assert(cached.GetQueryCacheStats().hits == 3 && cached.GetQueryCacheStats().misses == 3);
+    cached.FindTopDocuments("w1 w2 -w3"s, [](int, DocumentStatus, int) {
+        return true;
+    });
+    assert(cached.GetQueryCacheStats().hits == 3 && cached.GetQueryCacheStats().misses == 3);
+
+    // every change reaches the cached queries, whether it touches their words or not
+    const vector<string> queries = {"w1"s, "w2 w5"s, "w7 -w1"s, "w50"s};
+    for (int change = 0; change < 40; ++change) {
+        for (const string& query : queries) {
+            check_same(query);
+            check_same(query);
+        }
+        const int id = 2000 + change;
+        switch (change % 4) {
+        case 0:
+            add_document(id, change % 8 == 0 ? "w1 w1 w50"s : "w99"s);
+            break;
+        case 1:
+            cached.RemoveDocument(id - 1);
+            uncached.RemoveDocument(id - 1);
+            break;
+        case 2:
+            cached.RemoveDocuments({change, change + 1});
+            uncached.RemoveDocuments({change, change + 1});
+            break;
+        default:
+            cached.AddDocuments({{id, "w2 w5 w5"sv, DocumentStatus::ACTUAL, {1}}});
+            uncached.AddDocument(id, "w2 w5 w5"sv, DocumentStatus::ACTUAL, {1});
+        }
+    }
+    const QueryCache::Stats stats = cached.GetQueryCacheStats();
+    assert(stats.hits == 3 + 40 * 4 && stats.misses == 3 + 40 * 4);
+
+    // least recently used entries make room for new ones
+    for (int i = 0; i < 10; ++i) {
+        check_same("w"s + to_string(i));
+    }
+    assert(cached.GetQueryCacheStats().evictions >= 6);
+    check_same("w9"s);
+    assert(cached.GetQueryCacheStats().hits == stats.hits + 1);
+    check_same("w0 w1"s);
+    assert(cached.GetQueryCacheStats().hits == stats.hits + 1);
+}
+
+// Words of a query of plain words and -minus words found in the document,
+// sorted, or none if it holds a minus word.
+static vector<string> MatchReferenceDocument(const ReferenceDocument& document, const set<string>& stop_words, const string& query) {
+    set<string> matched_words;
+    for (const string& word : SplitText(query)) {
+        if (word[0] == '-' && document.word_counts.count(word.substr(1)) != 0) {
+            return {};
+        }
+        if (word[0] != '-' && stop_words.count(word) == 0 && document.word_counts.count(word) != 0) {
+            matched_words.insert(word);
+        }
+    }
+    return {matched_words.begin(), matched_words.end()};
+}
+
+static bool IsSameMatch(const tuple<vector<string_view>, DocumentStatus>& match, const vector<string>& words, DocumentStatus status) {
+    const auto& [matched_words, matched_status] = match;
+    return matched_status == status && equal(matched_words.begin(), matched_words.end(), words.begin(), words.end());
+}
+
+// A prepared query finds and matches what its text does, after the text is
+// gone, and matching gives every thread its own answer.
+static void TestPreparedQueriesMatchRawQueries() {
+    mt19937 generator(13);
+    const set<string> stop_words = {"w0"s};
+    SearchServer search_server("w0"s);
+    map<int, ReferenceDocument> documents;
+    for (int id = 0; id < 1000; ++id) {
+        const string text = GenerateText(generator, 60, 1 + generator() % 10);
+        const auto status = id % 3 == 0 ? DocumentStatus::BANNED : DocumentStatus::ACTUAL;
+        search_server.AddDocument(id, text, status, {id % 4});
+        documents[id] = MakeReferenceDocument(text, stop_words, status, id % 4);
+    }
+    vector<string> queries;
+    vector<SearchServer::PreparedQuery> prepared_queries;
+    for (int i = 0; i < 40; ++i) {
+        queries.push_back(GenerateText(generator, 60, 1 + i % 5) + (i % 3 == 0 ? " -w"s + to_string(generator() % 60) : ""s));
+        // the prepared query keeps its own copy of the text
+        string text = queries.back();
+        prepared_queries.push_back(search_server.PrepareQuery(text));
+        text.assign(text.size(), '?');
+    }
+    for (size_t i = 0; i < queries.size(); ++i) {
+        const SearchServer::PreparedQuery& prepared = prepared_queries[i];
+        assert(IsSameTop(search_server.FindTopDocuments(prepared), search_server.FindTopDocuments(queries[i])));
+        assert(IsSameTop(search_server.FindTopDocuments(execution::par, prepared, DocumentStatus::BANNED, 3),
+                         search_server.FindTopDocuments(queries[i], DocumentStatus::BANNED, 3)));
+        for (int id = 0; id < 1000; id += 7) {
+            const vector<string> expected = MatchReferenceDocument(documents.at(id), stop_words, queries[i]);
+            const DocumentStatus status = documents.at(id).status;
+            assert(IsSameMatch(search_server.MatchDocument(queries[i], id), expected, status));
+            assert(IsSameMatch(search_server.MatchDocument(execution::par, queries[i], id), expected, status));
+            assert(IsSameMatch(search_server.MatchDocument(prepared, id), expected, status));
+            assert(IsSameMatch(search_server.MatchDocument(execution::par, prepared, id), expected, status));
+        }
+    }
+
+    // threads matching different queries at once each get their own words
+    vector<thread> threads;
+    atomic<int> mismatch_count = 0;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&, t] {
+            for (size_t i = t; i < queries.size(); i += 4) {
+                for (int id = t; id < 1000; id += 13) {
+                    const vector<string> expected = MatchReferenceDocument(documents.at(id), stop_words, queries[i]);
+                    const DocumentStatus status = documents.at(id).status;
+                    mismatch_count += !IsSameMatch(search_server.MatchDocument(queries[i], id), expected, status);
+                    mismatch_count += !IsSameMatch(search_server.MatchDocument(execution::par, queries[i], id), expected, status);
+                    mismatch_count += !IsSameMatch(search_server.MatchDocument(prepared_queries[i], id), expected, status);
+                }
+            }
+        });
+    }
+    for (thread& thread : threads) {
+        thread.join();
+    }
+    assert(mismatch_count == 0);
+}
+
+// Matching a batch of documents gives, in the order of the ids, what
+// matching each of them does, across segments and removals.
+static void TestMatchDocumentsMatchesMatchDocument() {
+    mt19937 generator(14);
+    SearchServer search_server("w0"s);
+    vector<int> ids;
+    for (int id = 0; id < 6000; ++id) {
+        search_server.AddDocument(id * 2, GenerateText(generator, 100, 1 + generator() % 12), id % 5 == 0 ? DocumentStatus::BANNED : DocumentStatus::ACTUAL, {1});
+        if (id % 2000 == 1999) {
+            search_server.CreateVersion();
+        }
+    }
+    for (int id = 0; id < 6000; ++id) {
+        if (id % 9 == 0) {
+            search_server.RemoveDocument(id * 2);
+        } else {
+            ids.push_back(id * 2);
+        }
+    }
+    shuffle(ids.begin(), ids.end(), generator);
+
+    for (int i = 0; i < 20; ++i) {
+        const string query = GenerateText(generator, 100, 1 + i % 6) + (i % 2 == 0 ? " -w"s + to_string(generator() % 100) : ""s);
+        const SearchServer::PreparedQuery prepared = search_server.PrepareQuery(query);
+        const vector<int> batch_ids(ids.begin(), ids.begin() + (i == 0 ? 0 : i % 4 == 0 ? ids.size() : generator() % 500));
+        vector<tuple<vector<string_view>, DocumentStatus>> expected;
+        for (const int id : batch_ids) {
+            expected.push_back(search_server.MatchDocument(query, id));
+        }
+        assert(search_server.MatchDocuments(query, batch_ids) == expected);
+        assert(search_server.MatchDocuments(execution::par, query, batch_ids) == expected);
+        assert(search_server.MatchDocuments(prepared, batch_ids) == expected);
+        assert(search_server.MatchDocuments(execution::par, prepared, batch_ids) == expected);
+    }
+
+    // removed and unknown ids throw like MatchDocument does
+    for (const vector<int>& bad_ids : {vector<int>{ids[0], 0}, vector<int>{1, ids[0]}, vector<int>{-1}}) {
+        for (const bool is_parallel : {false, true}) {
+            bool is_thrown = false;
+            try {
+                is_parallel ? search_server.MatchDocuments(execution::par, "w1 w2"s, bad_ids) : search_server.MatchDocuments("w1 w2"s, bad_ids);
+            } catch (const out_of_range&) {
+                is_thrown = true;
+            }
+            assert(is_thrown);
+        }
+    }
+}
+
+// The joined results of a batch hold, query by query and in order, what
+// ProcessQueries returns for it.
+static void TestJoinedResultsMatchProcessQueries() {
+    mt19937 generator(16);
+    SearchServer search_server("w0"s);
+    for (int id = 0; id < 3000; ++id) {
+        search_server.AddDocument(id, GenerateText(generator, 200, 1 + generator() % 10), DocumentStatus::ACTUAL, {id % 6});
+    }
+    QueryExecutor executor(3);
+    for (const size_t query_count : {0, 1, 2, 150}) {
+        vector<string> queries;
+        for (size_t i = 0; i < query_count; ++i) {
+            // some find nothing at all
+            queries.push_back(i % 5 == 4 ? "w0 missing"s : GenerateText(generator, 200, 1 + i % 4));
+        }
+        const vector<vector<Document>> expected = ProcessQueries(executor, search_server, queries);
+        assert(expected.size() == queries.size());
+        vector<Document> concatenated;
+        for (size_t i = 0; i < queries.size(); ++i) {
+            assert(IsSameTop(expected[i], search_server.FindTopDocuments(queries[i])));
+            concatenated.insert(concatenated.end(), expected[i].begin(), expected[i].end());
+        }
+        for (const JoinedDocuments& joined : {ProcessQueriesJoined(executor, search_server, queries), ProcessQueriesJoined(search_server, queries)}) {
+            assert(joined.size() == concatenated.size() && joined.empty() == concatenated.empty());
+            assert(IsSameTop(vector<Document>(joined.begin(), joined.end()), concatenated));
+            for (size_t i = 0; i < queries.size(); ++i) {
+                const auto documents = joined.GetQueryDocuments(i);
+                assert(IsSameTop(vector<Document>(documents.begin(), documents.end()), expected[i]));
+            }
+        }
+    }
+}
+
+static double ComputeReferenceJaccard(const set<string>& lhs, const set<string>& rhs) {
+    vector<string> common;
+    set_intersection(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(), back_inserter(common));
+    return lhs.empty() && rhs.empty() ? 1.0 : common.size() * 1.0 / (lhs.size() + rhs.size() - common.size());
+}
+
+// Ids a scan in id order keeps: those not at least threshold similar to a
+// kept one. A threshold of 1 keeps one document of every word set.
+static set<int> KeepReferenceDocuments(const map<int, set<string>>& word_sets, double similarity_threshold) {
+    set<int> kept_ids;
+    for (const auto& [id, words] : word_sets) {
+        if (none_of(kept_ids.begin(), kept_ids.end(), [&](int kept_id) {
+            return ComputeReferenceJaccard(word_sets.at(kept_id), words) >= similarity_threshold;
+        })) {
+            kept_ids.insert(id);
+        }
+    }
+    return kept_ids;
+}
+
+// Duplicates are the documents whose word sets equal, or come close enough
+// to, those of a kept document with a smaller id. Near-duplicates here are
+// similar enough for MinHash never to miss them in practice.
+static void TestDuplicatesMatchWordSets() {
+    mt19937 generator(17);
+    const auto add_copies = [&generator](SearchServer& search_server, map<int, set<string>>& word_sets, bool is_near) {
+        int id = 0;
+        for (int group = 0; group < 300; ++group) {
+            vector<string> words;
+            for (int i = 0; i < 20; ++i) {
+                words.push_back("w"s + to_string(generator() % 100'000));
+            }
+            for (int copy = 0; copy < 1 + static_cast<int>(generator() % 4); ++copy) {
+                vector<string> copy_words = words;
+                if (is_near && copy > 0) {
+                    copy_words[generator() % copy_words.size()] = "x"s + to_string(id);
+                }
+                // word order, repeats and stop words make no difference
+                shuffle(copy_words.begin(), copy_words.end(), generator);
+                copy_words.push_back(copy_words[generator() % copy_words.size()]);
+                copy_words.push_back("and"s);
+                string text;
+                for (const string& word : copy_words) {
+                    text += word + ' ';
+                }
+                // copies are added among the other groups, not right after their original
+                const int copy_id = copy == 0 ? id : id + 100'000 * copy;
+                search_server.AddDocument(copy_id, text, DocumentStatus::ACTUAL, {1});
+                word_sets[copy_id] = set<string>(copy_words.begin(), copy_words.end() - 1);
+                word_sets[copy_id].erase("and"s);
+            }
+            ++id;
+        }
+    };
+
+    auto* const output = cout.rdbuf(nullptr);
+    for (const bool is_near : {false, true}) {
+        SearchServer search_server("and"s);
+        map<int, set<string>> word_sets;
+        add_copies(search_server, word_sets, is_near);
+        const double similarity_threshold = is_near ? 0.7 : 1.0;
+        const set<int> expected = KeepReferenceDocuments(word_sets, similarity_threshold);
+        assert(expected.size() == 300 && (is_near || KeepReferenceDocuments(word_sets, 0.7) == expected));
+        if (is_near) {
+            RemoveNearDuplicates(search_server, similarity_threshold);
+        } else {
+            RemoveDuplicates(search_server);
+        }
+        assert(set<int>(search_server.begin(), search_server.end()) == expected);
+    }
+
+    // exact duplicates only, a near-duplicate stays
+    SearchServer search_server("and"s);
+    map<int, set<string>> word_sets;
+    add_copies(search_server, word_sets, true);
+    RemoveDuplicates(search_server);
+    assert(set<int>(search_server.begin(), search_server.end()) == KeepReferenceDocuments(word_sets, 1.0));
+    RemoveNearDuplicates(search_server, 1.0);
+    assert(set<int>(search_server.begin(), search_server.end()) == KeepReferenceDocuments(word_sets, 1.0));
+    cout.rdbuf(output);
+}
+
+// Documents removed in batches, from frozen segments and the mutable one,
+// are gone from queries at once, and compaction leaves what building the
+// index from the live documents would, words no document has included.
+static void TestRemoveDocumentsMatchesFreshBuild() {
+    mt19937 generator(18);
+    InvertedIndex index;
+    map<DocumentOrdinal, vector<string>> documents;
+    for (DocumentOrdinal document = 0; document < 6000; ++document) {
+        vector<string> words = SplitText(GenerateText(generator, 2000, 1 + generator() % 10));
+        index.AddDocument(document, vector<string_view>(words.begin(), words.end()));
+        documents[document] = move(words);
+        if (document % 2500 == 2499) {
+            index.Freeze();
+        }
+    }
+    for (const bool is_parallel : {false, true}) {
+        vector<DocumentOrdinal> removed;
+        for (const auto& [document, words] : documents) {
+            if (generator() % 3 == 0) {
+                removed.push_back(document);
+            }
+        }
+        if (is_parallel) {
+            index.RemoveDocuments(execution::par, removed);
+        } else {
+            index.RemoveDocuments(execution::seq, removed);
+        }
+        for (const DocumentOrdinal document : removed) {
+            documents.erase(document);
+        }
+        assert(IsIndexOfDocuments(index, documents, 0.0));
+    }
+    index.Compact();
+    assert(IsIndexOfDocuments(index, documents, 0.0));
+    set<string> words;
+    for (const auto& [document, document_words] : documents) {
+        words.insert(document_words.begin(), document_words.end());
+    }
+    assert(index.GetTermCount() == words.size());
+
+    const set<string> stop_words = {"w0"s};
+    SearchServer search_server("w0"s);
+    map<int, string> texts;
+    for (int id = 0; id < 6000; ++id) {
+        texts[id] = GenerateText(generator, 300, 1 + generator() % 10);
+        search_server.AddDocument(id, texts[id], DocumentStatus::ACTUAL, {id % 4});
+        if (id % 2500 == 2499) {
+            search_server.CreateVersion();
+        }
+    }
+    vector<string> queries;
+    for (int i = 0; i < 20; ++i) {
+        queries.push_back(GenerateText(generator, 300, 1 + i % 5) + (i % 3 == 0 ? " -w4"s : ""s));
+    }
+    const auto check_fresh_build = [&] {
+        SearchServer fresh("w0"s);
+        map<int, ReferenceDocument> reference;
+        for (const auto& [id, text] : texts) {
+            fresh.AddDocument(id, text, DocumentStatus::ACTUAL, {id % 4});
+            reference[id] = MakeReferenceDocument(text, stop_words, DocumentStatus::ACTUAL, id % 4);
+        }
+        CheckSameServer(fresh, search_server, reference, stop_words, queries);
+    };
+    for (const bool is_parallel : {false, true}) {
+        // unknown and repeated ids are skipped
+        vector<int> removed = {-5, 100'000};
+        for (int id = 0; id < 6000; ++id) {
+            if (generator() % 4 == 0) {
+                removed.push_back(id);
+                removed.push_back(id);
+                texts.erase(id);
+            }
+        }
+        if (is_parallel) {
+            search_server.RemoveDocuments(execution::par, removed);
+        } else {
+            search_server.RemoveDocuments(removed);
+        }
+        check_fresh_build();
+    }
+    search_server.Compact();
+    check_fresh_build();
+}
+
+// Impact scores of frozen segments put every relevance within the reported
+// bound of the exact one, the finer impacts closer than the coarser ones.
+static void TestImpactScoresWithinErrorBound() {
+    mt19937 generator(19);
+    const set<string> stop_words = {"w0"s};
+    map<int, ReferenceDocument> documents;
+    vector<string> texts;
+    for (int id = 0; id < 5000; ++id) {
+        texts.push_back(GenerateText(generator, 300, 1 + generator() % 30));
+        documents[id] = MakeReferenceDocument(texts.back(), stop_words, DocumentStatus::ACTUAL, 0);
+    }
+    const auto is_any = [](int, DocumentStatus, int) {
+        return true;
+    };
+    vector<unique_ptr<const SearchServer>> versions;
+    for (const ScoringMode scoring_mode : {ScoringMode::IMPACT_8_BIT, ScoringMode::IMPACT_16_BIT}) {
+        SearchServer search_server("w0"s, scoring_mode);
+        for (int id = 0; id < 5000; ++id) {
+            search_server.AddDocument(id, texts[id], DocumentStatus::ACTUAL, {0});
+            if (id % 2000 == 1999) {
+                search_server.CreateVersion();
+            }
+        }
+        // only frozen segments store impacts, the version has no mutable one
+        versions.push_back(search_server.CreateVersion());
+
+        InvertedIndex index(scoring_mode);
+        map<DocumentOrdinal, vector<string>> index_documents;
+        for (DocumentOrdinal document = 0; document < 1000; ++document) {
+            vector<string> words = SplitText(texts[document]);
+            index.AddDocument(document, vector<string_view>(words.begin(), words.end()));
+            index_documents[document] = move(words);
+        }
+        index.Freeze();
+        assert(IsIndexOfDocuments(index, index_documents, 0.5 / (scoring_mode == ScoringMode::IMPACT_8_BIT ? 255 : 65535)));
+    }
+    SearchServer exact("w0"s);
+    for (int id = 0; id < 5000; ++id) {
+        exact.AddDocument(id, texts[id], DocumentStatus::ACTUAL, {0});
+    }
+    exact.CreateVersion();
+
+    for (int i = 0; i < 40; ++i) {
+        const string query = GenerateText(generator, 300, 1 + i % 8);
+        const auto relevance = ComputeReferenceRelevance(documents, stop_words, query);
+        assert(exact.GetRelevanceErrorBound(query) == 0.0);
+        const double bound_8 = versions[0]->GetRelevanceErrorBound(query);
+        const double bound_16 = versions[1]->GetRelevanceErrorBound(query);
+        assert(bound_16 < bound_8 || bound_8 == 0.0);
+        for (size_t mode = 0; mode < versions.size(); ++mode) {
+            const double bound = mode == 0 ? bound_8 : bound_16;
+            const auto found = versions[mode]->FindTopDocuments(execution::seq, query, is_any, 10'000);
+            assert(found.size() == relevance.size());
+            for (const Document& document : found) {
+                assert(abs(document.relevance - relevance.at(document.id)) <= bound + 1e-9);
+            }
+            // the top 10 are the exact top 10 as far as the bound can tell
+            const auto top = versions[mode]->FindTopDocuments(execution::seq, query, is_any, 10);
+            assert(IsSameTop(top, vector<Document>(found.begin(), found.begin() + top.size())));
+            for (const auto& [id, score] : relevance) {
+                assert(top.size() < 10 || score <= top.back().relevance + bound + 1e-6 || any_of(top.begin(), top.end(), [id = id](const Document& document) {
+                    return document.id == id;
+                }));
+            }
+        }
+    }
+}
+
+// Compressed postings decode to the exact postings, so a compressed server
+// finds what an exact one does, across merges, removals and compaction.
+static void TestCompressedMatchesExact() {
+    mt19937 generator(20);
+    InvertedIndex index(ScoringMode::COMPRESSED);
+    map<DocumentOrdinal, vector<string>> documents;
+    for (DocumentOrdinal document = 0; document < 8000; ++document) {
+        // long documents too, so word counts need more bits
+        vector<string> words = SplitText(GenerateText(generator, document % 100 == 0 ? 20 : 2000, 1 + generator() % (document % 100 == 0 ? 3000 : 12)));
+        index.AddDocument(document, vector<string_view>(words.begin(), words.end()));
+        documents[document] = move(words);
+        if (document % 700 == 699) {
+            index.Freeze();
+        }
+        if (document % 5 == 0) {
+            const DocumentOrdinal removed = generator() % (document + 1);
+            index.RemoveDocument(removed);
+            documents.erase(removed);
+        }
+    }
+    index.Freeze();
+    assert(IsIndexOfDocuments(index, documents, 0.0));
+    index.Compact();
+    assert(IsIndexOfDocuments(index, documents, 0.0));
+
+    const auto is_any = [](int, DocumentStatus, int) {
+        return true;
+    };
+    SearchServer exact("w0"s);
+    SearchServer compressed("w0"s, ScoringMode::COMPRESSED);
+    for (int id = 0; id < 8000; ++id) {
+        const string text = GenerateText(generator, 400, 1 + generator() % 16);
+        exact.AddDocument(id, text, DocumentStatus::ACTUAL, {id % 3});
+        compressed.AddDocument(id, text, DocumentStatus::ACTUAL, {id % 3});
+        if (id % 3000 == 2999) {
+            compressed.CreateVersion();
+        }
+    }
+    for (int id = 0; id < 8000; id += 13) {
+        exact.RemoveDocument(id);
+        compressed.RemoveDocument(id);
+    }
+    const auto version = compressed.CreateVersion();
+    for (int i = 0; i < 40; ++i) {
+        const string query = GenerateText(generator, 400, 1 + i % 8) + (i % 4 == 0 ? " -w2"s : ""s);
+        const auto expected = exact.FindTopDocuments(execution::seq, query, is_any, 30);
+        assert(IsSameTop(version->FindTopDocuments(execution::seq, query, is_any, 30), expected));
+        assert(IsSameTop(version->FindTopDocuments(execution::par, query, is_any, 30), expected));
+        assert(IsSameTop(version->FindTopDocuments(block_max_wand, query, is_any, 30), expected));
+        assert(version->GetRelevanceErrorBound(query) == 0.0);
+    }
+}
+
+// Every query times each stage once, from whichever thread runs it, and
+// the ingestion counters add up the documents, words and postings changed.
+static void TestMetricsCountStagesAndIngestion() {
+    mt19937 generator(22);
+    MetricsRegistry& registry = MetricsRegistry::Get();
+    registry.Reset();
+    SearchServer search_server("w0"s);
+    set<string> words;
+    map<int, size_t> distinct_word_counts;
+    for (int id = 0; id < 500; ++id) {
+        const vector<string> document_words = SplitText(GenerateText(generator, 1000, 1 + generator() % 10));
+        string text;
+        set<string> distinct_words;
+        for (const string& word : document_words) {
+            text += word + ' ';
+            if (word != "w0"s) {
+                distinct_words.insert(word);
+            }
+        }
+        search_server.AddDocument(id, text, DocumentStatus::ACTUAL, {1});
+        words.insert(distinct_words.begin(), distinct_words.end());
+        distinct_word_counts[id] = distinct_words.size();
+    }
+    MetricsSnapshot snapshot = registry.GetSnapshot();
+    const auto get_counter = [&snapshot](IngestionCounter counter) {
+        return snapshot.counters[static_cast<size_t>(counter)];
+    };
+    size_t posting_count = 0;
+    for (const auto& [id, count] : distinct_word_counts) {
+        posting_count += count;
+    }
+    assert(get_counter(IngestionCounter::DOCUMENTS_ADDED) == 500 && get_counter(IngestionCounter::TERMS_ADDED) == words.size());
+    assert(get_counter(IngestionCounter::POSTINGS_ADDED) == posting_count);
+    for (const auto& stage : snapshot.stages) {
+        assert(stage.count == 0);
+    }
+
+    // removing a document twice or an unknown one counts nothing
+    size_t removed_posting_count = 0;
+    for (int id = 0; id < 500; id += 3) {
+        search_server.RemoveDocument(id);
+        search_server.RemoveDocument(id);
+        removed_posting_count += distinct_word_counts[id];
+    }
+    search_server.RemoveDocuments({1, 4, 1, 10'000});
+    removed_posting_count += distinct_word_counts[1] + distinct_word_counts[4];
+    snapshot = registry.GetSnapshot();
+    assert(get_counter(IngestionCounter::DOCUMENTS_REMOVED) == 167 + 2);
+    assert(get_counter(IngestionCounter::POSTINGS_REMOVED) == removed_posting_count);
+    set<string> live_words;
+    for (const int id : search_server) {
+        for (const auto& [word, freq] : search_server.GetWordFrequencies(id)) {
+            live_words.emplace(word);
+        }
+    }
+    search_server.Compact();
+    snapshot = registry.GetSnapshot();
+    assert(get_counter(IngestionCounter::TERMS_REMOVED) == words.size() - live_words.size());
+
+    // sequential queries from several threads, then nothing while disabled
+    registry.Reset();
+    vector<thread> threads;
+    for (int t = 0; t < 3; ++t) {
+        threads.emplace_back([&search_server, t] {
+            for (int i = 0; i < 50; ++i) {
+                search_server.FindTopDocuments("w"s + to_string(t * 50 + i) + " w7 -w3"s);
+            }
+        });
+    }
+    for (thread& thread : threads) {
+        thread.join();
+    }
+    registry.SetEnabled(false);
+    search_server.FindTopDocuments("w1 w2"s);
+    search_server.AddDocument(10'001, "w1 w2"s, DocumentStatus::ACTUAL, {1});
+    registry.SetEnabled(true);
+    snapshot = registry.GetSnapshot();
+    for (const LatencyHistogram& stage : snapshot.stages) {
+        assert(stage.count == 150);
+        assert(accumulate(stage.buckets.begin(), stage.buckets.end(), uint64_t{0}) == 150);
+        assert(stage.GetPercentile(50) <= stage.GetPercentile(99) && stage.GetPercentile(99) > 0);
+    }
+    for (const uint64_t counter : snapshot.counters) {
+        assert(counter == 0);
+    }
+    ostringstream json;
+    snapshot.WriteJson(json);
+    for (size_t stage = 0; stage < QUERY_STAGE_COUNT; ++stage) {
+        assert(json.str().find(GetStageName(static_cast<QueryStage>(stage))) != string::npos);
+    }
+}
+
+// Window statistics count what a log of every request made counts over the
+// same buckets, for windows ending now or in the past, within the ring or
+// reaching out of it.
+static void TestRequestWindowStatsMatchLog() {
+    struct LoggedRequest {
+        int64_t bucket;
+        bool is_empty;
+    };
+    mt19937 generator(23);
+    const SearchServer search_server("and"s);
+    // requests sit in the middle of their buckets, far from the edges
+    const auto bucket_duration = chrono::seconds(1);
+    for (int round = 0; round < 20; ++round) {
+        const size_t bucket_count = 1 + generator() % 8;
+        RequestQueue request_queue(search_server, bucket_duration, bucket_count);
+        const auto start_time = RequestQueue::Clock::now();
+        const auto get_time = [&](int64_t bucket) {
+            return start_time + bucket * bucket_duration + bucket_duration / 2;
+        };
+        deque<LoggedRequest> log;
+        int64_t bucket = 0;
+        for (int i = 0; i < 300; ++i) {
+            bucket += generator() % 3 == 0 ? generator() % 4 : 0;
+            const bool is_empty = generator() % 2 == 0;
+            request_queue.RecordRequest(is_empty, chrono::microseconds(1 + generator() % 100), get_time(bucket));
+            log.push_back({bucket, is_empty});
+            const int64_t first_kept = bucket - static_cast<int64_t>(bucket_count) + 1;
+
+            uint64_t ring_no_result_count = 0;
+            for (const LoggedRequest& request : log) {
+                ring_no_result_count += request.bucket >= first_kept && request.is_empty;
+            }
+            assert(request_queue.GetWindowStats(bucket_count * bucket_duration, get_time(bucket)).no_result_count == ring_no_result_count);
+
+            for (int j = 0; j < 3; ++j) {
+                // a window ending up to a few buckets before the newest one
+                const int64_t last = max<int64_t>(0, bucket - generator() % 12);
+                const int64_t window_bucket_count = 1 + generator() % 10;
+                const auto stats = request_queue.GetWindowStats(window_bucket_count * bucket_duration, get_time(last));
+                uint64_t request_count = 0;
+                uint64_t no_result_count = 0;
+                // the ring has to hold the bucket after the window, unless the window ends now
+                if (last == bucket || last + 1 >= first_kept) {
+                    for (const LoggedRequest& request : log) {
+                        if (request.bucket >= max(last - window_bucket_count + 1, first_kept) && request.bucket <= last) {
+                            ++request_count;
+                            no_result_count += request.is_empty;
+                        }
+                    }
+                }
+                assert(stats.request_count == request_count && stats.no_result_count == no_result_count);
+                assert(accumulate(stats.latency_counts.begin(), stats.latency_counts.end(), uint64_t{0}) == request_count);
+                assert((stats.GetLatencyPercentile(100) == RequestQueue::Clock::duration::zero()) == (request_count == 0));
+                assert(stats.GetLatencyPercentile(100) <= chrono::microseconds(128));
+            }
+            while (log.front().bucket < first_kept) {
+                log.pop_front();
+            }
+        }
+    }
+}
+
+void RunSearchServerTests() {
+    TestPruningMatchesExhaustiveScoring();
+    cout << "TestPruningMatchesExhaustiveScoring OK"s << endl;
+    TestSnapshotRoundTrip();
+    cout << "TestSnapshotRoundTrip OK"s << endl;
+    TestConcurrentReadersSeePublishedVersions();
+    cout << "TestConcurrentReadersSeePublishedVersions OK"s << endl;
+    TestQueryExecutorBatches();
+    cout << "TestQueryExecutorBatches OK"s << endl;
+    TestPagesMatchFullRanking();
+    cout << "TestPagesMatchFullRanking OK"s << endl;
+    TestPhrasesMatchTextScan();
+    cout << "TestPhrasesMatchTextScan OK"s << endl;
+    TestIndexMatchesDocumentWords();
+    cout << "TestIndexMatchesDocumentWords OK"s << endl;
+    TestTermDictionaryMatchesMap();
+    cout << "TestTermDictionaryMatchesMap OK"s << endl;
+    TestTopDocumentsMatchFullSort();
+    cout << "TestTopDocumentsMatchFullSort OK"s << endl;
+    TestScoringWorkspaceReuse();
+    cout << "TestScoringWorkspaceReuse OK"s << endl;
+    TestParallelScoringMatchesSequential();
+    cout << "TestParallelScoringMatchesSequential OK"s << endl;
+    TestForEachWordMatchesSplitIntoWords();
+    cout << "TestForEachWordMatchesSplitIntoWords OK"s << endl;
+    TestAddDocumentsMatchesAddDocument();
+    cout << "TestAddDocumentsMatchesAddDocument OK"s << endl;
+    TestSegmentsMatchSingleSegment();
+    cout << "TestSegmentsMatchSingleSegment OK"s << endl;
+    TestQueryCacheInvalidation();
+    cout << "TestQueryCacheInvalidation OK"s << endl;
+    TestPreparedQueriesMatchRawQueries();
+    cout << "TestPreparedQueriesMatchRawQueries OK"s << endl;
+    TestMatchDocumentsMatchesMatchDocument();
+    cout << "TestMatchDocumentsMatchesMatchDocument OK"s << endl;
+    TestJoinedResultsMatchProcessQueries();
+    cout << "TestJoinedResultsMatchProcessQueries OK"s << endl;
+    TestDuplicatesMatchWordSets();
+    cout << "TestDuplicatesMatchWordSets OK"s << endl;
+    TestRemoveDocumentsMatchesFreshBuild();
+    cout << "TestRemoveDocumentsMatchesFreshBuild OK"s << endl;
+    TestImpactScoresWithinErrorBound();
+    cout << "TestImpactScoresWithinErrorBound OK"s << endl;
+    TestCompressedMatchesExact();
+    cout << "TestCompressedMatchesExact OK"s << endl;
+    TestMetricsCountStagesAndIngestion();
+    cout << "TestMetricsCountStagesAndIngestion OK"s << endl;
+    TestRequestWindowStatsMatchLog();
+    cout << "TestRequestWindowStatsMatchLog OK"s << endl;
+}
@@ -0,0 +1,5 @@
+#pragma once
+
+// Behaviour tests of the search server, each checking results against a
+// brute-force reference. Failures abort through assert; main --test runs them.
+void RunSearchServerTests();
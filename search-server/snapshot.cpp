@@ -0,0 +1,58 @@
+#include "snapshot.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+using namespace std;
+
+SnapshotWriter::SnapshotWriter(const string& path)
+    : path_(path)
+    , temporary_path_(path + ".tmp"s)
+    , output_(temporary_path_, ios::binary | ios::trunc) {
+    if (!output_) {
+        throw runtime_error("Cannot create "s + temporary_path_);
+    }
+    // the header is rewritten with the section table on Finish
+    output_.write(reinterpret_cast<const char*>(&header_), sizeof(header_));
+    offset_ = sizeof(header_);
+}
+
+void SnapshotWriter::WriteBytes(SnapshotSection section, const char* data, size_t size) {
+    static const char padding[SnapshotHeader::ALIGNMENT] = {};
+    const size_t padding_size = (SnapshotHeader::ALIGNMENT - offset_ % SnapshotHeader::ALIGNMENT) % SnapshotHeader::ALIGNMENT;
+    output_.write(padding, padding_size);
+    offset_ += padding_size;
+    header_.sections[static_cast<size_t>(section)] = {offset_, size};
+    output_.write(data, size);
+    offset_ += size;
+}
+
+void SnapshotWriter::Finish() {
+    copy(begin(SnapshotHeader::MAGIC), end(SnapshotHeader::MAGIC), header_.magic);
+    header_.version = SnapshotHeader::VERSION;
+    header_.endianness = SnapshotHeader::ENDIANNESS;
+    output_.seekp(0);
+    output_.write(reinterpret_cast<const char*>(&header_), sizeof(header_));
+    output_.close();
+    if (!output_ || rename(temporary_path_.c_str(), path_.c_str()) != 0) {
+        throw runtime_error("Cannot write "s + path_);
+    }
+}
+
+Snapshot::Snapshot(const string& path)
+    : file_(path) {
+    if (file_.size() < sizeof(header_)) {
+        throw invalid_argument("Invalid snapshot "s + path);
+    }
+    memcpy(&header_, file_.data(), sizeof(header_));
+    if (!equal(begin(SnapshotHeader::MAGIC), end(SnapshotHeader::MAGIC), header_.magic)
+        || header_.version != SnapshotHeader::VERSION || header_.endianness != SnapshotHeader::ENDIANNESS) {
+        throw invalid_argument("Unsupported snapshot "s + path);
+    }
+    for (const auto [offset, size] : header_.sections) {
+        if (offset % SnapshotHeader::ALIGNMENT != 0 || offset > file_.size() || size > file_.size() - offset) {
+            throw invalid_argument("Invalid snapshot "s + path);
+        }
+    }
+}
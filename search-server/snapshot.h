@@ -0,0 +1,105 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+#include "array_view.h"
+#include "mapped_file.h"
+
+// Arrays stored in a snapshot file. Every section is a flat array of
+// trivially copyable values in native byte order.
+enum class SnapshotSection : uint32_t {
+    STOP_WORD_OFFSETS,
+    STOP_WORD_BYTES,
+    TERM_OFFSETS,
+    TERM_BYTES,
+    TERM_SLOTS,
+    POSTING_OFFSETS,
+    POSTING_DOCUMENTS,
+    POSTING_FREQS,
+    POSTING_MAX_FREQS,
+    BLOCK_OFFSETS,
+    BLOCK_MAX_FREQS,
+    DOCUMENT_TERM_OFFSETS,
+    DOCUMENT_TERMS,
+    DOCUMENTS,
+    DOCUMENT_IDS,
+    POSITION_OFFSETS,
+    POSITION_BYTES,
+    COUNT,
+};
+
+// Layout of a snapshot file: the header, then 8-byte aligned sections.
+// Bump VERSION whenever a section changes its meaning or layout.
+struct SnapshotHeader {
+    static constexpr char MAGIC[8] = {'S', 'S', 'N', 'A', 'P', 'S', 'H', 'T'};
+    static constexpr uint32_t VERSION = 2;
+    static constexpr uint32_t ENDIANNESS = 0x01020304;
+    static constexpr size_t ALIGNMENT = 8;
+
+    struct Section {
+        uint64_t offset = 0;
+        uint64_t size = 0;
+    };
+
+    char magic[8] = {};
+    uint32_t version = 0;
+    uint32_t endianness = 0;
+    std::array<Section, static_cast<size_t>(SnapshotSection::COUNT)> sections = {};
+};
+
+// Writes a snapshot to a temporary file that replaces path on Finish, so
+// processes that have the old snapshot mapped keep reading consistent pages.
+class SnapshotWriter {
+public:
+    explicit SnapshotWriter(const std::string& path);
+
+    template <typename T>
+    void Write(SnapshotSection section, ArrayView<T> values);
+
+    void Finish();
+
+private:
+    std::string path_;
+    std::string temporary_path_;
+    std::ofstream output_;
+    SnapshotHeader header_;
+    uint64_t offset_ = 0;
+
+    void WriteBytes(SnapshotSection section, const char* data, size_t size);
+};
+
+// A snapshot file mapped into memory. Sections are handed out as views into
+// the mapped pages, nothing is copied or decoded. Opening only checks the
+// header, so it takes the same time for any corpus size.
+class Snapshot {
+public:
+    explicit Snapshot(const std::string& path);
+
+    template <typename T>
+    ArrayView<T> Get(SnapshotSection section) const;
+
+private:
+    MappedFile file_;
+    SnapshotHeader header_;
+};
+
+template <typename T>
+void SnapshotWriter::Write(SnapshotSection section, ArrayView<T> values) {
+    static_assert(std::is_trivially_copyable_v<T> && alignof(T) <= SnapshotHeader::ALIGNMENT);
+    WriteBytes(section, reinterpret_cast<const char*>(values.data()), values.size() * sizeof(T));
+}
+
+template <typename T>
+ArrayView<T> Snapshot::Get(SnapshotSection section) const {
+    static_assert(std::is_trivially_copyable_v<T> && alignof(T) <= SnapshotHeader::ALIGNMENT);
+    const auto [offset, size] = header_.sections[static_cast<size_t>(section)];
+    if (size % sizeof(T) != 0) {
+        throw std::invalid_argument("Invalid snapshot section size");
+    }
+    return {reinterpret_cast<const T*>(file_.data() + offset), size / sizeof(T)};
+}
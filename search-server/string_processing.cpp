@@ -2,6 +2,11 @@
 #include "log_duration.h"
 
 #include <iostream>
+
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
 using namespace std;
 
 
@@ -23,4 +28,35 @@ vector<string> SplitIntoWords(const string_view text) {
     }
 
     return words;
-}
\ No newline at end of file
+}
+TextBlockMasks ScanTextBlock(const char* data, size_t size) {
+    TextBlockMasks masks{0, 0};
+    size_t pos = 0;
+#if defined(__AVX2__)
+    const __m256i space = _mm256_set1_epi8(' ');
+    const __m256i minus_one = _mm256_set1_epi8(-1);
+    for (; pos + 32 <= size; pos += 32) {
+        const __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + pos));
+        // control characters are the signed bytes in [0, ' ')
+        const __m256i controls = _mm256_and_si256(_mm256_cmpgt_epi8(bytes, minus_one), _mm256_cmpgt_epi8(space, bytes));
+        masks.spaces |= uint64_t{static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, space)))} << pos;
+        masks.controls |= uint64_t{static_cast<uint32_t>(_mm256_movemask_epi8(controls))} << pos;
+    }
+#elif defined(__SSE2__) || defined(_M_X64)
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i minus_one = _mm_set1_epi8(-1);
+    for (; pos + 16 <= size; pos += 16) {
+        const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + pos));
+        // control characters are the signed bytes in [0, ' ')
+        const __m128i controls = _mm_and_si128(_mm_cmpgt_epi8(bytes, minus_one), _mm_cmplt_epi8(bytes, space));
+        masks.spaces |= uint64_t{static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, space)))} << pos;
+        masks.controls |= uint64_t{static_cast<uint32_t>(_mm_movemask_epi8(controls))} << pos;
+    }
+#endif
+    for (; pos < size; ++pos) {
+        const char c = data[pos];
+        masks.spaces |= uint64_t{c == ' '} << pos;
+        masks.controls |= uint64_t{c >= '\0' && c < ' '} << pos;
+    }
+    return masks;
+}
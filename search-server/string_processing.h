@@ -1,11 +1,85 @@
 #pragma once
 
+#include <algorithm>
+#include <cstdint>
 #include <vector>
 #include <string>
+#include <string_view>
 #include <set>
 
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
 std::vector<std::string> SplitIntoWords(const std::string_view text);
 
+// Masks over a block of up to TEXT_BLOCK_SIZE bytes of text:
+// bit i is set when byte i is a space or a control character.
+struct TextBlockMasks {
+    uint64_t spaces;
+    uint64_t controls;
+};
+
+constexpr size_t TEXT_BLOCK_SIZE = 64;
+
+// Uses AVX2 or SSE2 when the target has them and plain loops otherwise.
+TextBlockMasks ScanTextBlock(const char* data, size_t size);
+
+inline size_t CountTrailingZeros(uint64_t bits) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward64(&index, bits);
+    return index;
+#else
+    return __builtin_ctzll(bits);
+#endif
+}
+
+// Calls callback(word, is_valid) for every space-separated word of text.
+// Words are views into text; is_valid is false if the word holds a control
+// character. Delimiters and control characters are found in the same pass,
+// TEXT_BLOCK_SIZE bytes at a time.
+template <typename Callback>
+void ForEachWord(std::string_view text, Callback callback) {
+    size_t word_begin = 0;
+    bool in_word = false;
+    bool has_controls = false;
+    for (size_t block_begin = 0; block_begin < text.size(); block_begin += TEXT_BLOCK_SIZE) {
+        const size_t block_size = std::min(TEXT_BLOCK_SIZE, text.size() - block_begin);
+        const TextBlockMasks masks = ScanTextBlock(text.data() + block_begin, block_size);
+        // bytes past the end of text count as spaces, so the last word ends inside its block
+        const uint64_t spaces = block_size < TEXT_BLOCK_SIZE ? masks.spaces | (~uint64_t{0} << block_size) : masks.spaces;
+
+        size_t offset = 0;
+        while (offset < block_size) {
+            if (!in_word) {
+                const uint64_t letters = ~spaces >> offset;
+                if (letters == 0) {
+                    break;
+                }
+                offset += CountTrailingZeros(letters);
+                word_begin = block_begin + offset;
+                in_word = true;
+                has_controls = false;
+            }
+            const uint64_t rest = spaces >> offset;
+            const size_t word_end = rest == 0 ? TEXT_BLOCK_SIZE : offset + CountTrailingZeros(rest);
+            const uint64_t word_bits = (word_end == TEXT_BLOCK_SIZE ? ~uint64_t{0} : (uint64_t{1} << word_end) - 1) & (~uint64_t{0} << offset);
+            has_controls = has_controls || (masks.controls & word_bits) != 0;
+            if (rest == 0) {
+                // the word goes on in the next block
+                break;
+            }
+            callback(text.substr(word_begin, block_begin + word_end - word_begin), !has_controls);
+            in_word = false;
+            offset = word_end + 1;
+        }
+    }
+    if (in_word) {
+        callback(text.substr(word_begin), !has_controls);
+    }
+}
+
 template <typename StringContainer>
 std::set<std::string> MakeUniqueNonEmptyStrings(const StringContainer& strings) {
     std::set<std::string> non_empty_strings;
@@ -0,0 +1,143 @@
+#include "term_dictionary.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <iterator>
+
+using namespace std;
+
+TermDictionary::TermDictionary(const TermDictionary& other)
+    : slots_(other.slots_)
+    , terms_(other.terms_)
+    , chunks_(other.chunks_) {
+    // chunk_used_ starts full: the copy stores its own terms in new chunks, never in one the original still fills
+}
+
+TermId TermDictionary::Insert(string_view term) {
+    const uint32_t hash = Hash(term);
+    if (!slots_.empty()) {
+        const size_t slot = FindSlot(term, hash);
+        if (slots_[slot].term != EMPTY_SLOT) {
+            return slots_[slot].term;
+        }
+    }
+    // keep the load factor under 1/2 so probe sequences stay short
+    if ((terms_.size() + 1) * 2 > slots_.size()) {
+        Rehash(max<size_t>(16, slots_.size() * 2));
+    }
+    const TermId term_id = static_cast<TermId>(terms_.size());
+    terms_.push_back(Store(term));
+    slots_[FindSlot(term, hash)] = {hash, term_id};
+    return term_id;
+}
+
+const TermId* TermDictionary::Find(string_view term) const {
+    if (slots_.empty()) {
+        return nullptr;
+    }
+    const Slot& slot = slots_[FindSlot(term, Hash(term))];
+    return slot.term == EMPTY_SLOT ? nullptr : &slot.term;
+}
+
+bool TermDictionary::Contains(string_view term) const {
+    return Find(term) != nullptr;
+}
+
+size_t TermDictionary::GetMemoryUsage() const {
+    return slots_.capacity() * sizeof(Slot) + terms_.capacity() * sizeof(string_view) + chunks_.size() * CHUNK_SIZE;
+}
+
+uint32_t TermDictionary::Hash(string_view term) {
+    uint32_t hash = 2166136261u;
+    for (const char c : term) {
+        hash = (hash ^ static_cast<unsigned char>(c)) * 16777619u;
+    }
+    return hash;
+}
+
+size_t TermDictionary::FindSlot(string_view term, uint32_t hash) const {
+    const size_t mask = slots_.size() - 1;
+    for (size_t slot = hash & mask;; slot = (slot + 1) & mask) {
+        const Slot& candidate = slots_[slot];
+        if (candidate.term == EMPTY_SLOT || (candidate.hash == hash && terms_[candidate.term] == term)) {
+            return slot;
+        }
+    }
+}
+
+string_view TermDictionary::Store(string_view term) {
+    if (term.size() > CHUNK_SIZE) {
+        // oversized terms get a chunk of their own, the partially filled one stays last
+        shared_ptr<char[]> chunk(new char[term.size()]);
+        memcpy(chunk.get(), term.data(), term.size());
+        const char* data = chunk.get();
+        chunks_.insert(chunks_.empty() ? chunks_.end() : prev(chunks_.end()), move(chunk));
+        return {data, term.size()};
+    }
+    if (chunk_used_ + term.size() > CHUNK_SIZE) {
+        chunks_.emplace_back(new char[CHUNK_SIZE]);
+        chunk_used_ = 0;
+    }
+    char* data = chunks_.back().get() + chunk_used_;
+    memcpy(data, term.data(), term.size());
+    chunk_used_ += term.size();
+    return {data, term.size()};
+}
+
+void TermDictionary::Rehash(size_t slot_count) {
+    vector<Slot> slots(slot_count);
+    const size_t mask = slot_count - 1;
+    for (const Slot& slot : slots_) {
+        if (slot.term == EMPTY_SLOT) {
+            continue;
+        }
+        size_t position = slot.hash & mask;
+        while (slots[position].term != EMPTY_SLOT) {
+            position = (position + 1) & mask;
+        }
+        slots[position] = slot;
+    }
+    slots_.swap(slots);
+}
+
+FrozenTermDictionary::FrozenTermDictionary(ArrayView<TermDictionary::Slot> slots, ArrayView<uint64_t> offsets, ArrayView<char> bytes)
+    : slots_(slots)
+    , offsets_(offsets)
+    , bytes_(bytes) {
+    const bool is_power_of_two = (slots_.size() & (slots_.size() - 1)) == 0;
+    if (!is_power_of_two || (size() > 0 && size() >= slots_.size())
+        || (!offsets_.empty() && (offsets_[0] != 0 || offsets_.back() != bytes_.size() || !is_sorted(offsets_.begin(), offsets_.end())))) {
+        throw invalid_argument("Invalid term dictionary");
+    }
+    // a slot per term, so probes end at an empty one
+    size_t used_slot_count = 0;
+    for (const TermDictionary::Slot& slot : slots_) {
+        if (slot.term != TermDictionary::EMPTY_SLOT) {
+            if (slot.term >= size()) {
+                throw invalid_argument("Invalid term dictionary");
+            }
+            ++used_slot_count;
+        }
+    }
+    if (used_slot_count != size()) {
+        throw invalid_argument("Invalid term dictionary");
+    }
+}
+
+const TermId* FrozenTermDictionary::Find(string_view term) const {
+    if (slots_.empty()) {
+        return nullptr;
+    }
+    const uint32_t hash = TermDictionary::Hash(term);
+    const size_t mask = slots_.size() - 1;
+    for (size_t slot = hash & mask;; slot = (slot + 1) & mask) {
+        const TermDictionary::Slot& candidate = slots_[slot];
+        if (candidate.term == TermDictionary::EMPTY_SLOT) {
+            return nullptr;
+        }
+        if (candidate.hash == hash && GetTerm(candidate.term) == term) {
+            return &candidate.term;
+        }
+    }
+}
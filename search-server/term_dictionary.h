@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+#include "array_view.h"
+
+using TermId = uint32_t;
+
+// Open-addressing hash table mapping terms to dense ids.
+// Lookups take std::string_view and never allocate. Term bytes live in
+// fixed-size chunks, so views handed out by GetTerm stay valid for the
+// lifetime of the dictionary. Copies share the chunks of the original.
+class TermDictionary {
+public:
+    static constexpr TermId EMPTY_SLOT = UINT32_MAX;
+
+    struct Slot {
+        uint32_t hash;
+        TermId term = EMPTY_SLOT;
+    };
+
+    TermDictionary() = default;
+    TermDictionary(const TermDictionary& other);
+    TermDictionary& operator=(const TermDictionary&) = delete;
+    TermDictionary& operator=(TermDictionary&&) = default;
+
+    template <typename StringContainer>
+    explicit TermDictionary(const StringContainer& terms);
+
+    TermId Insert(std::string_view term);
+    const TermId* Find(std::string_view term) const;
+    bool Contains(std::string_view term) const;
+
+    std::string_view GetTerm(TermId term) const {
+        return terms_[term];
+    }
+
+    size_t size() const {
+        return terms_.size();
+    }
+
+    auto begin() const {
+        return terms_.begin();
+    }
+
+    auto end() const {
+        return terms_.end();
+    }
+
+    // The probe table, a power of two in size and at most half full.
+    ArrayView<Slot> GetSlots() const {
+        return slots_;
+    }
+
+    size_t GetMemoryUsage() const;
+
+    // FNV-1a: unlike std::hash it is the same in every build, so slot tables can be stored.
+    static uint32_t Hash(std::string_view term);
+
+private:
+    static constexpr size_t CHUNK_SIZE = 64 * 1024;
+
+    std::vector<Slot> slots_;
+    std::vector<std::string_view> terms_;
+    std::vector<std::shared_ptr<char[]>> chunks_;
+    size_t chunk_used_ = CHUNK_SIZE;
+
+    size_t FindSlot(std::string_view term, uint32_t hash) const;
+    std::string_view Store(std::string_view term);
+    void Rehash(size_t slot_count);
+};
+
+// Read-only TermDictionary stored in a snapshot: its slot table plus the
+// bytes of all terms, term i being bytes[offsets[i], offsets[i + 1]).
+class FrozenTermDictionary {
+public:
+    FrozenTermDictionary() = default;
+    FrozenTermDictionary(ArrayView<TermDictionary::Slot> slots, ArrayView<uint64_t> offsets, ArrayView<char> bytes);
+
+    const TermId* Find(std::string_view term) const;
+
+    std::string_view GetTerm(TermId term) const {
+        return {bytes_.data() + offsets_[term], offsets_[term + 1] - offsets_[term]};
+    }
+
+    size_t size() const {
+        return offsets_.empty() ? 0 : offsets_.size() - 1;
+    }
+
+private:
+    ArrayView<TermDictionary::Slot> slots_;
+    ArrayView<uint64_t> offsets_;
+    ArrayView<char> bytes_;
+};
+
+template <typename StringContainer>
+TermDictionary::TermDictionary(const StringContainer& terms) {
+    for (const auto& term : terms) {
+        Insert(term);
+    }
+}
@@ -27,10 +27,12 @@ void MatchDocuments(const SearchServer& search_server, const string& query) {
         LOG_DURATION("Operation time");
         cout << "Матчинг документов по запросу: "s << query << endl;
 //        const int document_count = search_server.GetDocumentCount();
-        for (const int document_id : search_server) {
-            const auto [words, status] = search_server.MatchDocument(query, document_id);
-            PrintMatchDocumentResult(document_id, words, status);
-         }
+        const vector<int> document_ids(search_server.begin(), search_server.end());
+        const auto results = search_server.MatchDocuments(query, document_ids);
+        for (size_t i = 0; i < document_ids.size(); ++i) {
+            const auto& [words, status] = results[i];
+            PrintMatchDocumentResult(document_ids[i], words, status);
+        }
     
     } catch (const invalid_argument& e) {
         cout << "Ошибка матчинга документов на запрос "s << query << ": "s << e.what() << endl;
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <optional>
+#include <vector>
+
+#include "document.h"
+
+constexpr double EPSILON = 1e-6;
+
+// Ranking order of search results: relevance first, values closer than
+// EPSILON count as equal and fall back to rating, then to the lower id.
+bool IsMoreRelevant(const Document& lhs, const Document& rhs);
+
+// Keeps the top_count best documents seen so far.
+// The worst kept document sits on top of a bounded heap, so adding a
+// candidate costs O(log top_count) and never grows past top_count.
+// Given a document to search after, only documents ranked below it are kept,
+// which is how a page of results continues the previous one.
+class TopDocuments {
+public:
+    explicit TopDocuments(size_t top_count, std::optional<Document> after = std::nullopt);
+
+    void Add(const Document& document);
+    void Merge(const TopDocuments& other);
+
+    size_t size() const {
+        return heap_.size();
+    }
+
+    size_t GetTopCount() const {
+        return top_count_;
+    }
+
+    const std::optional<Document>& GetAfter() const {
+        return after_;
+    }
+
+    bool IsFull() const {
+        return heap_.size() == top_count_;
+    }
+
+    // The document a candidate has to beat once the collector is full.
+    const Document& GetWorst() const {
+        return heap_.front();
+    }
+
+    // Leaves the collector empty, best document first.
+    std::vector<Document> Extract();
+
+private:
+    size_t top_count_;
+    std::optional<Document> after_;
+    std::vector<Document> heap_;
+};